@@ -84,6 +84,34 @@ extern "C" {
 
    #define LZHAM_MAX_HELPER_THREADS 64
 
+   // Range of the optional lzham_compress_params::m_match_hash_bits override.
+   #define LZHAM_MIN_MATCH_HASH_BITS 16
+   #define LZHAM_MAX_MATCH_HASH_BITS 24
+
+   // Ranges of the optional lzham_compress_params::m_max_parse_threads and m_parse_graph_size overrides.
+   #define LZHAM_MAX_PARSE_THREADS 64
+   #define LZHAM_MIN_PARSE_GRAPH_SIZE 1024
+   #define LZHAM_MAX_PARSE_GRAPH_SIZE 16384
+
+   // Range of the optional lzham_compress_params::m_segment_size_log2 override, see LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS.
+   #define LZHAM_MIN_SEGMENT_SIZE_LOG2 20
+   #define LZHAM_MAX_SEGMENT_SIZE_LOG2 26
+   #define LZHAM_DEFAULT_SEGMENT_SIZE_LOG2 22
+
+   // Last 4 bytes of a stream written with LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS ("LZSI").
+   #define LZHAM_SEGMENT_INDEX_MAGIC 0x49535A4C
+
+   typedef enum
+   {
+      LZHAM_MATCH_FINDER_DEFAULT = 0,        // Hash chains at LZHAM_COMP_LEVEL_FASTEST, binary trees otherwise. LZHAM_COMP_LEVEL_GREEDY and LAZY always use their own hash table.
+      LZHAM_MATCH_FINDER_BINARY_TREE,        // Hashed binary trees, updated incrementally as bytes are added to the dictionary.
+      LZHAM_MATCH_FINDER_HASH_CHAIN,         // Hash chains, 4 bytes per dictionary byte instead of the trees' 8. Only finds the most recent candidates, so best with few probes.
+
+      LZHAM_TOTAL_MATCH_FINDERS,
+
+      LZHAM_MATCH_FINDER_FORCE_DWORD = 0xFFFFFFFF
+   } lzham_match_finder;
+
    typedef enum
    {
       LZHAM_COMP_STATUS_NOT_FINISHED = 0,
@@ -114,12 +142,22 @@ extern "C" {
 
       LZHAM_TOTAL_COMP_LEVELS,
 
+      // Faster than LZHAM_COMP_LEVEL_FASTEST, for when throughput matters more than ratio. These skip the parse graph and the precomputed match
+      // lists: a greedy (or one step lazy) parser probes a single entry hash table as it goes and codes each decision right away. They use no
+      // helper threads, and ignore m_match_finder, m_max_parse_threads, m_parse_graph_size and the parsing and long range matching flags.
+      // Numbered past LZHAM_TOTAL_COMP_LEVELS so the levels above keep their values.
+      LZHAM_COMP_LEVEL_GREEDY = 0x100,
+      LZHAM_COMP_LEVEL_LAZY,
+
       LZHAM_COMP_LEVEL_FORCE_DWORD = 0xFFFFFFFF
    } lzham_compress_level;
 
    // Streaming compression
    typedef void *lzham_compress_state_ptr;
 
+   // A seed dictionary that has been indexed once by lzham_compress_dict_init(), see m_pPrepared_dict.
+   typedef void *lzham_compress_dict_ptr;
+
    typedef enum
    {
       LZHAM_COMP_FLAG_FORCE_POLAR_CODING = 1,      // Forces Polar codes vs. Huffman, for a slight increase in decompression speed.
@@ -131,11 +169,35 @@ extern "C" {
       LZHAM_COMP_FLAG_TRADEOFF_DECOMPRESSION_RATE_FOR_COMP_RATIO = 16,
       
       LZHAM_COMP_FLAG_WRITE_ZLIB_STREAM = 32,
+
+      // Scans each block for repeats of 512+ bytes anywhere in the dictionary, however far back, before the regular match finder runs. Positions
+      // inside one skip the match finder, so duplicated files in archives or backups compress both better and faster with large dictionaries.
+      // Costs a hash table of 4 bytes per 64 dictionary bytes.
+      LZHAM_COMP_FLAG_LONG_RANGE_MATCHING = 64,
+
+      // Maps the match finder's dictionary, trees and match lists straight from the OS (bypassing lzham_set_memory_callbacks()) and asks for
+      // huge pages: explicit 2MB huge pages if any are reserved, otherwise transparent huge pages on Linux, or large pages on Windows if the
+      // process holds SeLockMemoryPrivilege. Mapped prepared dictionaries keep normal pages.
+      LZHAM_COMP_FLAG_LARGE_PAGES = 128,
+
+      // Parse jobs after the first start from a state predicted by a quick greedy parse of the bytes just before them, instead of a partial state
+      // reset code. The predicted match history is patched up while coding if it turns out wrong. Improves ratio when parsing on several threads
+      // and lets the compressor give about half of the helper threads to parsing (see m_max_parse_threads). Only matters when m_max_helper_threads > 0.
+      LZHAM_COMP_FLAG_SPECULATIVE_PARSING = 256,
+
+      // Cuts the input into segments of 1<<m_segment_size_log2 bytes and compresses up to m_max_helper_threads + 1 of them at once, each on one
+      // thread with its own match finder sized for the segment. Every segment after the first resets the decompressor's statistics in its first
+      // compressed block, as LZHAM_FULL_FLUSH does, and can only match the m_segment_prime_size bytes before it. Scales close to linearly with threads on large inputs, at some cost in ratio. The output is an ordinary stream, followed by
+      // an index of the segments that decompressors ignore:
+      //    num_segments x { lzham_uint64 uncompressed offset, lzham_uint64 offset of the segment's first block from the start of the stream }
+      //    lzham_uint32 num_segments, lzham_uint32 m_segment_prime_size, lzham_uint32 LZHAM_SEGMENT_INDEX_MAGIC
+      // All little endian. Segments written with m_segment_prime_size = 0 don't depend on each other's data. Can't be used with seed dictionaries.
+      LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS = 512,
    } lzham_compress_flags;
 
    typedef struct
    {
-      lzham_uint32 m_struct_size;            // set to sizeof(lzham_compress_params)
+      lzham_uint32 m_struct_size;            // set to sizeof(lzham_compress_params) (shorter versions of this struct from older headers are accepted, their missing fields act as 0)
       lzham_uint32 m_dict_size_log2;         // set to the log2(dictionary_size), must range between [LZHAM_MIN_DICT_SIZE_LOG2, LZHAM_MAX_DICT_SIZE_LOG2_X86] for x86 LZHAM_MAX_DICT_SIZE_LOG2_X64 for x64
       lzham_compress_level m_level;          // set to LZHAM_COMP_LEVEL_FASTEST, etc.
       lzham_int32 m_max_helper_threads;      // max # of additional "helper" threads to create, must range between [-1,LZHAM_MAX_HELPER_THREADS], where -1=max practical
@@ -144,6 +206,16 @@ extern "C" {
       lzham_uint32 m_compress_flags;         // optional compression flags (see lzham_compress_flags enum)
       lzham_uint32 m_num_seed_bytes;         // for delta compression (optional) - number of seed bytes pointed to by m_pSeed_bytes
       const void *m_pSeed_bytes;             // for delta compression (optional) - pointer to seed bytes buffer, must be at least m_num_seed_bytes long
+      lzham_uint32 m_match_hash_bits;        // optional: log2 of the match finder's hash table size, [LZHAM_MIN_MATCH_HASH_BITS, LZHAM_MAX_MATCH_HASH_BITS], or 0 to scale it with m_dict_size_log2 and m_level
+      lzham_uint32 m_match_hash_bytes;       // optional: # of leading bytes hashed by the match finder, 3 or 4 (4 is faster on large dictionaries but can't find 3 byte matches), or 0 to choose automatically
+      lzham_compress_dict_ptr m_pPrepared_dict; // for delta compression (optional) - seed dictionary from lzham_compress_dict_init(), replaces m_num_seed_bytes/m_pSeed_bytes (which must be 0/NULL)
+      lzham_uint32 m_match_finder;           // optional: match finder engine (see lzham_match_finder enum), or 0 for the default
+      lzham_uint32 m_numa_node;              // optional: 0 = default placement, otherwise 1 + the NUMA node the match finder's buffers should preferably come from (Linux only, needs LZHAM_COMP_FLAG_LARGE_PAGES)
+      lzham_uint32 m_max_parse_threads;      // optional: max # of parse jobs run at once, [1, LZHAM_MAX_PARSE_THREADS] (limited to m_max_helper_threads + 1), or 0 to choose from the helper thread count and block size
+      lzham_uint32 m_parse_graph_size;       // optional: # of bytes each parse job optimizes at once, [LZHAM_MIN_PARSE_GRAPH_SIZE, LZHAM_MAX_PARSE_GRAPH_SIZE], or 0 for 3072 (less if that would leave parse jobs idle)
+      lzham_uint32 m_segment_size_log2;      // optional: with LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS, log2 of the segment size, [LZHAM_MIN_SEGMENT_SIZE_LOG2, LZHAM_MAX_SEGMENT_SIZE_LOG2], or 0 for LZHAM_DEFAULT_SEGMENT_SIZE_LOG2
+      lzham_uint32 m_segment_prime_size;     // optional: with LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS, # of bytes before each segment its matches may reach back into, up to the dictionary size
+      lzham_uint32 m_target_comp_kb_per_sec; // optional: 0 = off, otherwise the Fastest..Uber levels trade ratio for speed block by block, stepping down as far as the fastest level's match finder and parser settings, to compress at about this many KB (1024 bytes) per second
    } lzham_compress_params;
    
    // Initializes a compressor. Returns a pointer to the compressor's internal state, or NULL on failure.
@@ -153,10 +225,27 @@ extern "C" {
 
    LZHAM_DLL_EXPORT lzham_compress_state_ptr LZHAM_CDECL lzham_compress_reinit(lzham_compress_state_ptr pState);
 
+   // Creates a new compressor that's an exact copy of pState, so a stream can be forked after a shared warm-up (for example a common header
+   // or template) and each copy continued independently. Any compressed data pState hasn't returned yet is returned by both compressors.
+   // The match finder's dictionary and trees are shared copy-on-write where the OS supports it, so this is much cheaper than compressing the
+   // warm-up again. pState must not be in the middle of a lzham_compress() call. Returns NULL on failure. Free the copy with lzham_compress_deinit().
+   LZHAM_DLL_EXPORT lzham_compress_state_ptr LZHAM_CDECL lzham_compress_clone(lzham_compress_state_ptr pState);
+
    // Deinitializes a compressor, releasing all allocated memory.
    // returns adler32 of source data (valid only on success).
    LZHAM_DLL_EXPORT lzham_uint32 LZHAM_CDECL lzham_compress_deinit(lzham_compress_state_ptr pState);
 
+   // Indexes the seed dictionary pointed to by pParams->m_pSeed_bytes once, so any number of compressors (on any thread) can start from it
+   // via m_pPrepared_dict without indexing it again. Compressors map the index copy-on-write where the OS supports it, so their init and
+   // reinit cost doesn't grow with the seed's size. The seed bytes are copied, so the caller's buffer can be freed once this returns.
+   // Compressors using the dictionary must have the same m_dict_size_log2, m_level, m_match_hash_bits, m_match_hash_bytes and m_match_finder,
+   // and must all set or all clear LZHAM_COMP_FLAG_LONG_RANGE_MATCHING.
+   // Returns NULL on failure.
+   LZHAM_DLL_EXPORT lzham_compress_dict_ptr LZHAM_CDECL lzham_compress_dict_init(const lzham_compress_params *pParams);
+
+   // Releases the caller's reference to a prepared dictionary. Compressors still using it keep it alive until they're deinitialized.
+   LZHAM_DLL_EXPORT void LZHAM_CDECL lzham_compress_dict_deinit(lzham_compress_dict_ptr pDict);
+
    // Compresses an arbitrarily sized block of data, writing as much available compressed data as possible to the output buffer. 
    // This method may be called as many times as needed, but for best perf. try not to call it with tiny buffers.
    // pState - Pointer to internal compression state, created by lzham_compress_init.
@@ -239,6 +328,13 @@ extern "C" {
       LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED = 1,
       LZHAM_DECOMP_FLAG_COMPUTE_ADLER32 = 2,
       LZHAM_DECOMP_FLAG_READ_ZLIB_STREAM = 4,
+
+      // Maps the dictionary straight from the OS and asks for huge pages, see LZHAM_COMP_FLAG_LARGE_PAGES. Ignored with LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED.
+      LZHAM_DECOMP_FLAG_LARGE_PAGES = 8,
+
+      // Maps the dictionary's pages twice back to back, so matches that run off its end never have to wrap (Linux only, falls back to mirroring the first
+      // 64KB on demand elsewhere). Takes precedence over LZHAM_DECOMP_FLAG_LARGE_PAGES. Ignored with LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED.
+      LZHAM_DECOMP_FLAG_MIRRORED_DICT = 16,
    } lzham_decompress_flags;
 
    // Decompression parameters structure.
@@ -246,13 +342,21 @@ extern "C" {
    // m_dict_size_log2 MUST match the value used during compression!
    // If m_num_seed_bytes != 0, LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED must not be set (i.e. static "seed" dictionaries are not compatible with unbuffered decompression).
    // The seed buffer's contents and size must match the seed buffer used during compression.
+   // If m_pOutput_ring is set, the decompressor uses it as its dictionary instead of allocating one, and lzham_decompress() hands out output in place
+   // instead of copying it to pOut_buf. It must stay valid (and untouched) until the decompressor is reinitialized or deinitialized. Output byte i
+   // (counting any seed bytes first) lands at m_pOutput_ring[i & (dict_size - 1)], and each call's output is contiguous and never wraps. Any space past
+   // dict_size bytes (up to 64KB is used) mirrors the start of the ring, which speeds up matches that wrap around. LZHAM_DECOMP_FLAG_LARGE_PAGES and
+   // LZHAM_DECOMP_FLAG_MIRRORED_DICT are ignored. Not compatible with LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED, and such decompressors can't be cloned.
    typedef struct
    {
-      lzham_uint32 m_struct_size;            // set to sizeof(lzham_decompress_params)
+      lzham_uint32 m_struct_size;            // set to sizeof(lzham_decompress_params) (shorter versions of this struct from older headers are accepted, their missing fields act as 0)
       lzham_uint32 m_dict_size_log2;         // set to the log2(dictionary_size), must range between [LZHAM_MIN_DICT_SIZE_LOG2, LZHAM_MAX_DICT_SIZE_LOG2_X86] for x86 LZHAM_MAX_DICT_SIZE_LOG2_X64 for x64
       lzham_uint32 m_decompress_flags;       // optional decompression flags (see lzham_decompress_flags enum)
       lzham_uint32 m_num_seed_bytes;         // for delta compression (optional) - number of seed bytes pointed to by m_pSeed_bytes
       const void *m_pSeed_bytes;             // for delta compression (optional) - pointer to seed bytes buffer, must be at least m_num_seed_bytes long
+      lzham_uint32 m_numa_node;              // optional: 0 = default placement, otherwise 1 + the NUMA node the dictionary should preferably come from (Linux only, needs LZHAM_DECOMP_FLAG_LARGE_PAGES)
+      lzham_uint8 *m_pOutput_ring;           // optional: caller owned dictionary/output ring, at least dict_size bytes (see above)
+      lzham_uint32 m_output_ring_size;       // size of m_pOutput_ring in bytes
    } lzham_decompress_params;
    
    // Initializes a decompressor.
@@ -264,6 +368,10 @@ extern "C" {
    // Quickly re-initializes the decompressor to its initial state given an already allocated/initialized state (doesn't do any memory alloc unless necessary).
    LZHAM_DLL_EXPORT lzham_decompress_state_ptr LZHAM_CDECL lzham_decompress_reinit(lzham_decompress_state_ptr pState, const lzham_decompress_params *pParams);
 
+   // Creates a new decompressor that's an exact copy of pState, including its dictionary, so the matching forked streams can be decompressed from
+   // the point they were split. Unbuffered decompressors (LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED) can't be cloned. Returns NULL on failure.
+   LZHAM_DLL_EXPORT lzham_decompress_state_ptr LZHAM_CDECL lzham_decompress_clone(lzham_decompress_state_ptr pState);
+
    // Deinitializes a decompressor.
    // returns adler32 of decompressed data if compute_adler32 was true, otherwise it returns the adler32 from the compressed stream.
    LZHAM_DLL_EXPORT lzham_uint32 LZHAM_CDECL lzham_decompress_deinit(lzham_decompress_state_ptr pState);
@@ -282,6 +390,8 @@ extern "C" {
    // In buffered mode, if the output buffer's size is 0 bytes, the caller is indicating that no more output bytes are expected from the
    //  decompressor. In this case, if the decompressor actually has more bytes you'll receive the LZHAM_DECOMP_STATUS_HAS_MORE_OUTPUT
    //  error (which is recoverable in the buffered case - just call lzham_decompress() again with a non-zero size output buffer).
+   // With m_pOutput_ring, pOut_buf is never written to (and may be NULL). *pOut_buf_size still limits how many bytes are handed out, and on return is
+   //  the number of new bytes in the ring. They stay valid until the next call, after which the decompressor may start overwriting the oldest output.
    LZHAM_DLL_EXPORT lzham_decompress_status_t LZHAM_CDECL lzham_decompress(
       lzham_decompress_state_ptr pState,
       const lzham_uint8 *pIn_buf, size_t *pIn_buf_size,
@@ -600,13 +710,17 @@ extern "C" {
 
    typedef lzham_compress_state_ptr (LZHAM_CDECL *lzham_compress_init_func)(const lzham_compress_params *pParams);
    typedef lzham_compress_state_ptr (LZHAM_CDECL *lzham_compress_reinit_func)(lzham_compress_state_ptr pState);
+   typedef lzham_compress_state_ptr (LZHAM_CDECL *lzham_compress_clone_func)(lzham_compress_state_ptr pState);
    typedef lzham_uint32 (LZHAM_CDECL *lzham_compress_deinit_func)(lzham_compress_state_ptr pState);
+   typedef lzham_compress_dict_ptr (LZHAM_CDECL *lzham_compress_dict_init_func)(const lzham_compress_params *pParams);
+   typedef void (LZHAM_CDECL *lzham_compress_dict_deinit_func)(lzham_compress_dict_ptr pDict);
    typedef lzham_compress_status_t (LZHAM_CDECL *lzham_compress_func)(lzham_compress_state_ptr pState, const lzham_uint8 *pIn_buf, size_t *pIn_buf_size, lzham_uint8 *pOut_buf, size_t *pOut_buf_size, lzham_bool no_more_input_bytes_flag);
    typedef lzham_compress_status_t (LZHAM_CDECL *lzham_compress2_func)(lzham_compress_state_ptr pState, const lzham_uint8 *pIn_buf, size_t *pIn_buf_size, lzham_uint8 *pOut_buf, size_t *pOut_buf_size, lzham_flush_t flush_type);
    typedef lzham_compress_status_t (LZHAM_CDECL *lzham_compress_memory_func)(const lzham_compress_params *pParams, lzham_uint8* pDst_buf, size_t *pDst_len, const lzham_uint8* pSrc_buf, size_t src_len, lzham_uint32 *pAdler32);
 
    typedef lzham_decompress_state_ptr (LZHAM_CDECL *lzham_decompress_init_func)(const lzham_decompress_params *pParams);
    typedef lzham_decompress_state_ptr (LZHAM_CDECL *lzham_decompress_reinit_func)(lzham_compress_state_ptr pState, const lzham_decompress_params *pParams);
+   typedef lzham_decompress_state_ptr (LZHAM_CDECL *lzham_decompress_clone_func)(lzham_decompress_state_ptr pState);
    typedef lzham_uint32 (LZHAM_CDECL *lzham_decompress_deinit_func)(lzham_decompress_state_ptr pState);
    typedef lzham_decompress_status_t (LZHAM_CDECL *lzham_decompress_func)(lzham_decompress_state_ptr pState, const lzham_uint8 *pIn_buf, size_t *pIn_buf_size, lzham_uint8 *pOut_buf, size_t *pOut_buf_size, lzham_bool no_more_input_bytes_flag);
    typedef lzham_decompress_status_t (LZHAM_CDECL *lzham_decompress_memory_func)(const lzham_decompress_params *pParams, lzham_uint8* pDst_buf, size_t *pDst_len, const lzham_uint8* pSrc_buf, size_t src_len, lzham_uint32 *pAdler32);
@@ -656,13 +770,17 @@ public:
       
       this->lzham_compress_init = NULL;
       this->lzham_compress_reinit = NULL;
+      this->lzham_compress_clone = NULL;
       this->lzham_compress_deinit = NULL;
+      this->lzham_compress_dict_init = NULL;
+      this->lzham_compress_dict_deinit = NULL;
       this->lzham_compress = NULL;
       this->lzham_compress2 = NULL;
       this->lzham_compress_memory = NULL;
       
       this->lzham_decompress_init = NULL;
       this->lzham_decompress_reinit = NULL;
+      this->lzham_decompress_clone = NULL;
       this->lzham_decompress_deinit = NULL;
       this->lzham_decompress = NULL;
       this->lzham_decompress_memory = NULL;
@@ -690,13 +808,17 @@ public:
    
    lzham_compress_init_func         lzham_compress_init;
    lzham_compress_reinit_func       lzham_compress_reinit;
+   lzham_compress_clone_func        lzham_compress_clone;
    lzham_compress_deinit_func       lzham_compress_deinit;
+   lzham_compress_dict_init_func    lzham_compress_dict_init;
+   lzham_compress_dict_deinit_func  lzham_compress_dict_deinit;
    lzham_compress_func              lzham_compress;
    lzham_compress2_func             lzham_compress2;
    lzham_compress_memory_func       lzham_compress_memory;
 
    lzham_decompress_init_func       lzham_decompress_init;
    lzham_decompress_reinit_func     lzham_decompress_reinit;
+   lzham_decompress_clone_func      lzham_decompress_clone;
    lzham_decompress_deinit_func     lzham_decompress_deinit;
    lzham_decompress_func            lzham_decompress;
    lzham_decompress_memory_func     lzham_decompress_memory;
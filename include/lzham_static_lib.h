@@ -20,12 +20,17 @@ public:
       this->lzham_get_version = ::lzham_get_version;
       this->lzham_set_memory_callbacks = ::lzham_set_memory_callbacks;
       this->lzham_compress_init = ::lzham_compress_init;
+      this->lzham_compress_reinit = ::lzham_compress_reinit;
+      this->lzham_compress_clone = ::lzham_compress_clone;
       this->lzham_compress_deinit = ::lzham_compress_deinit;
+      this->lzham_compress_dict_init = ::lzham_compress_dict_init;
+      this->lzham_compress_dict_deinit = ::lzham_compress_dict_deinit;
       this->lzham_compress = ::lzham_compress;
       this->lzham_compress2 = ::lzham_compress2;
       this->lzham_compress_memory = ::lzham_compress_memory;
       this->lzham_decompress_init = ::lzham_decompress_init;
       this->lzham_decompress_reinit = ::lzham_decompress_reinit;
+      this->lzham_decompress_clone = ::lzham_decompress_clone;
       this->lzham_decompress_deinit = ::lzham_decompress_deinit;
       this->lzham_decompress = ::lzham_decompress;
       this->lzham_decompress_memory = ::lzham_decompress_memory;
@@ -8,8 +8,14 @@ namespace lzham
    lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_init(const lzham_compress_params *pParams);
    
    lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_reinit(lzham_compress_state_ptr p);
+
+   lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_clone(lzham_compress_state_ptr p);
    
    lzham_uint32 LZHAM_CDECL lzham_lib_compress_deinit(lzham_compress_state_ptr p);
+
+   lzham_compress_dict_ptr LZHAM_CDECL lzham_lib_compress_dict_init(const lzham_compress_params *pParams);
+
+   void LZHAM_CDECL lzham_lib_compress_dict_deinit(lzham_compress_dict_ptr p);
    
    lzham_compress_status_t LZHAM_CDECL lzham_lib_compress(
       lzham_compress_state_ptr p,
@@ -0,0 +1,214 @@
+// File: lzham_cow_memory.cpp
+// See Copyright Notice and license at the end of include/lzham.h
+#include "lzham_core.h"
+#include "lzham_cow_memory.h"
+
+#if LZHAM_USE_WIN32_API && !LZHAM_PLATFORM_X360
+   #define LZHAM_COW_USE_FILE_MAPPING 1
+#elif defined(__linux__)
+   #include <sys/mman.h>
+   #include <sys/syscall.h>
+   #include <unistd.h>
+   #ifdef SYS_memfd_create
+      #define LZHAM_COW_USE_MEMFD 1
+   #endif
+#endif
+
+#ifndef LZHAM_COW_USE_FILE_MAPPING
+   #define LZHAM_COW_USE_FILE_MAPPING 0
+#endif
+#ifndef LZHAM_COW_USE_MEMFD
+   #define LZHAM_COW_USE_MEMFD 0
+#endif
+
+namespace lzham
+{
+#if LZHAM_USE_WIN32_API
+   void* const cow_image::cInvalidHandle = NULL;
+#else
+   const int cow_image::cInvalidHandle;
+#endif
+
+   cow_image::cow_image() :
+      m_pData(NULL),
+      m_size(0),
+      m_handle(cInvalidHandle)
+   {
+   }
+
+   cow_image::~cow_image()
+   {
+      deinit();
+   }
+
+   bool cow_image::init(size_t size)
+   {
+      deinit();
+
+      if (!size)
+         return false;
+
+#if LZHAM_COW_USE_FILE_MAPPING
+      const uint64 size64 = size;
+      HANDLE h = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), NULL);
+      if (h)
+      {
+         void* p = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+         if (p)
+         {
+            m_pData = static_cast<uint8*>(p);
+            m_size = size;
+            m_handle = h;
+            return true;
+         }
+         CloseHandle(h);
+      }
+#elif LZHAM_COW_USE_MEMFD
+      int fd = static_cast<int>(syscall(SYS_memfd_create, "lzham_cow_image", 1U /* MFD_CLOEXEC */));
+      if (fd >= 0)
+      {
+         if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+         {
+            void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED)
+            {
+               m_pData = static_cast<uint8*>(p);
+               m_size = size;
+               m_handle = fd;
+               return true;
+            }
+         }
+         close(fd);
+      }
+#endif
+
+      // No shared memory, so views will have to copy the whole image.
+      m_pData = static_cast<uint8*>(lzham_malloc(size));
+      if (!m_pData)
+         return false;
+      memset(m_pData, 0, size);
+      m_size = size;
+
+      return true;
+   }
+
+   void cow_image::deinit()
+   {
+      if (!m_pData)
+         return;
+
+      if (m_handle != cInvalidHandle)
+      {
+#if LZHAM_COW_USE_FILE_MAPPING
+         UnmapViewOfFile(m_pData);
+         CloseHandle(m_handle);
+#elif LZHAM_COW_USE_MEMFD
+         munmap(m_pData, m_size);
+         close(m_handle);
+#endif
+      }
+      else
+      {
+         lzham_free(m_pData);
+      }
+
+      m_pData = NULL;
+      m_size = 0;
+      m_handle = cInvalidHandle;
+   }
+
+   cow_view::cow_view() :
+      m_pData(NULL),
+      m_size(0),
+      m_alloc_flags(0),
+      m_mapped(false)
+   {
+   }
+
+   cow_view::~cow_view()
+   {
+      free();
+   }
+
+   bool cow_view::alloc(size_t size, uint alloc_flags, int numa_node)
+   {
+      free();
+
+      if (!size)
+         return false;
+
+      m_pData = static_cast<uint8*>(lzham_large_alloc(size, alloc_flags, numa_node));
+      if (!m_pData)
+         return false;
+      m_size = size;
+      m_alloc_flags = alloc_flags;
+
+      return true;
+   }
+
+   bool cow_view::map(const cow_image& image)
+   {
+      free();
+
+      if (!image.m_pData)
+         return false;
+
+#if LZHAM_COW_USE_FILE_MAPPING || LZHAM_COW_USE_MEMFD
+      if (image.m_handle != cow_image::cInvalidHandle)
+      {
+   #if LZHAM_COW_USE_FILE_MAPPING
+         void* p = MapViewOfFile(image.m_handle, FILE_MAP_COPY, 0, 0, image.m_size);
+         if (!p)
+            return false;
+   #else
+         void* p = mmap(NULL, image.m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image.m_handle, 0);
+         if (p == MAP_FAILED)
+            return false;
+   #endif
+         m_pData = static_cast<uint8*>(p);
+         m_size = image.m_size;
+         m_mapped = true;
+         return true;
+      }
+#endif
+
+      if (!alloc(image.m_size))
+         return false;
+      memcpy(m_pData, image.m_pData, image.m_size);
+
+      return true;
+   }
+
+   void cow_view::free()
+   {
+      if (!m_pData)
+         return;
+
+      if (m_mapped)
+      {
+#if LZHAM_COW_USE_FILE_MAPPING
+         UnmapViewOfFile(m_pData);
+#elif LZHAM_COW_USE_MEMFD
+         munmap(m_pData, m_size);
+#endif
+      }
+      else
+      {
+         lzham_large_free(m_pData, m_size, m_alloc_flags);
+      }
+
+      m_pData = NULL;
+      m_size = 0;
+      m_alloc_flags = 0;
+      m_mapped = false;
+   }
+
+   void cow_view::swap(cow_view& other)
+   {
+      utils::swap(m_pData, other.m_pData);
+      utils::swap(m_size, other.m_size);
+      utils::swap(m_alloc_flags, other.m_alloc_flags);
+      utils::swap(m_mapped, other.m_mapped);
+   }
+
+} // namespace lzham
@@ -0,0 +1,73 @@
+// File: lzham_cow_memory.h
+// See Copyright Notice and license at the end of include/lzham.h
+#pragma once
+
+namespace lzham
+{
+   // A block of zeroed memory that's filled in once, then never written again. Any number of cow_views (on any thread) can be mapped from it.
+   // Where the OS supports it the image is backed by anonymous shared memory, so mapping a view is O(1) and pages are only copied when a view first writes them.
+   class cow_image
+   {
+      LZHAM_NO_COPY_OR_ASSIGNMENT_OP(cow_image);
+
+   public:
+      cow_image();
+      ~cow_image();
+
+      bool init(size_t size);
+      void deinit();
+
+      inline uint8* get_ptr() const { return m_pData; }
+      inline size_t get_size() const { return m_size; }
+
+      // True if views map the image instead of copying it.
+      inline bool is_shared() const { return m_pData && (m_handle != cInvalidHandle); }
+
+   private:
+#if LZHAM_USE_WIN32_API
+      static void* const cInvalidHandle;
+#else
+      static const int cInvalidHandle = -1;
+#endif
+
+      uint8* m_pData;
+      size_t m_size;
+
+      // OS handle of the shared memory object, or the invalid value if the image lives on the heap and views must copy it.
+#if LZHAM_USE_WIN32_API
+      void* m_handle;
+#else
+      int m_handle;
+#endif
+
+      friend class cow_view;
+   };
+
+   // Writable memory that's either plainly allocated, or starts out as a private copy-on-write view of a cow_image.
+   class cow_view
+   {
+      LZHAM_NO_COPY_OR_ASSIGNMENT_OP(cow_view);
+
+   public:
+      cow_view();
+      ~cow_view();
+
+      // The contents of newly allocated memory are undefined. alloc_flags and numa_node are passed on to lzham_large_alloc().
+      bool alloc(size_t size, uint alloc_flags = 0, int numa_node = -1);
+      bool map(const cow_image& image);
+      void free();
+
+      void swap(cow_view& other);
+
+      inline uint8* get_ptr() const { return m_pData; }
+      inline size_t get_size() const { return m_size; }
+      inline bool is_mapped() const { return m_mapped; }
+
+   private:
+      uint8* m_pData;
+      size_t m_size;
+      uint m_alloc_flags;
+      bool m_mapped;
+   };
+
+} // namespace lzham
@@ -28,9 +28,26 @@ namespace lzham
 
       lzham_compress_params m_params;
 
+      // Reference held on m_params.m_pPrepared_dict for the compressor's lifetime.
+      prepared_dict *m_pPrepared_dict;
+
       lzham_compress_status_t m_status;
    };
 
+   // Callers built against older versions of lzham.h pass a shorter lzham_compress_params, missing the fields that were appended since.
+   // Copies whatever the caller's version has into params and zeros the rest, which selects each newer field's default.
+   static bool get_compress_params(lzham_compress_params &params, const lzham_compress_params *pParams)
+   {
+      const uint cMinStructSize = offsetof(lzham_compress_params, m_match_hash_bits);
+      if ((!pParams) || (pParams->m_struct_size < cMinStructSize) || (pParams->m_struct_size > sizeof(lzham_compress_params)))
+         return false;
+
+      utils::zero_object(params);
+      memcpy(&params, pParams, pParams->m_struct_size);
+      params.m_struct_size = sizeof(lzham_compress_params);
+      return true;
+   }
+
    static lzham_compress_status_t create_internal_init_params(lzcompressor::init_params &internal_params, const lzham_compress_params *pParams)
    {
       if ((pParams->m_dict_size_log2 < CLZBase::cMinDictSizeLog2) || (pParams->m_dict_size_log2 > CLZBase::cMaxDictSizeLog2))
@@ -63,6 +80,41 @@ namespace lzham
          internal_params.m_pSeed_bytes = pParams->m_pSeed_bytes;
       }
 
+      if (pParams->m_pPrepared_dict)
+      {
+         if (pParams->m_num_seed_bytes)
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+
+         internal_params.m_pPrepared_dict = static_cast<const prepared_dict*>(pParams->m_pPrepared_dict);
+      }
+
+      if (pParams->m_match_hash_bits)
+      {
+         if ((pParams->m_match_hash_bits < LZHAM_MIN_MATCH_HASH_BITS) || (pParams->m_match_hash_bits > LZHAM_MAX_MATCH_HASH_BITS))
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+         internal_params.m_match_hash_bits = pParams->m_match_hash_bits;
+      }
+
+      if (pParams->m_match_hash_bytes)
+      {
+         if ((pParams->m_match_hash_bytes != 3) && (pParams->m_match_hash_bytes != 4))
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+         internal_params.m_match_hash_bytes = pParams->m_match_hash_bytes;
+      }
+
+      internal_params.m_numa_node = static_cast<int>(pParams->m_numa_node) - 1;
+
+      if (pParams->m_max_parse_threads > LZHAM_MAX_PARSE_THREADS)
+         return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+      internal_params.m_max_parse_threads = pParams->m_max_parse_threads;
+
+      if (pParams->m_parse_graph_size)
+      {
+         if ((pParams->m_parse_graph_size < LZHAM_MIN_PARSE_GRAPH_SIZE) || (pParams->m_parse_graph_size > LZHAM_MAX_PARSE_GRAPH_SIZE))
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+         internal_params.m_parse_graph_size = pParams->m_parse_graph_size;
+      }
+
       switch (pParams->m_level)
       {
          case LZHAM_COMP_LEVEL_FASTEST:   internal_params.m_compression_level = cCompressionLevelFastest; break;
@@ -70,17 +122,63 @@ namespace lzham
          case LZHAM_COMP_LEVEL_DEFAULT:   internal_params.m_compression_level = cCompressionLevelDefault; break;
          case LZHAM_COMP_LEVEL_BETTER:    internal_params.m_compression_level = cCompressionLevelBetter; break;
          case LZHAM_COMP_LEVEL_UBER:      internal_params.m_compression_level = cCompressionLevelUber; break;
+         case LZHAM_COMP_LEVEL_GREEDY:    internal_params.m_compression_level = cCompressionLevelGreedy; break;
+         case LZHAM_COMP_LEVEL_LAZY:      internal_params.m_compression_level = cCompressionLevelLazy; break;
          default:
             return LZHAM_COMP_STATUS_INVALID_PARAMETER;
       };
 
+      switch (pParams->m_match_finder)
+      {
+         case LZHAM_MATCH_FINDER_DEFAULT:
+         {
+            // The fastest level only takes a couple of probes, which a hash chain answers nearly as well as a tree with half the memory.
+            // Past that the chain's newest-first walk misses far repeats the tree would have found, so the other levels stay on trees.
+            internal_params.m_match_finder = (internal_params.m_compression_level == cCompressionLevelFastest) ? cMatchFinderHashChain : cMatchFinderBinaryTree;
+            break;
+         }
+         case LZHAM_MATCH_FINDER_BINARY_TREE:   internal_params.m_match_finder = cMatchFinderBinaryTree; break;
+         case LZHAM_MATCH_FINDER_HASH_CHAIN:    internal_params.m_match_finder = cMatchFinderHashChain; break;
+         default: return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+      }
+
+      // The greedy and lazy parsers probe the hash table engine directly, and can't use match lists.
+      if (internal_params.m_compression_level < cCompressionLevelFastest)
+         internal_params.m_match_finder = cMatchFinderHashTable;
+
+      if ((internal_params.m_pPrepared_dict) && (!internal_params.m_pPrepared_dict->is_compatible(internal_params)))
+         return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+
+      if (pParams->m_compress_flags & LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS)
+      {
+         // Each segment's compressor is seeded with the bytes before it, so there's no room for a seed dictionary.
+         if ((internal_params.m_num_seed_bytes) || (internal_params.m_pPrepared_dict))
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+
+         internal_params.m_segment_size_log2 = LZHAM_DEFAULT_SEGMENT_SIZE_LOG2;
+         if (pParams->m_segment_size_log2)
+         {
+            if ((pParams->m_segment_size_log2 < LZHAM_MIN_SEGMENT_SIZE_LOG2) || (pParams->m_segment_size_log2 > LZHAM_MAX_SEGMENT_SIZE_LOG2))
+               return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+            internal_params.m_segment_size_log2 = pParams->m_segment_size_log2;
+         }
+
+         if (pParams->m_segment_prime_size > (1U << pParams->m_dict_size_log2))
+            return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+         internal_params.m_segment_prime_size = pParams->m_segment_prime_size;
+      }
+
+      internal_params.m_target_comp_kb_per_sec = pParams->m_target_comp_kb_per_sec;
+
       return LZHAM_COMP_STATUS_SUCCESS;
    }
 
-   lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_init(const lzham_compress_params *pParams)
+   lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_init(const lzham_compress_params *pCaller_params)
    {
-      if ((!pParams) || (pParams->m_struct_size != sizeof(lzham_compress_params)))
+      lzham_compress_params params;
+      if (!get_compress_params(params, pCaller_params))
          return NULL;
+      const lzham_compress_params *pParams = &params;
 
       if ((pParams->m_dict_size_log2 < CLZBase::cMinDictSizeLog2) || (pParams->m_dict_size_log2 > CLZBase::cMaxDictSizeLog2))
          return NULL;
@@ -95,6 +193,7 @@ namespace lzham
          return NULL;
 
       pState->m_params = *pParams;
+      pState->m_pPrepared_dict = NULL;
 
       pState->m_pIn_buf = NULL;
       pState->m_pIn_buf_size = NULL;
@@ -127,6 +226,12 @@ namespace lzham
          return NULL;
       }
 
+      if (pParams->m_pPrepared_dict)
+      {
+         pState->m_pPrepared_dict = static_cast<prepared_dict*>(pParams->m_pPrepared_dict);
+         pState->m_pPrepared_dict->add_ref();
+      }
+
       return pState;
    }
 
@@ -150,6 +255,53 @@ namespace lzham
       return pState;
    }
 
+   lzham_compress_state_ptr LZHAM_CDECL lzham_lib_compress_clone(lzham_compress_state_ptr p)
+   {
+      lzham_compress_state *pSrc_state = static_cast<lzham_compress_state*>(p);
+      if ((!pSrc_state) || (pSrc_state->m_status >= LZHAM_COMP_STATUS_FIRST_FAILURE_CODE))
+         return NULL;
+
+      lzham_compress_state *pState = lzham_new<lzham_compress_state>();
+      if (!pState)
+         return NULL;
+
+      pState->m_params = pSrc_state->m_params;
+      pState->m_pPrepared_dict = NULL;
+
+      pState->m_pIn_buf = NULL;
+      pState->m_pIn_buf_size = NULL;
+      pState->m_pOut_buf = NULL;
+      pState->m_pOut_buf_size = NULL;
+      pState->m_status = pSrc_state->m_status;
+      pState->m_comp_data_ofs = pSrc_state->m_comp_data_ofs;
+      pState->m_finished_compression = pSrc_state->m_finished_compression;
+
+      task_pool *pTask_pool = NULL;
+      if (pSrc_state->m_compressor.get_params().m_pTask_pool)
+      {
+         if ((!pState->m_tp.init(pSrc_state->m_tp.get_num_threads())) || (pState->m_tp.get_num_threads() != pSrc_state->m_tp.get_num_threads()))
+         {
+            lzham_delete(pState);
+            return NULL;
+         }
+         pTask_pool = &pState->m_tp;
+      }
+
+      if (!pState->m_compressor.init_clone(pSrc_state->m_compressor, pTask_pool))
+      {
+         lzham_delete(pState);
+         return NULL;
+      }
+
+      if (pSrc_state->m_pPrepared_dict)
+      {
+         pState->m_pPrepared_dict = pSrc_state->m_pPrepared_dict;
+         pState->m_pPrepared_dict->add_ref();
+      }
+
+      return pState;
+   }
+
    lzham_uint32 LZHAM_CDECL lzham_lib_compress_deinit(lzham_compress_state_ptr p)
    {
       lzham_compress_state *pState = static_cast<lzham_compress_state *>(p);
@@ -158,11 +310,64 @@ namespace lzham
 
       uint32 adler32 = pState->m_compressor.get_src_adler32();
 
+      prepared_dict *pPrepared_dict = pState->m_pPrepared_dict;
+
       lzham_delete(pState);
 
+      lzham_lib_compress_dict_deinit(pPrepared_dict);
+
       return adler32;
    }
 
+   lzham_compress_dict_ptr LZHAM_CDECL lzham_lib_compress_dict_init(const lzham_compress_params *pCaller_params)
+   {
+      lzham_compress_params params;
+      if (!get_compress_params(params, pCaller_params))
+         return NULL;
+      const lzham_compress_params *pParams = &params;
+
+      if ((!pParams->m_num_seed_bytes) || (pParams->m_pPrepared_dict))
+         return NULL;
+
+      lzcompressor::init_params internal_params;
+      lzham_compress_status_t status = create_internal_init_params(internal_params, pParams);
+      if (status != LZHAM_COMP_STATUS_SUCCESS)
+         return NULL;
+
+      // The helper threads are only needed while the seed is being indexed.
+      task_pool *pTask_pool = NULL;
+      if (internal_params.m_max_helper_threads)
+      {
+         pTask_pool = lzham_new<task_pool>();
+         if ((pTask_pool) && (pTask_pool->init(internal_params.m_max_helper_threads)) && (pTask_pool->get_num_threads() >= internal_params.m_max_helper_threads))
+         {
+            internal_params.m_pTask_pool = pTask_pool;
+         }
+         else
+         {
+            internal_params.m_max_helper_threads = 0;
+         }
+      }
+
+      prepared_dict *pDict = lzham_new<prepared_dict>();
+      if ((pDict) && (!pDict->init(internal_params)))
+      {
+         lzham_delete(pDict);
+         pDict = NULL;
+      }
+
+      lzham_delete(pTask_pool);
+
+      return pDict;
+   }
+
+   void LZHAM_CDECL lzham_lib_compress_dict_deinit(lzham_compress_dict_ptr p)
+   {
+      prepared_dict *pDict = static_cast<prepared_dict*>(p);
+      if ((pDict) && (pDict->release()))
+         lzham_delete(pDict);
+   }
+
    lzham_compress_status_t LZHAM_CDECL lzham_lib_compress(
       lzham_compress_state_ptr p,
       const lzham_uint8 *pIn_buf, size_t *pIn_buf_size,
@@ -295,10 +500,12 @@ namespace lzham
       return pState->m_status;
    }
 
-   lzham_compress_status_t LZHAM_CDECL lzham_lib_compress_memory(const lzham_compress_params *pParams, lzham_uint8* pDst_buf, size_t *pDst_len, const lzham_uint8* pSrc_buf, size_t src_len, lzham_uint32 *pAdler32)
+   lzham_compress_status_t LZHAM_CDECL lzham_lib_compress_memory(const lzham_compress_params *pCaller_params, lzham_uint8* pDst_buf, size_t *pDst_len, const lzham_uint8* pSrc_buf, size_t src_len, lzham_uint32 *pAdler32)
    {
-      if ((!pParams) || (!pDst_len))
+      lzham_compress_params params;
+      if ((!get_compress_params(params, pCaller_params)) || (!pDst_len))
          return LZHAM_COMP_STATUS_INVALID_PARAMETER;
+      const lzham_compress_params *pParams = &params;
 
       if (src_len)
       {
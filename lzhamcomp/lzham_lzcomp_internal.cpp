@@ -6,6 +6,7 @@
 #include "lzham_timer.h"
 #include "lzham_lzbase.h"
 #include <string.h>
+#include <math.h>
 
 // Update and print high-level coding statistics if set to 1.
 // TODO: Add match distance coding statistics.
@@ -24,6 +25,22 @@ namespace lzham
 {
    static comp_settings s_level_settings[cCompressionLevelCount] =
    {
+      // cCompressionLevelGreedy
+      {
+         0,                               // m_fast_bytes (every match is taken as soon as it's found)
+         true,                            // m_fast_adaptive_huffman_updating
+         true,                            // m_use_polar_codes
+         1,                               // m_match_accel_max_matches_per_probe
+         1,                               // m_match_accel_max_probes
+      },
+      // cCompressionLevelLazy
+      {
+         24,                              // m_fast_bytes (shorter matches are held back for a look at the next position)
+         true,                            // m_fast_adaptive_huffman_updating
+         true,                            // m_use_polar_codes
+         1,                               // m_match_accel_max_matches_per_probe
+         1,                               // m_match_accel_max_probes
+      },
       // cCompressionLevelFastest
       {
          8,                               // m_fast_bytes
@@ -66,6 +83,28 @@ namespace lzham
       }
    };
 
+   // Roughly one tree root per 16 dictionary bytes, so tree depth (and the cache misses of walking it) stays bounded as the dictionary grows.
+   // The lower levels only probe a couple of nodes, so they get sparser trees.
+   static uint compute_match_hash_bits(uint dict_size_log2, compression_level level)
+   {
+      int hash_bits = (int)dict_size_log2 - 4;
+      if (level <= cCompressionLevelFaster)
+         hash_bits++;
+
+      // The greedy and lazy levels' table holds one position per bucket and is hit at every position coded, so it's kept cache sized.
+      if (level < cCompressionLevelFastest)
+         hash_bits = LZHAM_MIN(hash_bits, static_cast<int>(cFastParseMaxHashBits));
+
+      return math::clamp<int>(hash_bits, cMatchAccelMinHashBits, cMatchAccelMaxHashBits);
+   }
+
+   // Short matches far back are rarely cheaper than literals, so on big windows the lower levels hash 4 bytes to keep trigram buckets from degenerating.
+   static uint compute_match_hash_bytes(uint dict_size_log2, compression_level level)
+   {
+      // A single probe can't afford to land on a trigram bucket's newest short match instead of a longer one, so the greedy and lazy levels always hash 4.
+      return (((dict_size_log2 >= 24) && (level < cCompressionLevelBetter)) || (level < cCompressionLevelFastest)) ? 4 : 3;
+   }
+
    lzcompressor::lzcompressor() :
       m_src_size(-1),
       m_src_adler32(0),
@@ -73,14 +112,32 @@ namespace lzham
       m_block_start_dict_ofs(0),
       m_block_index(0),
       m_finished(false),
+      m_next_block_queued(false),
+      m_reset_all_tables_pending(false),
+      m_segment_buf_prime_size(0),
+      m_segment_src_ofs(0),
+      m_segment_comp_ofs(0),
       m_num_parse_threads(0),
+      m_max_parse_threads(0),
+      m_parse_graph_size(0),
+      m_parse_thread_state(NULL),
+      m_num_parse_thread_states(0),
       m_parse_jobs_remaining(0),
       m_block_history_size(0),
-      m_block_history_next(0)
+      m_block_history_next(0),
+      m_speed_step(0),
+      m_max_speed_step(0),
+      m_extreme_parsing(false)
    {
       LZHAM_VERIFY( ((uint32_ptr)this & (LZHAM_GET_ALIGNMENT(lzcompressor) - 1)) == 0);
    }
 
+   lzcompressor::~lzcompressor()
+   {
+      delete_segment_compressors();
+      free_parse_thread_states();
+   }
+
    bool lzcompressor::init_seed_bytes()
    {
       uint cur_seed_ofs = 0;
@@ -94,6 +151,13 @@ namespace lzham
             return false;
          m_accel.add_bytes_end();
 
+         // The hash table engine only indexes what the parser probes, so seed bytes must be inserted explicitly.
+         if (m_accel.get_match_finder() == cMatchFinderHashTable)
+         {
+            for (uint i = 0; i < num_bytes_to_add; i++)
+               m_accel.insert_hash(i);
+         }
+
          m_accel.advance_bytes(num_bytes_to_add);
 
          cur_seed_ofs += num_bytes_to_add;
@@ -112,21 +176,53 @@ namespace lzham
          return false;
 
       m_params = params;
-      m_use_task_pool = (m_params.m_pTask_pool) && (m_params.m_pTask_pool->get_num_threads() != 0) && (m_params.m_max_helper_threads > 0);
-      if ((m_params.m_max_helper_threads) && (!m_use_task_pool))
-         return false;
-      m_settings = s_level_settings[params.m_compression_level];
 
-      const uint dict_size = 1U << m_params.m_dict_size_log2;
+      if (params.m_pPrepared_dict)
+      {
+         if ((params.m_num_seed_bytes) || (!params.m_pPrepared_dict->is_compatible(params)))
+            return false;
+
+         // The match finder starts from the dictionary's snapshot. The seed bytes themselves are only needed to decide how to parse the first block.
+         m_params.m_pSeed_bytes = params.m_pPrepared_dict->get_seed_bytes();
+         m_params.m_num_seed_bytes = params.m_pPrepared_dict->get_num_seed_bytes();
+      }
 
       if (params.m_num_seed_bytes)
       {
          if (!params.m_pSeed_bytes)
             return false;
-         if (params.m_num_seed_bytes > dict_size)
+         if (params.m_num_seed_bytes > (1U << m_params.m_dict_size_log2))
             return false;
       }
 
+      return init_internal(NULL);
+   }
+
+   bool lzcompressor::init_clone(lzcompressor& other, task_pool* pTask_pool)
+   {
+      clear();
+
+      // The source must be between blocks, and not have failed.
+      if ((other.m_src_size < 0) || (other.m_accel.get_lookahead_size()))
+         return false;
+
+      // other.m_params has already been validated and had any prepared dictionary folded in.
+      m_params = other.m_params;
+      m_params.m_pTask_pool = pTask_pool;
+
+      return init_internal(&other);
+   }
+
+   // Finishes init() or init_clone() from m_params. If pClone_src isn't NULL, its coding state is copied instead of starting a new stream.
+   bool lzcompressor::init_internal(lzcompressor* pClone_src)
+   {
+      m_use_task_pool = (m_params.m_pTask_pool) && (m_params.m_pTask_pool->get_num_threads() != 0) && (m_params.m_max_helper_threads > 0);
+      if ((m_params.m_max_helper_threads) && (!m_use_task_pool))
+         return false;
+      m_settings = s_level_settings[m_params.m_compression_level];
+
+      const uint dict_size = 1U << m_params.m_dict_size_log2;
+
       if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_FORCE_POLAR_CODING)
          m_settings.m_use_polar_codes = true;
 
@@ -138,46 +234,81 @@ namespace lzham
 
       m_num_parse_threads = 1;
 
+      // Without speculative parsing every parse job after the first costs a partial state reset code.
+      m_max_parse_threads = (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_SPECULATIVE_PARSING) ? cMaxParseThreads : cMaxPartialResetParseThreads;
+      if (m_params.m_max_parse_threads)
+         m_max_parse_threads = LZHAM_MIN(m_params.m_max_parse_threads, cMaxParseThreads);
+
 #if !LZHAM_FORCE_SINGLE_THREADED_PARSING
-      if (params.m_max_helper_threads > 0)
+      // The greedy and lazy levels code each block in a single pass, so they never run parse jobs.
+      if ((m_params.m_max_helper_threads > 0) && (m_params.m_compression_level >= cCompressionLevelFastest))
       {
-         LZHAM_ASSUME(cMaxParseThreads >= 4);
+         LZHAM_ASSUME(cMaxPartialResetParseThreads >= 8);
 
-         if (m_params.m_block_size < 16384)
+         if (m_params.m_max_parse_threads)
+         {
+            m_num_parse_threads = LZHAM_MIN(m_max_parse_threads, m_params.m_max_helper_threads + 1);
+         }
+         else if (m_params.m_block_size < 16384)
          {
-            m_num_parse_threads = LZHAM_MIN(cMaxParseThreads, params.m_max_helper_threads + 1);
+            m_num_parse_threads = LZHAM_MIN(m_max_parse_threads, m_params.m_max_helper_threads + 1);
          }
          else
          {
-            if ((params.m_max_helper_threads == 1) || (m_params.m_compression_level == cCompressionLevelFastest))
+            if ((m_params.m_max_helper_threads == 1) || (m_params.m_compression_level == cCompressionLevelFastest))
             {
                m_num_parse_threads = 1;
             }
-            else if (params.m_max_helper_threads <= 3)
+            else if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_SPECULATIVE_PARSING)
+            {
+               // Split the helpers about evenly between parsing and match finding.
+               m_num_parse_threads = LZHAM_MIN(m_max_parse_threads, LZHAM_MAX(2U, (m_params.m_max_helper_threads + 1U) / 2U));
+            }
+            else if (m_params.m_max_helper_threads <= 3)
             {
                m_num_parse_threads = 2;
             }
-            else if (params.m_max_helper_threads <= 7)
+            else if (m_params.m_max_helper_threads <= 7)
             {
                if ((m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_EXTREME_PARSING) && (m_params.m_compression_level == cCompressionLevelUber))
                   m_num_parse_threads = 4;
                else
                   m_num_parse_threads = 2;
             }
-            else
+            else if (m_params.m_max_helper_threads <= 15)
             {
-               // 8-16
                m_num_parse_threads = 4;
             }
+            else
+            {
+               m_num_parse_threads = cMaxPartialResetParseThreads;
+            }
          }
       }
+      else
 #endif
+      {
+         m_max_parse_threads = 1;
+      }
+
+      // The default graph window shrinks when a block would otherwise leave some parse jobs without any bytes to parse.
+      if (m_params.m_parse_graph_size)
+         m_parse_graph_size = math::clamp<uint>(m_params.m_parse_graph_size, cMinParseGraphNodes, cMaxParseGraphNodes);
+      else
+         m_parse_graph_size = math::clamp<uint>(m_params.m_block_size / m_num_parse_threads, cMinParseGraphNodes, cDefaultParseGraphNodes);
+
+      // More jobs than the block has graph windows would never get any work.
+      m_max_parse_threads = LZHAM_MIN(m_max_parse_threads, LZHAM_MAX(1U, (m_params.m_block_size + m_parse_graph_size - 1) / m_parse_graph_size));
+      m_num_parse_threads = LZHAM_MIN(m_num_parse_threads, m_max_parse_threads);
+
+      if (!init_parse_thread_states())
+         return false;
 
       int num_parse_jobs = m_num_parse_threads - 1;
-      uint match_accel_helper_threads = LZHAM_MAX(0, (int)params.m_max_helper_threads - num_parse_jobs);
+      uint match_accel_helper_threads = LZHAM_MAX(0, (int)m_params.m_max_helper_threads - num_parse_jobs);
 
       LZHAM_ASSERT(m_num_parse_threads >= 1);
-      LZHAM_ASSERT(m_num_parse_threads <= cMaxParseThreads);
+      LZHAM_ASSERT(m_num_parse_threads <= m_max_parse_threads);
 
       if (!m_use_task_pool)
       {
@@ -185,13 +316,33 @@ namespace lzham
       }
       else
       {
-         LZHAM_ASSERT((match_accel_helper_threads + (m_num_parse_threads - 1)) <= params.m_max_helper_threads);
+         LZHAM_ASSERT((match_accel_helper_threads + (m_num_parse_threads - 1)) <= m_params.m_max_helper_threads);
       }
 
-      if (!m_accel.init(this, params.m_pTask_pool, match_accel_helper_threads, dict_size, m_settings.m_match_accel_max_matches_per_probe, false, m_settings.m_match_accel_max_probes))
-         return false;
+      uint accel_dict_size_log2 = m_params.m_accel_dict_size_log2 ? m_params.m_accel_dict_size_log2 : m_params.m_dict_size_log2;
+
+      // The segments get compressors of their own, so this one's match finder is never used.
+      if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS)
+         accel_dict_size_log2 = CLZBase::cMinDictSizeLog2;
 
-      init_position_slots(params.m_dict_size_log2);
+      const uint match_hash_bits = m_params.m_match_hash_bits ? m_params.m_match_hash_bits : compute_match_hash_bits(accel_dict_size_log2, m_params.m_compression_level);
+      const uint match_hash_bytes = m_params.m_match_hash_bytes ? m_params.m_match_hash_bytes : compute_match_hash_bytes(accel_dict_size_log2, m_params.m_compression_level);
+
+      if (pClone_src)
+      {
+         if (!m_accel.init_clone(pClone_src->m_accel, this, m_params.m_pTask_pool, match_accel_helper_threads))
+            return false;
+      }
+      else
+      {
+         const match_accel_snapshot* pSeed_snapshot = m_params.m_pPrepared_dict ? &m_params.m_pPrepared_dict->get_snapshot() : NULL;
+         const uint alloc_flags = (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_LARGE_PAGES) ? cLargeAllocHugePages : 0;
+         const bool long_range_matching = ((m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_LONG_RANGE_MATCHING) != 0) && (m_params.m_match_finder != cMatchFinderHashTable);
+         if (!m_accel.init(this, m_params.m_pTask_pool, match_accel_helper_threads, 1U << accel_dict_size_log2, m_settings.m_match_accel_max_matches_per_probe, false, m_settings.m_match_accel_max_probes, match_hash_bits, match_hash_bytes, m_params.m_match_finder, long_range_matching, alloc_flags, m_params.m_numa_node, pSeed_snapshot))
+            return false;
+      }
+
+      init_position_slots(m_params.m_dict_size_log2);
       init_slot_tabs();
 
       if (!m_state.init(*this, m_settings.m_fast_adaptive_huffman_updating, m_settings.m_use_polar_codes))
@@ -212,7 +363,21 @@ namespace lzham
       m_block_history_size = 0;
       m_block_history_next = 0;
 
-      if (params.m_num_seed_bytes)
+      // The greedy and lazy parsers have nothing left to trade away.
+      m_max_speed_step = 0;
+      if ((m_params.m_target_comp_kb_per_sec) && (m_params.m_compression_level >= cCompressionLevelFastest))
+      {
+         m_max_speed_step = m_params.m_compression_level - cCompressionLevelFastest;
+         if ((m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_EXTREME_PARSING) && (m_params.m_compression_level == cCompressionLevelUber))
+            m_max_speed_step++;
+      }
+      m_speed_step = 0;
+      apply_speed_step();
+
+      if (pClone_src)
+         return clone_state(*pClone_src);
+
+      if ((m_params.m_num_seed_bytes) && (!m_params.m_pPrepared_dict))
       {
          if (!init_seed_bytes())
             return false;
@@ -221,11 +386,89 @@ namespace lzham
       if (!send_zlib_header())
          return false;
 
+      m_segment_comp_ofs = m_comp_buf.size();
+
       m_src_size = 0;
 
       return true;
    }
 
+   // Allocates m_max_parse_threads + 1 parse thread states, keeping the current array if it's already the right size.
+   bool lzcompressor::init_parse_thread_states()
+   {
+      const uint num_states = m_max_parse_threads + 1;
+      if (m_num_parse_thread_states != num_states)
+      {
+         free_parse_thread_states();
+
+         // Constructed one by one, lzham_new_array()'s generic construct_array() would memset this non-trivial type.
+         m_parse_thread_state = static_cast<parse_thread_state*>(lzham_malloc(sizeof(parse_thread_state) * num_states));
+         if (!m_parse_thread_state)
+            return false;
+         for (uint i = 0; i < num_states; i++)
+            helpers::construct(&m_parse_thread_state[i]);
+         m_num_parse_thread_states = num_states;
+      }
+
+      // The greedy parser's state doesn't need a graph. Nodes have no constructor worth running, every parse clears the ones it uses.
+      for (uint i = 0; i < m_max_parse_threads; i++)
+      {
+         if (!m_parse_thread_state[i].m_nodes.try_resize_no_construct(m_parse_graph_size + 1))
+            return false;
+      }
+
+      return true;
+   }
+
+   void lzcompressor::free_parse_thread_states()
+   {
+      for (uint i = 0; i < m_num_parse_thread_states; i++)
+         helpers::destruct(&m_parse_thread_state[i]);
+      lzham_free(m_parse_thread_state);
+
+      m_parse_thread_state = NULL;
+      m_num_parse_thread_states = 0;
+   }
+
+   bool lzcompressor::clone_state(const lzcompressor& other)
+   {
+      m_state = other.m_state;
+      m_start_of_block_state = other.m_start_of_block_state;
+
+      // Compressed data that hasn't been taken by the caller yet belongs to both streams.
+      if ((!m_block_buf.try_resize(0)) || (!m_block_buf.append(other.m_block_buf)))
+         return false;
+      if ((!m_comp_buf.try_resize(0)) || (!m_comp_buf.append(other.m_comp_buf)))
+         return false;
+
+      m_stats = other.m_stats;
+
+      m_src_size = other.m_src_size;
+      m_src_adler32 = other.m_src_adler32;
+      m_step = other.m_step;
+      m_block_start_dict_ofs = other.m_block_start_dict_ofs;
+      m_block_index = other.m_block_index;
+      m_finished = other.m_finished;
+
+      memcpy(m_block_history, other.m_block_history, sizeof(m_block_history));
+      m_block_history_size = other.m_block_history_size;
+      m_block_history_next = other.m_block_history_next;
+
+      m_speed_step = other.m_speed_step;
+      apply_speed_step();
+
+      // Segment compressors hold nothing between batches, so the clone creates its own when it needs them.
+      if ((!m_segment_buf.try_resize(0)) || (!m_segment_buf.append(other.m_segment_buf)))
+         return false;
+      if ((!m_segment_index.try_resize(0)) || (!m_segment_index.append(other.m_segment_index)))
+         return false;
+      m_segment_buf_prime_size = other.m_segment_buf_prime_size;
+      m_segment_src_ofs = other.m_segment_src_ofs;
+      m_segment_comp_ofs = other.m_segment_comp_ofs;
+
+      return true;
+   }
+
    // See http://www.gzip.org/zlib/rfc-zlib.html
    // Method is set to 14 (LZHAM) and CINFO is (window_size - 15).
    bool lzcompressor::send_zlib_header()
@@ -240,18 +483,20 @@ namespace lzham
       int flg = 0;
       switch (m_params.m_compression_level)
       {
-         case LZHAM_COMP_LEVEL_FASTEST:
+         case cCompressionLevelGreedy:
+         case cCompressionLevelLazy:
+         case cCompressionLevelFastest:
          {
             flg = 0 << 6;
             break;
          }
-         case LZHAM_COMP_LEVEL_FASTER:
+         case cCompressionLevelFaster:
          {
             flg = 1 << 6;
             break;
          }
-         case LZHAM_COMP_LEVEL_DEFAULT:
-         case LZHAM_COMP_LEVEL_BETTER:
+         case cCompressionLevelDefault:
+         case cCompressionLevelBetter:
          {
             flg = 2 << 6;
             break;
@@ -280,7 +525,7 @@ namespace lzham
       if (m_params.m_pSeed_bytes)
       {
          // send adler32 of DICT
-         uint dict_adler32 = adler32(m_params.m_pSeed_bytes, m_params.m_num_seed_bytes);
+         uint dict_adler32 = m_params.m_pPrepared_dict ? m_params.m_pPrepared_dict->get_seed_adler32() : adler32(m_params.m_pSeed_bytes, m_params.m_num_seed_bytes);
          for (uint i = 0; i < 4; i++)
          {
             if (!m_comp_buf.try_push_back(static_cast<uint8>(dict_adler32 >> 24)))
@@ -303,24 +548,38 @@ namespace lzham
       m_step = 0;
       m_finished = false;
       m_use_task_pool = false;
+      m_next_block_queued = false;
+      m_reset_all_tables_pending = false;
       m_block_start_dict_ofs = 0;
       m_block_index = 0;
       m_state.clear();
+
+      delete_segment_compressors();
+      m_segment_jobs.clear();
+      m_segment_index.clear();
+      m_segment_buf.clear();
+      m_segment_buf_prime_size = 0;
+      m_segment_src_ofs = 0;
+      m_segment_comp_ofs = 0;
       m_num_parse_threads = 0;
+      m_max_parse_threads = 0;
+      m_parse_graph_size = 0;
       m_parse_jobs_remaining = 0;
 
-      for (uint i = 0; i < cMaxParseThreads; i++)
+      for (uint i = 0; i < m_num_parse_thread_states; i++)
       {
          parse_thread_state &parse_state = m_parse_thread_state[i];
          parse_state.m_initial_state.clear();
 
-         for (uint j = 0; j <= cMaxParseGraphNodes; j++)
+         for (uint j = 0; j < parse_state.m_nodes.size(); j++)
             parse_state.m_nodes[j].clear();
 
          parse_state.m_start_ofs = 0;
          parse_state.m_bytes_to_match = 0;
          parse_state.m_best_decisions.clear();
          parse_state.m_issue_reset_state_partial = false;
+         parse_state.m_speculative_initial_state = false;
+         parse_state.m_speculation_start_ofs = 0;
          parse_state.m_emit_decisions_backwards = false;
          parse_state.m_failed = false;
       }
@@ -334,7 +593,8 @@ namespace lzham
       if (m_src_size < 0)
          return false;
 
-      m_accel.reset();
+      if (!m_accel.reset())
+         return false;
       m_codec.reset();
       m_stats.clear();
       m_src_size = 0;
@@ -344,6 +604,8 @@ namespace lzham
 
       m_step = 0;
       m_finished = false;
+      m_next_block_queued = false;
+      m_reset_all_tables_pending = false;
       m_block_start_dict_ofs = 0;
       m_block_index = 0;
       m_state.reset();
@@ -351,13 +613,34 @@ namespace lzham
       m_block_history_size = 0;
       m_block_history_next = 0;
 
-      if (m_params.m_num_seed_bytes)
+      m_speed_step = 0;
+      apply_speed_step();
+
+      m_segment_index.try_resize(0);
+      m_segment_buf.try_resize(0);
+      m_segment_buf_prime_size = 0;
+      m_segment_src_ofs = 0;
+
+      if ((m_params.m_num_seed_bytes) && (!m_params.m_pPrepared_dict))
       {
          if (!init_seed_bytes())
             return false;
       }
 
-      return send_zlib_header();
+      if (!send_zlib_header())
+         return false;
+
+      m_segment_comp_ofs = m_comp_buf.size();
+
+      return true;
+   }
+
+   bool lzcompressor::create_seed_snapshot(match_accel_snapshot& snapshot) const
+   {
+      if (m_src_size != 0)
+         return false;
+
+      return m_accel.create_snapshot(snapshot);
    }
 
    bool lzcompressor::code_decision(lzdecision lzdec, uint& cur_ofs, uint& bytes_to_match)
@@ -394,6 +677,30 @@ namespace lzham
       return true;
    }
 
+   // Codes a decision made by a parse job that started from a predicted state. Rep matches are translated to whatever the real match history
+   // holds for their distance, falling back to a full match, or literals if the match is too short to be coded as one.
+   bool lzcompressor::code_speculative_decision(const lzdecision& lzdec, const state_base& predicted_state, uint& cur_ofs, uint& bytes_to_match)
+   {
+      if (!lzdec.is_match())
+         return code_decision(lzdec, cur_ofs, bytes_to_match);
+
+      const uint len = lzdec.get_len();
+      const uint match_dist = lzdec.is_rep() ? predicted_state.m_match_hist[-lzdec.m_dist - 1] : lzdec.m_dist;
+
+      int match_hist_index = m_state.find_match_dist(match_dist);
+      if ((match_hist_index >= 0) && ((len >= CLZBase::cMinMatchLen) || (!match_hist_index)))
+         return code_decision(lzdecision(lzdec.m_pos, len, -(match_hist_index + 1)), cur_ofs, bytes_to_match);
+
+      if (len >= CLZBase::cMinMatchLen)
+         return code_decision(lzdecision(lzdec.m_pos, len, match_dist), cur_ofs, bytes_to_match);
+
+      for (uint i = 0; i < len; i++)
+         if (!code_decision(lzdecision(lzdec.m_pos + i, 0, 0), cur_ofs, bytes_to_match))
+            return false;
+
+      return true;
+   }
+
    bool lzcompressor::send_sync_block(lzham_flush_t flush_type)
    {
       m_codec.reset();
@@ -447,7 +754,12 @@ namespace lzham
          return false;
 
       bool status = true;
-      if (m_block_buf.size())
+      if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS)
+      {
+         // Whatever has been buffered goes out as (shorter) segments.
+         status = compress_segments();
+      }
+      else if (m_block_buf.size())
       {
          status = compress_block(m_block_buf.get_ptr(), m_block_buf.size());
 
@@ -456,12 +768,20 @@ namespace lzham
 
       if (status)
       {
+         const uint prev_comp_buf_size = m_comp_buf.size();
+
          status = send_sync_block(flush_type);
 
+         m_segment_comp_ofs += m_comp_buf.size() - prev_comp_buf_size;
+
          if (LZHAM_FULL_FLUSH == flush_type)
          {
             m_accel.flush();
             m_state.reset();
+
+            // The decompressor restarts its dictionary after a full flush, so the next segment can't reach back before it.
+            m_segment_buf.try_resize(0);
+            m_segment_buf_prime_size = 0;
          }
       }
 
@@ -478,7 +798,18 @@ namespace lzham
 
       bool status = true;
 
-      if (!pBuf)
+      if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS)
+      {
+         if (pBuf)
+            status = put_segment_bytes(static_cast<const uint8*>(pBuf), buf_len);
+         else
+         {
+            // Last segment(s), then the final block, then the segment index (which decompressors never get to).
+            status = compress_segments() && send_final_block() && send_segment_index();
+            m_finished = true;
+         }
+      }
+      else if (!pBuf)
       {
          // Last block - flush whatever's left and send the final block.
          if (m_block_buf.size())
@@ -512,8 +843,9 @@ namespace lzham
             {
                LZHAM_ASSERT(!m_block_buf.size());
 
-               // Full-block available - compress in-place.
-               status = compress_block(pSrcBuf, num_bytes_to_copy);
+               // Full-block available - compress in-place. If another full block follows, the match finder can start on it early.
+               const uint next_buf_len = ((num_src_bytes_remaining - num_bytes_to_copy) >= m_params.m_block_size) ? m_params.m_block_size : 0;
+               status = compress_block(pSrcBuf, num_bytes_to_copy, next_buf_len);
             }
             else
             {
@@ -544,6 +876,219 @@ namespace lzham
       return status;
    }
 
+   bool lzcompressor::put_segment_bytes(const uint8* pBuf, uint buf_len)
+   {
+      m_src_size += buf_len;
+      m_src_adler32 = adler32(pBuf, buf_len, m_src_adler32);
+
+      // Buffer a segment per thread, then compress them all at once.
+      uint max_segments = m_use_task_pool ? (m_params.m_max_helper_threads + 1) : 1;
+      max_segments = LZHAM_MIN(max_segments, (1U << 30) >> m_params.m_segment_size_log2);
+      const uint batch_size = max_segments << m_params.m_segment_size_log2;
+
+      while (buf_len)
+      {
+         const uint num_bytes_to_copy = LZHAM_MIN(buf_len, m_segment_buf_prime_size + batch_size - m_segment_buf.size());
+         if (!m_segment_buf.append(pBuf, num_bytes_to_copy))
+            return false;
+
+         pBuf += num_bytes_to_copy;
+         buf_len -= num_bytes_to_copy;
+
+         if ((m_segment_buf.size() - m_segment_buf_prime_size) == batch_size)
+         {
+            if (!compress_segments())
+               return false;
+         }
+      }
+
+      return true;
+   }
+
+   // Compresses everything buffered after the prime bytes, one segment per compressor, and appends the results in order.
+   bool lzcompressor::compress_segments()
+   {
+      const uint segment_size = 1U << m_params.m_segment_size_log2;
+      const uint total_src_size = m_segment_buf.size() - m_segment_buf_prime_size;
+      if (!total_src_size)
+         return true;
+
+      const uint num_segments = (total_src_size + segment_size - 1) >> m_params.m_segment_size_log2;
+
+      while (m_segment_compressors.size() < num_segments)
+      {
+         init_params child_params(m_params);
+         child_params.m_pTask_pool = NULL;
+         child_params.m_max_helper_threads = 0;
+         child_params.m_lzham_compress_flags &= ~(LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS | LZHAM_COMP_FLAG_WRITE_ZLIB_STREAM);
+         child_params.m_pSeed_bytes = NULL;
+         child_params.m_num_seed_bytes = 0;
+         child_params.m_pPrepared_dict = NULL;
+         child_params.m_segment_size_log2 = 0;
+         child_params.m_segment_prime_size = 0;
+
+         // Segments are compressed side by side, so each one only has to keep up with its share of the target.
+         const uint max_segments = m_use_task_pool ? (m_params.m_max_helper_threads + 1) : 1;
+         child_params.m_target_comp_kb_per_sec = (m_params.m_target_comp_kb_per_sec + max_segments - 1) / max_segments;
+
+         // A segment never sees more than its prime bytes and itself, so a smaller match finder window will do.
+         child_params.m_accel_dict_size_log2 = LZHAM_MIN(m_params.m_dict_size_log2, math::ceil_log2i(segment_size + m_params.m_segment_prime_size));
+
+         lzcompressor* pComp = lzham_new<lzcompressor>();
+         if (!pComp)
+            return false;
+         if ((!pComp->init(child_params)) || (!m_segment_compressors.try_push_back(pComp)))
+         {
+            lzham_delete(pComp);
+            return false;
+         }
+      }
+
+      if (!m_segment_jobs.try_resize(num_segments))
+         return false;
+
+      for (uint i = 0; i < num_segments; i++)
+      {
+         const uint src_ofs = m_segment_buf_prime_size + i * segment_size;
+
+         segment_job& job = m_segment_jobs[i];
+         job.m_pSrc = m_segment_buf.get_ptr() + src_ofs;
+         job.m_src_size = LZHAM_MIN(segment_size, m_segment_buf.size() - src_ofs);
+         job.m_prime_size = LZHAM_MIN(m_params.m_segment_prime_size, src_ofs);
+         job.m_first_segment = (!m_block_index) && (!i);
+         job.m_succeeded = false;
+      }
+
+      if ((m_use_task_pool) && (num_segments > 1))
+      {
+         if (!m_params.m_pTask_pool->queue_multiple_object_tasks(this, &lzcompressor::segment_job_callback, 1, num_segments - 1))
+            return false;
+
+         segment_job_callback(0, NULL);
+
+         m_params.m_pTask_pool->join();
+      }
+      else
+      {
+         for (uint i = 0; i < num_segments; i++)
+            segment_job_callback(i, NULL);
+      }
+
+      for (uint i = 0; i < num_segments; i++)
+      {
+         if (!m_segment_jobs[i].m_succeeded)
+            return false;
+
+         segment_index_entry index_entry;
+         index_entry.m_src_ofs = m_segment_src_ofs;
+         index_entry.m_comp_ofs = m_segment_comp_ofs;
+         if (!m_segment_index.try_push_back(index_entry))
+            return false;
+
+         byte_vec& segment_comp_buf = m_segment_compressors[i]->m_comp_buf;
+
+         m_segment_src_ofs += m_segment_jobs[i].m_src_size;
+         m_segment_comp_ofs += segment_comp_buf.size();
+
+         if (m_comp_buf.empty())
+            m_comp_buf.swap(segment_comp_buf);
+         else if (!m_comp_buf.append(segment_comp_buf))
+            return false;
+
+         segment_comp_buf.try_resize(0);
+
+         // Only the very first segment sends the configuration.
+         m_block_index++;
+      }
+
+      // Keep the tail around as the next segment's prime bytes.
+      const uint new_prime_size = LZHAM_MIN(m_params.m_segment_prime_size, m_segment_buf.size());
+      if (new_prime_size)
+         memmove(m_segment_buf.get_ptr(), m_segment_buf.get_ptr() + m_segment_buf.size() - new_prime_size, new_prime_size);
+      m_segment_buf.try_resize(new_prime_size);
+      m_segment_buf_prime_size = new_prime_size;
+
+      return true;
+   }
+
+   void lzcompressor::segment_job_callback(uint64 data, void* pData_ptr)
+   {
+      LZHAM_NOTE_UNUSED(pData_ptr);
+
+      const uint segment_index = static_cast<uint>(data);
+      segment_job& job = m_segment_jobs[segment_index];
+
+      job.m_succeeded = m_segment_compressors[segment_index]->compress_segment(job);
+   }
+
+   // Called on a segment compressor. The prime bytes are loaded like seed bytes, which the decompressor already has in its dictionary.
+   bool lzcompressor::compress_segment(const segment_job& job)
+   {
+      m_params.m_pSeed_bytes = job.m_pSrc - job.m_prime_size;
+      m_params.m_num_seed_bytes = job.m_prime_size;
+
+      if (!reset())
+         return false;
+
+      if (!job.m_first_segment)
+      {
+         // The decompressor already has the configuration, but its tables are still trained on the previous segment.
+         m_block_index = 1;
+         m_reset_all_tables_pending = true;
+      }
+
+      uint cur_ofs = 0;
+      while (cur_ofs < job.m_src_size)
+      {
+         const uint num_bytes_remaining = job.m_src_size - cur_ofs;
+         const uint num_bytes_to_compress = LZHAM_MIN(num_bytes_remaining, m_params.m_block_size);
+         const uint next_buf_len = LZHAM_MIN(num_bytes_remaining - num_bytes_to_compress, m_params.m_block_size);
+
+         if (!compress_block(job.m_pSrc + cur_ofs, num_bytes_to_compress, next_buf_len))
+            return false;
+
+         cur_ofs += num_bytes_to_compress;
+      }
+
+      return true;
+   }
+
+   // The index follows the final block: { uint64 src_ofs, uint64 comp_ofs } per segment, then uint32 num_segments, prime_size, magic.
+   bool lzcompressor::send_segment_index()
+   {
+      const uint num_segments = m_segment_index.size();
+
+      uint8 buf[8];
+      for (uint i = 0; i < num_segments * 2 + 3; i++)
+      {
+         uint64 val;
+         uint num_bytes = sizeof(uint64);
+         if (i < num_segments * 2)
+            val = (i & 1) ? m_segment_index[i >> 1].m_comp_ofs : m_segment_index[i >> 1].m_src_ofs;
+         else
+         {
+            const uint footer[3] = { num_segments, m_params.m_segment_prime_size, LZHAM_SEGMENT_INDEX_MAGIC };
+            val = footer[i - num_segments * 2];
+            num_bytes = sizeof(uint32);
+         }
+
+         for (uint j = 0; j < num_bytes; j++)
+            buf[j] = static_cast<uint8>(val >> (j * 8));
+
+         if (!m_comp_buf.append(buf, num_bytes))
+            return false;
+      }
+
+      return true;
+   }
+
+   void lzcompressor::delete_segment_compressors()
+   {
+      for (uint i = 0; i < m_segment_compressors.size(); i++)
+         lzham_delete(m_segment_compressors[i]);
+      m_segment_compressors.clear();
+   }
+
    bool lzcompressor::send_final_block()
    {
       if (!m_codec.start_encoding(16))
@@ -586,6 +1131,19 @@ namespace lzham
 
 #if LZHAM_UPDATE_STATS
       m_stats.print();
+
+      if (m_accel.get_max_helper_threads())
+      {
+         printf("Match finder helper thread work (block, total):\n");
+         for (uint i = 0; i < m_accel.get_max_helper_threads(); i++)
+            printf("  %u: %u %.0f\n", i, m_accel.get_helper_thread_work(i), (double)m_accel.get_total_helper_thread_work(i));
+      }
+
+      search_accelerator::wait_stats accel_wait_stats;
+      m_accel.get_wait_stats(accel_wait_stats);
+      printf("Match finder waits: %.0f spins (%3.3f ms), %.0f blocks (%3.3f ms)\n",
+         (double)accel_wait_stats.m_total_spins, lzham_timer::ticks_to_ms(accel_wait_stats.m_total_spin_ticks),
+         (double)accel_wait_stats.m_total_blocks, lzham_timer::ticks_to_ms(accel_wait_stats.m_total_block_ticks));
 #endif
 
       return true;
@@ -692,19 +1250,22 @@ namespace lzham
    // It assumes the input statistics are locally stationary over the input block to parse.
    bool lzcompressor::extreme_parse(parse_thread_state &parse_state)
    {
-      LZHAM_ASSERT(parse_state.m_bytes_to_match <= cMaxParseGraphNodes);
+      LZHAM_ASSERT(parse_state.m_bytes_to_match <= m_parse_graph_size);
 
       parse_state.m_failed = false;
       parse_state.m_emit_decisions_backwards = true;
 
-      node *pNodes = parse_state.m_nodes;
-      for (uint i = 0; i <= cMaxParseGraphNodes; i++)
+      node *pNodes = parse_state.m_nodes.get_ptr();
+      for (uint i = 0; i <= m_parse_graph_size; i++)
       {
          pNodes[i].clear();
       }
 
       state &approx_state = parse_state.m_initial_state;
 
+      const match_price_tables &price_tables = parse_state.m_price_tables;
+      parse_state.m_price_tables.init(*this, approx_state);
+
       pNodes[0].m_num_node_states = 1;
       node_state &first_node_state = pNodes[0].m_node_states[0];
       approx_state.save_partial_state(first_node_state.m_saved_state);
@@ -804,16 +1365,14 @@ namespace lzham
                   const uint comp_pos = static_cast<uint>((m_accel.m_lookahead_pos + cur_lookahead_ofs - dist) & m_accel.m_max_dict_size_mask);
                   const uint8* pComp = &m_accel.m_dict[comp_pos];
 
-                  for (hist_match_len = 0; hist_match_len < max_admissable_match_len; hist_match_len++)
-                     if (pComp[hist_match_len] != pLookahead[hist_match_len])
-                        break;
+                  hist_match_len = compute_match_len(pComp, pLookahead, 0, max_admissable_match_len);
                }
 
                if (hist_match_len >= match_hist_min_match_len)
                {
                   match_hist_max_len = math::maximum(match_hist_max_len, hist_match_len);
 
-                  approx_state.get_rep_match_costs(cur_dict_ofs, lzdec_bitcosts, rep_match_index, match_hist_min_match_len, hist_match_len, is_match_model_index);
+                  price_tables.get_rep_match_costs(approx_state, lzdec_bitcosts, rep_match_index, match_hist_min_match_len, hist_match_len, is_match_model_index);
 
                   uint rep_match_total_complexity = cur_node_total_complexity + (cRep0Complexity + rep_match_index);
                   for (uint l = match_hist_min_match_len; l <= hist_match_len; l++)
@@ -863,7 +1422,7 @@ namespace lzham
 
                   LZHAM_ASSERT(start_len <= end_len);
 
-                  approx_state.get_full_match_costs(*this, cur_dict_ofs, lzdec_bitcosts, match_dist, start_len, end_len, is_match_model_index);
+                  price_tables.get_full_match_costs(*this, approx_state, lzdec_bitcosts, match_dist, start_len, end_len, is_match_model_index);
 
                   for (uint l = start_len; l <= end_len; l++)
                   {
@@ -933,7 +1492,7 @@ namespace lzham
       lzdecision *pDst_dec = parse_state.m_best_decisions.get_ptr();
       do
       {
-         LZHAM_ASSERT((node_index >= 0) && (node_index <= (int)cMaxParseGraphNodes));
+         LZHAM_ASSERT((node_index >= 0) && (node_index <= (int)m_parse_graph_size));
 
          node& cur_node = pNodes[node_index];
          const node_state &cur_node_state = cur_node.m_node_states[node_state_index];
@@ -963,27 +1522,31 @@ namespace lzham
    // In very early versions of LZHAM the parse was much more understandable (straight Dijkstra with almost no bit price optimizations or coding heuristics).
    bool lzcompressor::optimal_parse(parse_thread_state &parse_state)
    {
-      LZHAM_ASSERT(parse_state.m_bytes_to_match <= cMaxParseGraphNodes);
+      LZHAM_ASSERT(parse_state.m_bytes_to_match <= m_parse_graph_size);
 
       parse_state.m_failed = false;
       parse_state.m_emit_decisions_backwards = true;
 
-      node_state *pNodes = reinterpret_cast<node_state*>(parse_state.m_nodes);
+      node_state *pNodes = reinterpret_cast<node_state*>(parse_state.m_nodes.get_ptr());
       pNodes[0].m_parent_index = -1;
       pNodes[0].m_total_cost = 0;
       pNodes[0].m_total_complexity = 0;
 
 #if 0
-      for (uint i = 1; i <= cMaxParseGraphNodes; i++)
+      for (uint i = 1; i <= m_parse_graph_size; i++)
       {
          pNodes[i].clear();
       }
 #else
-      memset( &pNodes[1], 0xFF, cMaxParseGraphNodes * sizeof(node_state));
+      memset( &pNodes[1], 0xFF, m_parse_graph_size * sizeof(node_state));
 #endif
 
       state &approx_state = parse_state.m_initial_state;
 
+      // The models are frozen for the whole parse, so their match prices only need to be read once.
+      const match_price_tables &price_tables = parse_state.m_price_tables;
+      parse_state.m_price_tables.init(*this, approx_state);
+
       const uint bytes_to_parse = parse_state.m_bytes_to_match;
 
       const uint lookahead_start_ofs = m_accel.get_lookahead_pos() & m_accel.get_max_dict_size_mask();
@@ -1037,16 +1600,14 @@ namespace lzham
                const uint comp_pos = static_cast<uint>((m_accel.m_lookahead_pos + cur_lookahead_ofs - dist) & m_accel.m_max_dict_size_mask);
                const uint8* pComp = &m_accel.m_dict[comp_pos];
 
-               for (hist_match_len = 0; hist_match_len < max_admissable_match_len; hist_match_len++)
-                  if (pComp[hist_match_len] != pLookahead[hist_match_len])
-                     break;
+               hist_match_len = compute_match_len(pComp, pLookahead, 0, max_admissable_match_len);
             }
 
             if (hist_match_len >= match_hist_min_match_len)
             {
                match_hist_max_len = math::maximum(match_hist_max_len, hist_match_len);
 
-               approx_state.get_rep_match_costs(cur_dict_ofs, lzdec_bitcosts, rep_match_index, match_hist_min_match_len, hist_match_len, is_match_model_index);
+               price_tables.get_rep_match_costs(approx_state, lzdec_bitcosts, rep_match_index, match_hist_min_match_len, hist_match_len, is_match_model_index);
 
                uint rep_match_total_complexity = cur_node_total_complexity + (cRep0Complexity + rep_match_index);
                for (uint l = match_hist_min_match_len; l <= hist_match_len; l++)
@@ -1098,7 +1659,7 @@ namespace lzham
                uint len2_match_dist = m_accel.get_len2_match(cur_lookahead_ofs);
                if (len2_match_dist)
                {
-                  bit_cost_t cost = approx_state.get_len2_match_cost(*this, cur_dict_ofs, len2_match_dist, is_match_model_index);
+                  bit_cost_t cost = price_tables.get_len2_match_cost(*this, approx_state, len2_match_dist, is_match_model_index);
 
 #if LZHAM_VERIFY_MATCH_COSTS
                   {
@@ -1167,7 +1728,7 @@ namespace lzham
 
                   LZHAM_ASSERT(start_len <= end_len);
 
-                  approx_state.get_full_match_costs(*this, cur_dict_ofs, lzdec_bitcosts, match_dist, start_len, end_len, is_match_model_index);
+                  price_tables.get_full_match_costs(*this, approx_state, lzdec_bitcosts, match_dist, start_len, end_len, is_match_model_index);
 
                   for (uint l = start_len; l <= end_len; l++)
                   {
@@ -1246,7 +1807,7 @@ namespace lzham
       lzdecision *pDst_dec = parse_state.m_best_decisions.get_ptr();
       do
       {
-         LZHAM_ASSERT((node_index >= 0) && (node_index <= (int)cMaxParseGraphNodes));
+         LZHAM_ASSERT((node_index >= 0) && (node_index <= (int)m_parse_graph_size));
          node_state& cur_node = pNodes[node_index];
 
          *pDst_dec++ = cur_node.m_lzdec;
@@ -1269,7 +1830,10 @@ namespace lzham
 
       parse_thread_state &parse_state = m_parse_thread_state[parse_job_index];
 
-      if ((m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_EXTREME_PARSING) && (m_params.m_compression_level == cCompressionLevelUber))
+      if (parse_state.m_speculative_initial_state)
+         predict_initial_state(parse_state);
+
+      if (m_extreme_parsing)
          extreme_parse(parse_state);
       else
          optimal_parse(parse_state);
@@ -1449,14 +2013,166 @@ namespace lzham
       return true;
    }
 
-   bool lzcompressor::compress_block(const void* pBuf, uint buf_len)
+   // Picks the longest match history entry at lookahead_ofs, unless the hash table's match (if any) is worth more. Returns 0 if neither is
+   // codable, otherwise the match length, with match_dist set as in lzdecision::m_dist.
+   uint lzcompressor::choose_fast_match(uint lookahead_ofs, uint max_match_len, uint full_match_len, uint full_match_dist, int& match_dist) const
+   {
+      uint best_len = 0;
+      for (uint i = 0; i < CLZBase::cMatchHistSize; i++)
+      {
+         uint hist_match_len = m_accel.get_match_len(lookahead_ofs, m_state.m_match_hist[i], max_match_len);
+         if (hist_match_len > best_len)
+         {
+            best_len = hist_match_len;
+            match_dist = -((int)i + 1);
+         }
+      }
+
+      if (best_len < CLZBase::cMinMatchLen)
+         best_len = 0;
+
+      // Rep matches are much cheaper to code, so a full match has to be at least 2 bytes longer to win.
+      if ((full_match_len > 3) || ((full_match_len == 3) && (full_match_dist <= cFastParseMaxLen3MatchDist)))
+      {
+         if (full_match_len > (best_len + 1))
+         {
+            best_len = full_match_len;
+            match_dist = full_match_dist;
+         }
+      }
+
+      return best_len;
+   }
+
+   // Codes the rest of the block at the greedy and lazy levels: each decision is chosen from the match history and one hash table probe, and
+   // coded right away. At the lazy level a match shorter than m_fast_bytes is dropped for a literal if the next position has a longer rep match.
+   bool lzcompressor::fast_parse(uint& cur_dict_ofs, uint& bytes_to_match)
+   {
+      LZHAM_ASSERT(m_accel.get_match_finder() == cMatchFinderHashTable);
+      LZHAM_ASSERT(m_accel.get_lookahead_size() == bytes_to_match);
+
+      // Probing a position also inserts it, so the lazy check's probe of the next position is kept for when it's reached.
+      bool have_next_probe = false;
+      uint next_full_match_len = 0;
+      uint next_full_match_dist = 0;
+
+      uint num_misses = 0;
+      uint num_unprobed_lits = 0;
+
+      while (bytes_to_match)
+      {
+         if (num_unprobed_lits)
+         {
+            num_unprobed_lits--;
+            if (!code_decision(lzdecision(cur_dict_ofs, 0, 0), cur_dict_ofs, bytes_to_match))
+               return false;
+            continue;
+         }
+
+         const uint max_match_len = LZHAM_MIN(bytes_to_match, static_cast<uint>(CLZBase::cMaxHugeMatchLen));
+
+         uint full_match_len = 0;
+         uint full_match_dist = 0;
+         if (have_next_probe)
+         {
+            full_match_len = next_full_match_len;
+            full_match_dist = next_full_match_dist;
+            have_next_probe = false;
+         }
+         else
+         {
+            full_match_len = m_accel.find_hash_match(0, max_match_len, full_match_dist);
+         }
+
+         int match_dist = 0;
+         uint match_len = choose_fast_match(0, max_match_len, full_match_len, full_match_dist, match_dist);
+
+         if ((match_len) && (match_len < m_settings.m_fast_bytes) && (bytes_to_match > match_len))
+         {
+            const uint next_max_match_len = LZHAM_MIN(bytes_to_match - 1, static_cast<uint>(CLZBase::cMaxHugeMatchLen));
+
+            next_full_match_len = m_accel.find_hash_match(1, next_max_match_len, next_full_match_dist);
+            have_next_probe = true;
+
+            // Only a longer rep match is worth a literal. Trading a full match for a longer full match one byte later loses more than it gains,
+            // because the first match's distance is often reused by a rep match right after it.
+            int next_match_dist = 0;
+            const uint next_match_len = choose_fast_match(1, next_max_match_len, next_full_match_len, next_full_match_dist, next_match_dist);
+            if ((next_match_dist < 0) && (next_match_len > match_len))
+               match_len = 0;
+         }
+
+         if (!match_len)
+         {
+            // Runs of misses are usually incompressible data, so probe less and less often until something is found.
+            if (!have_next_probe)
+            {
+               num_misses++;
+               num_unprobed_lits = num_misses >> cFastParseSkipShift;
+            }
+
+            if (!code_decision(lzdecision(cur_dict_ofs, 0, 0), cur_dict_ofs, bytes_to_match))
+               return false;
+            continue;
+         }
+
+         num_misses = 0;
+         have_next_probe = false;
+
+         const uint num_inserts = LZHAM_MIN(match_len, cFastParseMaxMatchInserts);
+         for (uint i = 1; i < num_inserts; i++)
+            m_accel.insert_hash(i);
+         if (match_len > num_inserts)
+            m_accel.insert_hash(match_len - 1);
+
+         if (!code_decision(lzdecision(cur_dict_ofs, match_len, match_dist), cur_dict_ofs, bytes_to_match))
+            return false;
+      }
+
+      return true;
+   }
+
+   // Greedily parses the bytes just before a speculative parse job, starting from a partial state reset. The match history this leaves behind
+   // usually agrees with the one the previous job's optimal parse ends with, and any disagreement is fixed by code_speculative_decision().
+   void lzcompressor::predict_initial_state(parse_thread_state &parse_state)
+   {
+      state &approx_state = parse_state.m_initial_state;
+      approx_state.reset_state_partial();
+
+      lzham::vector<lzpriced_decision> &decisions = parse_state.m_temp_decisions;
+
+      uint cur_dict_ofs = parse_state.m_speculation_start_ofs;
+      while (cur_dict_ofs < parse_state.m_start_ofs)
+      {
+         const uint max_admissable_match_len = LZHAM_MIN(static_cast<uint>(CLZBase::cMaxHugeMatchLen), parse_state.m_start_ofs - cur_dict_ofs);
+
+         int largest_dec_index = enumerate_lz_decisions(cur_dict_ofs, approx_state, decisions, 1, max_admissable_match_len);
+         if (largest_dec_index < 0)
+         {
+            // Out of memory - any starting state is still codable.
+            approx_state.reset_state_partial();
+            break;
+         }
+
+         const lzpriced_decision &dec = decisions[largest_dec_index];
+         approx_state.partial_advance(dec);
+         cur_dict_ofs += dec.get_len();
+      }
+
+      approx_state.m_cur_ofs = parse_state.m_start_ofs;
+      approx_state.save_partial_state(parse_state.m_predicted_state);
+   }
+
+   // next_buf_len is the # of bytes directly following pBuf that the caller will pass to the very next compress_block() call, or 0.
+   bool lzcompressor::compress_block(const void* pBuf, uint buf_len, uint next_buf_len)
    {
       uint cur_ofs = 0;
       uint bytes_remaining = buf_len;
       while (bytes_remaining)
       {
          uint bytes_to_compress = math::minimum(m_accel.get_max_add_bytes(), bytes_remaining);
-         if (!compress_block_internal(static_cast<const uint8*>(pBuf) + cur_ofs, bytes_to_compress))
+         const uint bytes_following = (bytes_remaining > bytes_to_compress) ? (bytes_remaining - bytes_to_compress) : next_buf_len;
+         if (!compress_block_internal(static_cast<const uint8*>(pBuf) + cur_ofs, bytes_to_compress, bytes_following))
             return false;
 
          cur_ofs += bytes_to_compress;
@@ -1465,7 +2181,7 @@ namespace lzham
       return true;
    }
 
-   void lzcompressor::update_block_history(uint comp_size, uint src_size, uint ratio, bool raw_block, bool reset_update_rate)
+   void lzcompressor::update_block_history(uint comp_size, uint src_size, uint ratio, bool raw_block, bool reset_update_rate, double kb_per_sec)
    {
       block_history& cur_block_history = m_block_history[m_block_history_next];
       m_block_history_next++;
@@ -1476,6 +2192,8 @@ namespace lzham
       cur_block_history.m_ratio = ratio;
       cur_block_history.m_raw_block = raw_block;
       cur_block_history.m_reset_update_rate = reset_update_rate;
+      cur_block_history.m_speed_step = m_speed_step;
+      cur_block_history.m_kb_per_sec = kb_per_sec;
 
       m_block_history_size = LZHAM_MIN(m_block_history_size + 1, static_cast<uint>(cMaxBlockHistorySize));
    }
@@ -1521,10 +2239,127 @@ namespace lzham
       return total_resets;
    }
 
-   bool lzcompressor::compress_block_internal(const void* pBuf, uint buf_len)
+   // With extreme parsing the first step just turns it off. Every step after that takes the match finder and parser settings of the next lower
+   // level, down to cCompressionLevelFastest. The Huffman and Polar code settings were sent with the configuration, so they stay the level's.
+   void lzcompressor::apply_speed_step()
+   {
+      uint level_step = m_speed_step;
+
+      const bool extreme_parsing = (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_EXTREME_PARSING) && (m_params.m_compression_level == cCompressionLevelUber);
+      m_extreme_parsing = extreme_parsing && (!level_step);
+      if ((extreme_parsing) && (level_step))
+         level_step--;
+
+      LZHAM_ASSERT(level_step <= static_cast<uint>(m_params.m_compression_level));
+      const comp_settings& step_settings = s_level_settings[m_params.m_compression_level - level_step];
+
+      m_settings.m_fast_bytes = step_settings.m_fast_bytes;
+      m_settings.m_match_accel_max_matches_per_probe = step_settings.m_match_accel_max_matches_per_probe;
+      m_settings.m_match_accel_max_probes = step_settings.m_match_accel_max_probes;
+
+      // The match finder may already be working on the next block, so it picks these up with the block after it.
+      m_accel.set_max_probes(m_settings.m_match_accel_max_probes, m_settings.m_match_accel_max_matches_per_probe);
+   }
+
+   // Steps up as soon as a block comes in under the target. Steps back down once recent blocks coded one step slower beat the target by 10%,
+   // or, if none are left in the history, once a block beats it by 2x.
+   void lzcompressor::update_speed_step()
+   {
+      if (!m_max_speed_step)
+         return;
+
+      const block_history& cur_block_history = m_block_history[(m_block_history_next + cMaxBlockHistorySize - 1) % cMaxBlockHistorySize];
+      if (cur_block_history.m_kb_per_sec <= 0.0f)
+         return;
+
+      const double target_kb_per_sec = m_params.m_target_comp_kb_per_sec;
+      if (cur_block_history.m_kb_per_sec < target_kb_per_sec)
+      {
+         if (m_speed_step < m_max_speed_step)
+         {
+            m_speed_step++;
+            apply_speed_step();
+         }
+         return;
+      }
+
+      if (!m_speed_step)
+         return;
+
+      double total_kb_per_sec = 0.0f;
+      uint num_blocks = 0;
+      for (uint i = 0; i < m_block_history_size; i++)
+      {
+         if ((m_block_history[i].m_speed_step == m_speed_step - 1) && (m_block_history[i].m_kb_per_sec > 0.0f))
+         {
+            total_kb_per_sec += m_block_history[i].m_kb_per_sec;
+            num_blocks++;
+         }
+      }
+
+      const bool step_down = num_blocks ? ((total_kb_per_sec / num_blocks) >= (target_kb_per_sec * 1.1f)) : (cur_block_history.m_kb_per_sec >= (target_kb_per_sec * 2.0f));
+      if (step_down)
+      {
+         m_speed_step--;
+         apply_speed_step();
+      }
+   }
+
+   bool lzcompressor::is_block_incompressible(const uint8* pBuf, uint buf_len)
+   {
+#if (LZHAM_FORCE_ALL_RAW_BLOCKS || defined(LZHAM_DISABLE_RAW_BLOCKS) || defined(LZHAM_LZDEBUG))
+      LZHAM_NOTE_UNUSED(pBuf);
+      LZHAM_NOTE_UNUSED(buf_len);
+      return false;
+#else
+      // The hash table engine only finds matches for the positions its parser probes, and the greedy and lazy parsers are cheap anyway. Long
+      // range matches are repeats of (possibly incompressible) data seen before, and always worth coding.
+      if ((buf_len < cIncompressibleMinBlockSize) || (m_accel.get_match_finder() == cMatchFinderHashTable) || (m_accel.get_num_long_range_matches()))
+         return false;
+
+      uint hist[256];
+      utils::zero_object(hist);
+      for (uint i = 0; i < buf_len; i++)
+         hist[pBuf[i]]++;
+
+      const double cInvLn2 = 1.4426950408889634074;
+      double total_bits = 0.0f;
+      for (uint i = 0; i < 256; i++)
+         if (hist[i])
+            total_bits -= hist[i] * log(hist[i] * (1.0f / buf_len)) * cInvLn2;
+
+      if (total_bits < (buf_len * (8.0f - 1.0f / cIncompressibleEntropyMarginRecip)))
+         return false;
+
+      // Only now wait on the match finder, which is still running on this block.
+      uint num_samples = 0;
+      uint num_matched_samples = 0;
+      for (uint ofs = 0; ofs < buf_len; ofs += cIncompressibleSampleStride)
+      {
+         num_samples++;
+
+         const dict_match* pMatch = m_accel.find_matches(ofs);
+         if (!pMatch)
+            continue;
+
+         // Matches are sorted by length, so the last is the longest.
+         while (!pMatch->is_last())
+            pMatch++;
+
+         if (pMatch->get_len() >= cIncompressibleMinMatchLen)
+            num_matched_samples++;
+      }
+
+      return (num_matched_samples * cIncompressibleMatchedSampleRecip) <= num_samples;
+#endif
+   }
+
+   bool lzcompressor::compress_block_internal(const void* pBuf, uint buf_len, uint next_buf_len)
    {
       scoped_perf_section compress_block_timer(cVarArgs, "****** compress_block %u", m_block_index);
 
+      const timer_ticks block_start_ticks = m_max_speed_step ? lzham_timer::get_ticks() : 0;
+
       LZHAM_ASSERT(pBuf);
       LZHAM_ASSERT(buf_len <= m_params.m_block_size);
 
@@ -1535,7 +2370,13 @@ namespace lzham
       m_src_size += buf_len;
 
       // Important: Don't do any expensive work until after add_bytes_begin() is called, to increase parallelism.
-      if (!m_accel.add_bytes_begin(buf_len, static_cast<const uint8*>(pBuf)))
+      if (m_next_block_queued)
+      {
+         // The previous block already started the match finder on these bytes.
+         LZHAM_ASSERT(m_accel.get_lookahead_size() == buf_len);
+         m_next_block_queued = false;
+      }
+      else if (!m_accel.add_bytes_begin(buf_len, static_cast<const uint8*>(pBuf)))
          return false;
 
       m_start_of_block_state = m_state;
@@ -1548,6 +2389,9 @@ namespace lzham
 
       uint bytes_to_match = buf_len;
 
+      // Blocks that would almost certainly end up raw aren't parsed at all.
+      const bool skip_parse = is_block_incompressible(static_cast<const uint8*>(pBuf), buf_len);
+
       if (!m_codec.start_encoding((buf_len * 9) / 8))
          return false;
 
@@ -1597,21 +2441,49 @@ namespace lzham
          }
       }
 
-      if (emit_reset_update_rate_command)
-         m_state.reset_update_rate();
+      if (m_reset_all_tables_pending)
+      {
+         // The state was reset when the segment started, and resetting all of the tables covers the update rates too.
+         emit_reset_update_rate_command = false;
+         m_codec.encode_bits(2, cBlockFlushTypeBits);
+      }
+      else
+      {
+         if (emit_reset_update_rate_command)
+            m_state.reset_update_rate();
 
-      m_codec.encode_bits(emit_reset_update_rate_command ? 1 : 0, cBlockFlushTypeBits);
+         m_codec.encode_bits(emit_reset_update_rate_command ? 1 : 0, cBlockFlushTypeBits);
+      }
 
       //coding_stats initial_stats(m_stats);
 
       uint initial_step = m_step;
 
+      if (skip_parse)
+      {
+         // The match finder still indexes the block, so later blocks can match against it.
+         m_accel.advance_bytes(bytes_to_match);
+         cur_dict_ofs += bytes_to_match;
+         bytes_to_match = 0;
+      }
+      // The greedy and lazy levels code the whole block here, leaving nothing for the parse jobs below.
+      else if (m_params.m_compression_level < cCompressionLevelFastest)
+      {
+         scoped_perf_section fast_parse_timer("fast_parse");
+
+         if (!fast_parse(cur_dict_ofs, bytes_to_match))
+            return false;
+      }
+
       while (bytes_to_match)
       {
          const uint cAvgAcceptableGreedyMatchLen = 384;
-         if ((m_params.m_pSeed_bytes) && (bytes_to_match >= cAvgAcceptableGreedyMatchLen))
+
+         // Runs of huge matches mostly come from a seed, or from the far repeats found by long range matching, so only then is it worth trying a
+         // cheap greedy parse before the optimal one.
+         if (((m_params.m_pSeed_bytes) || (m_accel.get_num_long_range_matches())) && (bytes_to_match >= cAvgAcceptableGreedyMatchLen))
          {
-            parse_thread_state &greedy_parse_state = m_parse_thread_state[cMaxParseThreads];
+            parse_thread_state &greedy_parse_state = m_parse_thread_state[m_max_parse_threads];
 
             greedy_parse_state.m_initial_state = m_state;
             greedy_parse_state.m_initial_state.m_cur_ofs = cur_dict_ofs;
@@ -1688,14 +2560,14 @@ namespace lzham
             }
          }
 
-         uint num_parse_jobs = LZHAM_MIN(m_num_parse_threads, (bytes_to_match + cMaxParseGraphNodes - 1) / cMaxParseGraphNodes);
+         uint num_parse_jobs = LZHAM_MIN(m_num_parse_threads, (bytes_to_match + m_parse_graph_size - 1) / m_parse_graph_size);
          if ((m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_DETERMINISTIC_PARSING) == 0)
          {
             if (m_use_task_pool && m_accel.get_max_helper_threads())
             {
                // Increase the number of active parse jobs as the match finder finishes up to keep CPU utilization up.
                num_parse_jobs += m_accel.get_num_completed_helper_threads();
-               num_parse_jobs = LZHAM_MIN(num_parse_jobs, cMaxParseThreads);
+               num_parse_jobs = LZHAM_MIN(num_parse_jobs, m_max_parse_threads);
             }
          }
          if (bytes_to_match < 1536)
@@ -1703,14 +2575,14 @@ namespace lzham
 
          // Reduce block size near the beginning of the file so statistical models get going a bit faster.
          bool force_small_block = false;
-         if ((!m_block_index) && ((cur_dict_ofs - m_block_start_dict_ofs) < cMaxParseGraphNodes))
+         if ((!m_block_index) && ((cur_dict_ofs - m_block_start_dict_ofs) < m_parse_graph_size))
          {
             num_parse_jobs = 1;
             force_small_block = true;
          }
 
          uint parse_thread_start_ofs = cur_dict_ofs;
-         uint parse_thread_total_size = LZHAM_MIN(bytes_to_match, cMaxParseGraphNodes * num_parse_jobs);
+         uint parse_thread_total_size = LZHAM_MIN(bytes_to_match, m_parse_graph_size * num_parse_jobs);
          if (force_small_block)
          {
             parse_thread_total_size = LZHAM_MIN(parse_thread_total_size, 1536);
@@ -1724,14 +2596,22 @@ namespace lzham
             parse_thread.m_initial_state = m_state;
             parse_thread.m_initial_state.m_cur_ofs = parse_thread_start_ofs;
 
+            parse_thread.m_issue_reset_state_partial = false;
+            parse_thread.m_speculative_initial_state = false;
+
             if (parse_thread_index > 0)
             {
-               parse_thread.m_initial_state.reset_state_partial();
-               parse_thread.m_issue_reset_state_partial = true;
-            }
-            else
-            {
-               parse_thread.m_issue_reset_state_partial = false;
+               if (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_SPECULATIVE_PARSING)
+               {
+                  // The state is predicted by the job itself, so the warmup runs in parallel too.
+                  parse_thread.m_speculative_initial_state = true;
+                  parse_thread.m_speculation_start_ofs = parse_thread_start_ofs - LZHAM_MIN(cSpeculativeParseWarmupBytes, parse_thread_start_ofs - cur_dict_ofs);
+               }
+               else
+               {
+                  parse_thread.m_initial_state.reset_state_partial();
+                  parse_thread.m_issue_reset_state_partial = true;
+               }
             }
 
             parse_thread.m_start_ofs = parse_thread_start_ofs;
@@ -1740,7 +2620,7 @@ namespace lzham
             else
                parse_thread.m_bytes_to_match = parse_thread_total_size / num_parse_jobs;
 
-            parse_thread.m_bytes_to_match = LZHAM_MIN(parse_thread.m_bytes_to_match, cMaxParseGraphNodes);
+            parse_thread.m_bytes_to_match = LZHAM_MIN(parse_thread.m_bytes_to_match, m_parse_graph_size);
             LZHAM_ASSERT(parse_thread.m_bytes_to_match > 0);
 
             parse_thread.m_max_greedy_decisions = UINT_MAX;
@@ -1800,6 +2680,15 @@ namespace lzham
                   m_step++;
                }
 
+               // Decisions parsed from a predicted state must be translated until the real state agrees with the prediction.
+               state_base predicted_state;
+               bool mispredicted = false;
+               if (parse_thread.m_speculative_initial_state)
+               {
+                  predicted_state = parse_thread.m_predicted_state;
+                  mispredicted = !(m_state == predicted_state);
+               }
+
                if (best_decisions.size())
                {
                   int i = 0;
@@ -1830,8 +2719,17 @@ namespace lzham
                      //m_state.print(m_codec, *this, m_accel, best_decisions[i]);
 #endif
 
-                     if (!code_decision(best_decisions[i], cur_dict_ofs, bytes_to_match))
+                     if (mispredicted)
+                     {
+                        if (!code_speculative_decision(best_decisions[i], predicted_state, cur_dict_ofs, bytes_to_match))
+                           return false;
+
+                        predicted_state.partial_advance(best_decisions[i]);
+                        mispredicted = !(m_state == predicted_state);
+                     }
+                     else if (!code_decision(best_decisions[i], cur_dict_ofs, bytes_to_match))
                         return false;
+
                      if (i == end_dec_index)
                         break;
                      i += dec_step;
@@ -1852,6 +2750,19 @@ namespace lzham
          m_accel.add_bytes_end();
       }
 
+      // This block is fully parsed, and blocks are at most 1/8th of the dictionary, so the next block's bytes can't overwrite it. Start the
+      // helper threads on the next block now, so they index it while this one's end of block, flush, raw block check and append run serially.
+      if ((next_buf_len) && (m_use_task_pool) && (m_accel.get_max_helper_threads()))
+      {
+         scoped_perf_section queue_next_block_timer("add_bytes_begin (next block)");
+
+         const uint next_bytes_to_compress = math::minimum(m_accel.get_max_add_bytes(), next_buf_len);
+         if (!m_accel.add_bytes_begin(next_bytes_to_compress, static_cast<const uint8*>(pBuf) + buf_len))
+            return false;
+
+         m_next_block_queued = true;
+      }
+
       if (!m_state.encode_eob(m_codec, m_accel, cur_dict_ofs))
          return false;
 
@@ -1875,7 +2786,7 @@ namespace lzham
    #if (defined(LZHAM_DISABLE_RAW_BLOCKS) || defined(LZHAM_LZDEBUG))
        if (0)
    #else
-       if (compressed_size >= buf_len)
+       if ((skip_parse) || (compressed_size >= buf_len))
    #endif
 #endif
       {
@@ -1917,24 +2828,41 @@ namespace lzham
          if (!m_codec.encode_align_to_byte())
             return false;
 
-         const uint8* pSrc = m_accel.get_ptr(m_block_start_dict_ofs);
-
-         for (uint i = 0; i < buf_len; i++)
-         {
-            if (!m_codec.encode_bits(*pSrc++, 8))
-               return false;
-         }
+         if (!m_codec.encode_aligned_bytes(m_accel.get_ptr(m_block_start_dict_ofs), buf_len))
+            return false;
 
          if (!m_codec.stop_encoding(true))
             return false;
 
          used_raw_block = true;
          emit_reset_update_rate_command = false;
+
+#if LZHAM_UPDATE_STATS
+         if (skip_parse)
+         {
+            m_stats.m_total_unparsed_raw_blocks++;
+            m_stats.m_total_bytes += buf_len;
+         }
+#endif
       }
 
+      // Raw blocks don't carry a flush type, so a pending reset waits for the next compressed block.
+      if (!used_raw_block)
+         m_reset_all_tables_pending = false;
+
       uint comp_size = m_codec.get_encoding_buf().size();
       uint scaled_ratio =  (comp_size * cBlockHistoryCompRatioScale) / buf_len;
-      update_block_history(comp_size, buf_len, scaled_ratio, used_raw_block, emit_reset_update_rate_command);
+
+      double kb_per_sec = 0.0f;
+      if ((m_max_speed_step) && (!used_raw_block) && (buf_len >= cMinTimedBlockSize))
+      {
+         const double block_secs = lzham_timer::ticks_to_secs(lzham_timer::get_ticks() - block_start_ticks);
+         if (block_secs > 0.0f)
+            kb_per_sec = (buf_len / 1024.0f) / block_secs;
+      }
+
+      update_block_history(comp_size, buf_len, scaled_ratio, used_raw_block, emit_reset_update_rate_command, kb_per_sec);
+      update_speed_step();
 
       //printf("\n%u, %u, %u, %u\n", m_block_index, 500*emit_reset_update_rate_command, scaled_ratio, get_recent_block_ratio());
 
@@ -1962,4 +2890,58 @@ namespace lzham
       return true;
    }
 
+   prepared_dict::prepared_dict() :
+      m_seed_adler32(0),
+      m_ref_count(1)
+   {
+   }
+
+   bool prepared_dict::init(const lzcompressor::init_params& params)
+   {
+      if ((!params.m_num_seed_bytes) || (!params.m_pSeed_bytes) || (params.m_pPrepared_dict))
+         return false;
+
+      // Let a throwaway compressor index the seed exactly as it would for itself, then keep only its match finder's state.
+      lzcompressor* pComp = lzham_new<lzcompressor>();
+      if (!pComp)
+         return false;
+
+      bool success = pComp->init(params) && pComp->create_seed_snapshot(m_snapshot);
+
+      lzham_delete(pComp);
+
+      if (!success)
+         return false;
+
+      m_params = params;
+      m_params.m_pTask_pool = NULL;
+      m_params.m_max_helper_threads = 0;
+      m_params.m_pSeed_bytes = get_seed_bytes();
+
+      m_seed_adler32 = adler32(params.m_pSeed_bytes, params.m_num_seed_bytes);
+
+      return true;
+   }
+
+   bool prepared_dict::is_compatible(const lzcompressor::init_params& params) const
+   {
+      return (params.m_dict_size_log2 == m_params.m_dict_size_log2) &&
+             (params.m_compression_level == m_params.m_compression_level) &&
+             (params.m_block_size == m_params.m_block_size) &&
+             (params.m_match_hash_bits == m_params.m_match_hash_bits) &&
+             (params.m_match_hash_bytes == m_params.m_match_hash_bytes) &&
+             (params.m_match_finder == m_params.m_match_finder) &&
+             ((params.m_lzham_compress_flags & LZHAM_COMP_FLAG_LONG_RANGE_MATCHING) == (m_params.m_lzham_compress_flags & LZHAM_COMP_FLAG_LONG_RANGE_MATCHING));
+   }
+
+   void prepared_dict::add_ref()
+   {
+      atomic_increment32(&m_ref_count);
+   }
+
+   bool prepared_dict::release()
+   {
+      return atomic_decrement32(&m_ref_count) == 0;
+   }
+
 } // namespace lzham
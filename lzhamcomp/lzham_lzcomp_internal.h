@@ -9,11 +9,25 @@ namespace lzham
 {
    typedef lzham::vector<uint8> byte_vec;
 
-   const uint cMaxParseGraphNodes = 3072;
-   const uint cMaxParseThreads = 8;
+   const uint cMinParseGraphNodes = LZHAM_MIN_PARSE_GRAPH_SIZE;
+   const uint cMaxParseGraphNodes = LZHAM_MAX_PARSE_GRAPH_SIZE;
+   const uint cDefaultParseGraphNodes = 3072;
+   const uint cMaxParseThreads = LZHAM_MAX_PARSE_THREADS;
+   const uint cMaxPartialResetParseThreads = 8;
+   const uint cSpeculativeParseWarmupBytes = 512;
+
+   // Greedy and lazy levels: the hash table size cap, the first cFastParseMaxMatchInserts positions of each match (and its last) are indexed,
+   // 3 byte matches are only taken up to cFastParseMaxLen3MatchDist back, and after every 1<<cFastParseSkipShift probes in a row that find
+   // nothing one more literal is coded without probing.
+   const uint cFastParseMaxHashBits = 18;
+   const uint cFastParseMaxMatchInserts = 16;
+   const uint cFastParseMaxLen3MatchDist = 4096;
+   const uint cFastParseSkipShift = 5;
 
    enum compression_level
    {
+      cCompressionLevelGreedy,
+      cCompressionLevelLazy,
       cCompressionLevelFastest,
       cCompressionLevelFaster,
       cCompressionLevelDefault,
@@ -23,6 +37,8 @@ namespace lzham
       cCompressionLevelCount
    };
 
+   class prepared_dict;
+
    struct comp_settings
    {
       uint m_fast_bytes;
@@ -36,6 +52,7 @@ namespace lzham
    {
    public:
       lzcompressor();
+      ~lzcompressor();
 
       struct init_params
       {
@@ -56,7 +73,18 @@ namespace lzham
             m_cacheline_size(0),
             m_lzham_compress_flags(0),
             m_pSeed_bytes(0),
-            m_num_seed_bytes(0)
+            m_num_seed_bytes(0),
+            m_match_hash_bits(0),
+            m_match_hash_bytes(0),
+            m_match_finder(cMatchFinderBinaryTree),
+            m_pPrepared_dict(NULL),
+            m_numa_node(-1),
+            m_max_parse_threads(0),
+            m_parse_graph_size(0),
+            m_segment_size_log2(0),
+            m_segment_prime_size(0),
+            m_target_comp_kb_per_sec(0),
+            m_accel_dict_size_log2(0)
          {
          }
 
@@ -75,11 +103,42 @@ namespace lzham
 
          const void *m_pSeed_bytes;
          uint m_num_seed_bytes;
+
+         // 0 = automatic
+         uint m_match_hash_bits;
+         uint m_match_hash_bytes;
+
+         match_finder_type m_match_finder;
+
+         // If not NULL, the seed dictionary comes from here instead of m_pSeed_bytes, and isn't indexed again by init() or reset().
+         const prepared_dict* m_pPrepared_dict;
+
+         // NUMA node the match finder's buffers should come from, or -1 for the OS default.
+         int m_numa_node;
+
+         // 0 = automatic
+         uint m_max_parse_threads;
+         uint m_parse_graph_size;
+
+         // LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS only.
+         uint m_segment_size_log2;
+         uint m_segment_prime_size;
+
+         // 0 = off
+         uint m_target_comp_kb_per_sec;
+
+         // log2 of the match finder's window, or 0 for m_dict_size_log2. The stream is still coded for m_dict_size_log2, so a smaller window
+         // just finds fewer matches.
+         uint m_accel_dict_size_log2;
       };
 
       bool init(const init_params& params);
       void clear();
 
+      // Initializes this compressor to a copy of other, which must be between put_bytes()/flush() calls, so both streams can be continued independently.
+      // other's match finder memory is shared copy-on-write where possible. pTask_pool must have as many threads as other's pool.
+      bool init_clone(lzcompressor& other, task_pool* pTask_pool);
+
       // sync, or sync+dictionary flush 
       bool flush(lzham_flush_t flush_type);
 
@@ -92,6 +151,11 @@ namespace lzham
 
       uint32 get_src_adler32() const { return m_src_adler32; }
 
+      const init_params& get_params() const { return m_params; }
+
+      // Captures the match finder's state right after init(), before any bytes have been compressed.
+      bool create_seed_snapshot(match_accel_snapshot& snapshot) const;
+
    private:
       class state;
       
@@ -266,6 +330,32 @@ namespace lzham
          sym_data_model m_dist_lsb_table;
       };
 
+      // A state's match prices, flattened out of its Huffman and bit models. The models don't change while a parse job runs (only the
+      // state_base part of its approximate state does), so the parsers build these once per job and price match lengths by table lookup.
+      // Gives exactly the same costs as the state methods of the same names.
+      class match_price_tables
+      {
+      public:
+         void init(const CLZBase& lzbase, const state& s);
+
+         bit_cost_t get_len2_match_cost(CLZBase& lzbase, const state& s, uint len2_match_dist, uint is_match_model_index) const;
+         void get_rep_match_costs(const state& s, bit_cost_t *pBitcosts, uint match_hist_index, int min_len, int max_len, uint is_match_model_index) const;
+         void get_full_match_costs(CLZBase& lzbase, const state& s, bit_cost_t *pBitcosts, uint match_dist, int min_len, int max_len, uint is_match_model_index) const;
+
+      private:
+         // Indexed by match length, with the huge match code's price at cMaxMatchLen + 1.
+         bit_cost_t m_rep_len_cost[2][CLZBase::cMaxMatchLen + 2];
+         bit_cost_t m_large_len_cost[2][CLZBase::cMaxMatchLen + 2];
+
+         bit_cost_t m_main_cost[CLZBase::cLZXNumSpecialLengths + CLZBase::cLZXMaxPositionSlots * 8];
+         bit_cost_t m_dist_lsb_cost[16];
+
+         // The is_rep/is_rep0/is_rep1/is_rep2 bits leading up to each kind of match, by m_cur_state.
+         bit_cost_t m_full_match_base_cost[CLZBase::cNumStates];
+         bit_cost_t m_rep_match_base_cost[CLZBase::cNumStates][CLZBase::cMatchHistSize];
+         bit_cost_t m_rep0_single_byte_cost[CLZBase::cNumStates][2];
+      };
+
       class tracked_stat
       {
       public:
@@ -336,6 +426,7 @@ namespace lzham
          uint m_total_near_len2_matches;
 
          uint m_total_update_rate_resets;
+         uint m_total_unparsed_raw_blocks;
 
          uint m_max_len2_dist;
       };
@@ -363,6 +454,41 @@ namespace lzham
 
       bool m_finished;
       bool m_use_task_pool;
+
+      // Set when the match finder was already handed the next block's bytes while the previous block was still being coded.
+      bool m_next_block_queued;
+
+      // Set while coding a segment after the first (LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS). The first block that isn't raw tells the
+      // decompressor to reset all of its tables.
+      bool m_reset_all_tables_pending;
+
+      // LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS: segment job i runs on m_segment_compressors[i], which is created on first use and reused by later batches.
+      struct segment_job
+      {
+         const uint8* m_pSrc;
+         uint m_src_size;
+         uint m_prime_size;
+         bool m_first_segment;
+         bool m_succeeded;
+      };
+
+      struct segment_index_entry
+      {
+         uint64 m_src_ofs;
+         uint64 m_comp_ofs;
+      };
+
+      lzham::vector<lzcompressor*> m_segment_compressors;
+      lzham::vector<segment_job> m_segment_jobs;
+      lzham::vector<segment_index_entry> m_segment_index;
+
+      // The (up to) m_segment_prime_size bytes before the next segment, followed by the input that hasn't been compressed yet.
+      byte_vec m_segment_buf;
+      uint m_segment_buf_prime_size;
+
+      // Uncompressed bytes passed to segments, and compressed bytes output (including any the caller has already taken), so far.
+      uint64 m_segment_src_ofs;
+      uint64 m_segment_comp_ofs;
             
       struct node_state
       {
@@ -414,7 +540,9 @@ namespace lzham
 
          state m_initial_state;
 
-         node m_nodes[cMaxParseGraphNodes + 1];
+         lzham::vector<node> m_nodes;
+
+         match_price_tables m_price_tables;
                   
          lzham::vector<lzdecision> m_best_decisions;
          bool m_emit_decisions_backwards;
@@ -426,6 +554,13 @@ namespace lzham
          bool m_greedy_parse_gave_up;
          
          bool m_issue_reset_state_partial;
+
+         // If true, m_initial_state is predicted by greedily parsing from m_speculation_start_ofs up to m_start_ofs. The parse modifies
+         // m_initial_state, so the prediction is also kept in m_predicted_state.
+         bool m_speculative_initial_state;
+         uint m_speculation_start_ofs;
+         state_base m_predicted_state;
+
          bool m_failed;
       };
 
@@ -435,7 +570,12 @@ namespace lzham
       };
 
       uint m_num_parse_threads;
-      parse_thread_state m_parse_thread_state[cMaxParseThreads + 1]; // +1 extra for the greedy parser thread (only used for delta compression)
+      uint m_max_parse_threads;
+      uint m_parse_graph_size;
+
+      // m_max_parse_threads + 1 entries, the extra one for the greedy parser thread (only used for delta compression).
+      parse_thread_state* m_parse_thread_state;
+      uint m_num_parse_thread_states;
 
       volatile atomic32_t m_parse_jobs_remaining;
       semaphore m_parse_jobs_complete;
@@ -448,16 +588,44 @@ namespace lzham
          uint m_ratio;
          bool m_raw_block;
          bool m_reset_update_rate;
+         uint m_speed_step;
+         double m_kb_per_sec;    // 0 if the block wasn't timed
       };
       block_history m_block_history[cMaxBlockHistorySize];
       uint m_block_history_size;
       uint m_block_history_next;
-      void update_block_history(uint comp_size, uint src_size, uint ratio, bool raw_block, bool reset_update_rate);
+      void update_block_history(uint comp_size, uint src_size, uint ratio, bool raw_block, bool reset_update_rate, double kb_per_sec);
       uint get_recent_block_ratio();
       uint get_min_block_ratio();
       uint get_max_block_ratio();
       uint get_total_recent_reset_update_rate();
+
+      // m_params.m_target_comp_kb_per_sec: step 0 codes with the level's own settings, each step after it is faster (see apply_speed_step()).
+      // Raw blocks and blocks under cMinTimedBlockSize bytes aren't timed.
+      enum { cMinTimedBlockSize = 65536 };
+      uint m_speed_step;
+      uint m_max_speed_step;
+      bool m_extreme_parsing;
+      void apply_speed_step();
+      void update_speed_step();
+
+      // A block whose order-0 entropy is within 1/cIncompressibleEntropyMarginRecip bits per byte of 8, and where no more than
+      // 1/cIncompressibleMatchedSampleRecip of every cIncompressibleSampleStride'th position has a match of at least cIncompressibleMinMatchLen
+      // bytes, is sent raw without being parsed.
+      enum
+      {
+         cIncompressibleMinBlockSize = 4096,
+         cIncompressibleEntropyMarginRecip = 32,
+         cIncompressibleSampleStride = 32,
+         cIncompressibleMinMatchLen = 6,
+         cIncompressibleMatchedSampleRecip = 256
+      };
+      bool is_block_incompressible(const uint8* pBuf, uint buf_len);
       
+      bool init_internal(lzcompressor* pClone_src);
+      bool init_parse_thread_states();
+      void free_parse_thread_states();
+      bool clone_state(const lzcompressor& other);
       bool send_zlib_header();
       bool init_seed_bytes();
       bool send_final_block();
@@ -466,13 +634,55 @@ namespace lzham
       bool optimal_parse(parse_thread_state &parse_state);
       int enumerate_lz_decisions(uint ofs, const state& cur_state, lzham::vector<lzpriced_decision>& decisions, uint min_match_len, uint max_match_len);
       bool greedy_parse(parse_thread_state &parse_state);
+      void predict_initial_state(parse_thread_state &parse_state);
+      uint choose_fast_match(uint lookahead_ofs, uint max_match_len, uint full_match_len, uint full_match_dist, int& match_dist) const;
+      bool fast_parse(uint& cur_dict_ofs, uint& bytes_to_match);
       void parse_job_callback(uint64 data, void* pData_ptr);
-      bool compress_block(const void* pBuf, uint buf_len);
-      bool compress_block_internal(const void* pBuf, uint buf_len);
+      bool put_segment_bytes(const uint8* pBuf, uint buf_len);
+      bool compress_segments();
+      void segment_job_callback(uint64 data, void* pData_ptr);
+      bool compress_segment(const segment_job& job);
+      bool send_segment_index();
+      void delete_segment_compressors();
+      bool compress_block(const void* pBuf, uint buf_len, uint next_buf_len = 0);
+      bool compress_block_internal(const void* pBuf, uint buf_len, uint next_buf_len);
       bool code_decision(lzdecision lzdec, uint& cur_ofs, uint& bytes_to_match);
+      bool code_speculative_decision(const lzdecision& lzdec, const state_base& predicted_state, uint& cur_ofs, uint& bytes_to_match);
       bool send_sync_block(lzham_flush_t flush_type);
    };
 
+   // A seed dictionary indexed once, then shared read-only by any number of lzcompressors on any thread.
+   class prepared_dict
+   {
+      LZHAM_NO_COPY_OR_ASSIGNMENT_OP(prepared_dict);
+
+   public:
+      prepared_dict();
+
+      // Indexes params.m_pSeed_bytes. The other params must be the same as those of the compressors that will use the dictionary.
+      bool init(const lzcompressor::init_params& params);
+
+      bool is_compatible(const lzcompressor::init_params& params) const;
+
+      // The seed bytes, which live at the start of the snapshot's dictionary.
+      inline const uint8* get_seed_bytes() const { return m_snapshot.m_image.get_ptr(); }
+      inline uint get_num_seed_bytes() const { return m_params.m_num_seed_bytes; }
+      inline uint32 get_seed_adler32() const { return m_seed_adler32; }
+
+      inline const match_accel_snapshot& get_snapshot() const { return m_snapshot; }
+
+      void add_ref();
+      // Returns true if that was the last reference, in which case the caller must delete the object.
+      bool release();
+
+   private:
+      lzcompressor::init_params m_params;
+      uint32 m_seed_adler32;
+      match_accel_snapshot m_snapshot;
+
+      volatile atomic32_t m_ref_count;
+   };
+
 } // namespace lzham
 
 
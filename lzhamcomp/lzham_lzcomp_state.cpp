@@ -619,6 +619,133 @@ namespace lzham
       }
    }
 
+   void lzcompressor::match_price_tables::init(const CLZBase& lzbase, const state& s)
+   {
+      for (uint i = 0; i < 2; i++)
+      {
+         for (uint match_len = CLZBase::cMinMatchLen; match_len <= CLZBase::cMaxMatchLen + 1; match_len++)
+            m_rep_len_cost[i][match_len] = s.m_rep_len_table[i].get_cost(match_len - CLZBase::cMinMatchLen);
+
+         for (uint match_len = 9; match_len <= CLZBase::cMaxMatchLen + 1; match_len++)
+            m_large_len_cost[i][match_len] = s.m_large_len_table[i].get_cost(match_len - 9);
+      }
+
+      const uint num_main_syms = CLZBase::cLZXNumSpecialLengths + (lzbase.m_num_lzx_slots - CLZBase::cLZXLowestUsableMatchSlot) * 8;
+      for (uint i = 0; i < num_main_syms; i++)
+         m_main_cost[i] = s.m_main_table.get_cost(i);
+
+      for (uint i = 0; i < 16; i++)
+         m_dist_lsb_cost[i] = s.m_dist_lsb_table.get_cost(i);
+
+      for (uint cur_state = 0; cur_state < CLZBase::cNumStates; cur_state++)
+      {
+         m_full_match_base_cost[cur_state] = s.m_is_rep_model[cur_state].get_cost(0);
+
+         const bit_cost_t rep_cost = s.m_is_rep_model[cur_state].get_cost(1);
+         m_rep_match_base_cost[cur_state][0] = rep_cost + s.m_is_rep0_model[cur_state].get_cost(1);
+
+         const bit_cost_t rep123_cost = rep_cost + s.m_is_rep0_model[cur_state].get_cost(0);
+         m_rep_match_base_cost[cur_state][1] = rep123_cost + s.m_is_rep1_model[cur_state].get_cost(1);
+         m_rep_match_base_cost[cur_state][2] = rep123_cost + s.m_is_rep1_model[cur_state].get_cost(0) + s.m_is_rep2_model[cur_state].get_cost(1);
+         m_rep_match_base_cost[cur_state][3] = rep123_cost + s.m_is_rep1_model[cur_state].get_cost(0) + s.m_is_rep2_model[cur_state].get_cost(0);
+
+         m_rep0_single_byte_cost[cur_state][0] = s.m_is_rep0_single_byte_model[cur_state].get_cost(0);
+         m_rep0_single_byte_cost[cur_state][1] = s.m_is_rep0_single_byte_model[cur_state].get_cost(1);
+      }
+   }
+
+   bit_cost_t lzcompressor::match_price_tables::get_len2_match_cost(CLZBase& lzbase, const state& s, uint len2_match_dist, uint is_match_model_index) const
+   {
+      bit_cost_t cost = s.m_is_match_model[is_match_model_index].get_cost(1) + m_full_match_base_cost[s.m_cur_state];
+
+      uint match_slot, match_extra;
+      lzbase.compute_lzx_position_slot(len2_match_dist, match_slot, match_extra);
+      LZHAM_ASSERT(match_slot >= CLZBase::cLZXLowestUsableMatchSlot && (match_slot < lzbase.m_num_lzx_slots));
+
+      uint match_high_sym = match_slot - CLZBase::cLZXLowestUsableMatchSlot;
+      cost += m_main_cost[CLZBase::cLZXNumSpecialLengths + (match_high_sym << 3)];
+
+      uint num_extra_bits = lzbase.m_lzx_position_extra_bits[match_slot];
+      if (num_extra_bits < 3)
+         cost += convert_to_scaled_bitcost(num_extra_bits);
+      else
+      {
+         if (num_extra_bits > 4)
+            cost += convert_to_scaled_bitcost(num_extra_bits - 4);
+
+         cost += m_dist_lsb_cost[match_extra & 15];
+      }
+
+      return cost;
+   }
+
+   void lzcompressor::match_price_tables::get_rep_match_costs(const state& s, bit_cost_t *pBitcosts, uint match_hist_index, int min_len, int max_len, uint is_match_model_index) const
+   {
+      const uint cur_state = s.m_cur_state;
+      const bit_cost_t *pLen_costs = m_rep_len_cost[cur_state >= CLZBase::cNumLitStates];
+
+      bit_cost_t base_cost = s.m_is_match_model[is_match_model_index].get_cost(1) + m_rep_match_base_cost[cur_state][match_hist_index];
+
+      if (!match_hist_index)
+      {
+         if (min_len == 1)
+         {
+            // single byte rep0
+            pBitcosts[1] = base_cost + m_rep0_single_byte_cost[cur_state][1];
+            min_len++;
+         }
+
+         base_cost += m_rep0_single_byte_cost[cur_state][0];
+      }
+
+      int match_len = min_len;
+      for (const int end_len = LZHAM_MIN(max_len, static_cast<int>(CLZBase::cMaxMatchLen)); match_len <= end_len; match_len++)
+         pBitcosts[match_len] = base_cost + pLen_costs[match_len];
+
+      for ( ; match_len <= max_len; match_len++)
+         pBitcosts[match_len] = get_huge_match_code_len(match_len) + base_cost + pLen_costs[CLZBase::cMaxMatchLen + 1];
+   }
+
+   void lzcompressor::match_price_tables::get_full_match_costs(CLZBase& lzbase, const state& s, bit_cost_t *pBitcosts, uint match_dist, int min_len, int max_len, uint is_match_model_index) const
+   {
+      LZHAM_ASSERT(min_len >= CLZBase::cMinMatchLen);
+
+      bit_cost_t cost = s.m_is_match_model[is_match_model_index].get_cost(1) + m_full_match_base_cost[s.m_cur_state];
+
+      uint match_slot, match_extra;
+      lzbase.compute_lzx_position_slot(match_dist, match_slot, match_extra);
+      LZHAM_ASSERT(match_slot >= CLZBase::cLZXLowestUsableMatchSlot && (match_slot < lzbase.m_num_lzx_slots));
+
+      uint num_extra_bits = lzbase.m_lzx_position_extra_bits[match_slot];
+
+      if (num_extra_bits < 3)
+         cost += convert_to_scaled_bitcost(num_extra_bits);
+      else
+      {
+         if (num_extra_bits > 4)
+            cost += convert_to_scaled_bitcost(num_extra_bits - 4);
+
+         cost += m_dist_lsb_cost[match_extra & 15];
+      }
+
+      uint match_high_sym = match_slot - CLZBase::cLZXLowestUsableMatchSlot;
+      const bit_cost_t *pMain_costs = &m_main_cost[CLZBase::cLZXNumSpecialLengths + (match_high_sym << 3)];
+      const bit_cost_t *pLarge_len_costs = m_large_len_cost[s.m_cur_state >= CLZBase::cNumLitStates];
+
+      int match_len = min_len;
+      for (const int end_len = LZHAM_MIN(max_len, 8); match_len <= end_len; match_len++)
+         pBitcosts[match_len] = cost + pMain_costs[match_len - 2];
+
+      // Lengths of 9 and up share main symbol 7 and send the rest of the length from the large length table.
+      cost += pMain_costs[7];
+
+      for (const int end_len = LZHAM_MIN(max_len, static_cast<int>(CLZBase::cMaxMatchLen)); match_len <= end_len; match_len++)
+         pBitcosts[match_len] = cost + pLarge_len_costs[match_len];
+
+      for ( ; match_len <= max_len; match_len++)
+         pBitcosts[match_len] = get_huge_match_code_len(match_len) + cost + pLarge_len_costs[CLZBase::cMaxMatchLen + 1];
+   }
+
    bool lzcompressor::state::advance(CLZBase& lzbase, const search_accelerator& dict, const lzdecision& lzdec)
    {
       const uint lit_pred0 = get_pred_char(dict, lzdec.m_pos, 1);
@@ -1265,6 +1392,7 @@ namespace lzham
       utils::zero_object(m_match_type_was_not_truncated_hist);
 
       m_total_update_rate_resets = 0;
+      m_total_unparsed_raw_blocks = 0;
 
       m_max_len2_dist = 0;
    }
@@ -1277,6 +1405,7 @@ namespace lzham
       printf("-----------\n");
       printf("Coding statistics:\n");
       printf("Total update rate resets: %u\n", m_total_update_rate_resets);
+      printf("Total raw blocks sent without parsing: %u\n", m_total_unparsed_raw_blocks);
       printf("Total Bytes: %u, Total Contexts: %u, Total Cost: %f bits (%f bytes)\nContext ave cost: %f StdDev: %f Min: %f Max: %f\n", m_total_bytes, m_total_contexts, m_total_cost, m_total_cost / 8.0f, m_context_stats.get_average(), m_context_stats.get_std_dev(), m_context_stats.get_min_val(), m_context_stats.get_max_val());
       printf("Ave bytes per context: %f\n", m_total_bytes / (float)m_total_contexts);
 
@@ -3,6 +3,7 @@
 #include "lzham_core.h"
 #include "lzham_match_accel.h"
 #include "lzham_timer.h"
+#include <algorithm>
 
 namespace lzham
 {
@@ -16,6 +17,25 @@ namespace lzham
       return (c0 | (c1 << 8)) ^ (c2 << 4);
    }
 
+   // Fibonacci hashing: the high bits of the product are well mixed, so the table size only changes the shift.
+   const uint32 cHashMultiplier = 2654435761U;
+
+   inline uint search_accelerator::hash_string(const uint8* p) const
+   {
+      if (m_hash_bytes == 4)
+      {
+         const uint32 x = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32>(p[3]) << 24);
+         return (x * cHashMultiplier) >> (32 - m_hash_bits);
+      }
+      else if (m_hash_bits == 16)
+      {
+         return hash3_to_16(p[0], p[1], p[2]);
+      }
+
+      const uint32 x = p[0] | (p[1] << 8) | (p[2] << 16);
+      return (x * cHashMultiplier) >> (32 - m_hash_bits);
+   }
+
    search_accelerator::search_accelerator() :
       m_pLZBase(NULL),
       m_pTask_pool(NULL),
@@ -25,29 +45,102 @@ namespace lzham
       m_lookahead_pos(0),
       m_lookahead_size(0),
       m_cur_dict_size(0),
+      m_match_finder(cMatchFinderBinaryTree),
+      m_hash_ofs(0),
+      m_long_range_hash_ofs(0),
+      m_nodes_ofs(0),
+      m_pSnapshot(NULL),
+      m_alloc_flags(0),
+      m_numa_node(-1),
+      m_dict(NULL),
+      m_hash_bits(0),
+      m_hash_bytes(0),
+      m_hash(NULL),
+      m_nodes(NULL),
+      m_chain(NULL),
+      m_long_range_hash_bits(0),
+      m_long_range_hash(NULL),
+      m_matches(NULL),
+      m_hash_thread_shift(0),
+      m_num_blocked_waiters(0),
       m_fill_lookahead_pos(0),
       m_fill_lookahead_size(0),
       m_fill_dict_size(0),
       m_max_probes(0),
       m_max_matches(0),
+      m_next_max_probes(0),
+      m_next_max_matches(0),
       m_all_matches(false),
       m_next_match_ref(0),
       m_num_completed_helper_threads(0)
    {
    }
 
-   bool search_accelerator::init(CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads, uint max_dict_size, uint max_matches, bool all_matches, uint max_probes)
+   static inline size_t align_to_page(size_t size, size_t page_size)
+   {
+      return (size + page_size - 1) & ~(page_size - 1);
+   }
+
+   // Bytes of tree or chain links kept per dictionary position.
+   uint search_accelerator::get_link_size() const
+   {
+      switch (m_match_finder)
+      {
+         case cMatchFinderHashChain: return sizeof(uint);
+         case cMatchFinderHashTable: return 0;
+         default: break;
+      }
+      return sizeof(node);
+   }
+
+   size_t search_accelerator::get_storage_size() const
+   {
+      return m_nodes_ofs + get_link_size() * static_cast<size_t>(m_max_dict_size);
+   }
+
+   void search_accelerator::init_storage_ptrs()
+   {
+      uint8* pStorage = m_storage.get_ptr();
+
+      m_dict = pStorage;
+      m_hash = reinterpret_cast<uint*>(pStorage + m_hash_ofs);
+      m_long_range_hash = m_long_range_hash_bits ? reinterpret_cast<uint*>(pStorage + m_long_range_hash_ofs) : NULL;
+      m_nodes = (m_match_finder == cMatchFinderBinaryTree) ? reinterpret_cast<node*>(pStorage + m_nodes_ofs) : NULL;
+      m_chain = (m_match_finder == cMatchFinderHashChain) ? reinterpret_cast<uint*>(pStorage + m_nodes_ofs) : NULL;
+   }
+
+   bool search_accelerator::init(CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads, uint max_dict_size, uint max_matches, bool all_matches, uint max_probes, uint hash_bits, uint hash_bytes, match_finder_type match_finder, bool long_range_matching, uint alloc_flags, int numa_node, const match_accel_snapshot* pSnapshot)
    {
       LZHAM_ASSERT(pLZBase);
       LZHAM_ASSERT(max_dict_size && math::is_power_of_2(max_dict_size));
       LZHAM_ASSERT(max_probes);
 
+      if ((hash_bits < cMatchAccelMinHashBits) || (hash_bits > cMatchAccelMaxHashBits))
+         return false;
+      if ((hash_bytes != 3) && (hash_bytes != 4))
+         return false;
+      if (match_finder >= cMatchFinderTotal)
+         return false;
+
+      m_match_finder = match_finder;
+
+      m_hash_bits = hash_bits;
+      m_hash_bytes = hash_bytes;
+      m_hash_thread_shift = hash_bits - cHashThreadIndexBits;
+
+      // About one anchor per table entry once the dictionary is full.
+      m_long_range_hash_bits = 0;
+      if (long_range_matching)
+         m_long_range_hash_bits = math::clamp<uint>(math::floor_log2i(max_dict_size) - cLongRangeAnchorBits, cLongRangeMinHashBits, cLongRangeMaxHashBits);
+
       m_max_probes = LZHAM_MIN(cMatchAccelMaxSupportedProbes, max_probes);
 
       m_pLZBase = pLZBase;
       m_pTask_pool = max_helper_threads ? pPool : NULL;
       m_max_helper_threads = m_pTask_pool ? max_helper_threads : 0;
       m_max_matches = LZHAM_MIN(m_max_probes, max_matches);
+      m_next_max_probes = m_max_probes;
+      m_next_max_matches = m_max_matches;
       m_all_matches = all_matches;
 
       m_max_dict_size = max_dict_size;
@@ -59,23 +152,226 @@ namespace lzham
       m_fill_lookahead_size = 0;
       m_fill_dict_size = 0;
       m_num_completed_helper_threads = 0;
+      m_pSnapshot = NULL;
+      m_clone_image.deinit();
+      m_long_range_matches.try_resize(0);
+
+      m_alloc_flags = alloc_flags;
+      m_numa_node = numa_node;
+      m_match_buf.free();
+      m_matches = NULL;
+
+      m_thread_work.clear();
+      m_total_thread_work.clear();
+      m_helper_progress.clear();
+      if ((!m_thread_work.try_resize(m_max_helper_threads)) || (!m_total_thread_work.try_resize(m_max_helper_threads)) || (!m_helper_progress.try_resize(m_max_helper_threads)))
+         return false;
+      // uint64 isn't one of the vector's scalar types, so try_resize() leaves its elements uninitialized.
+      for (uint i = 0; i < m_max_helper_threads; i++)
+         m_total_thread_work[i] = 0;
+
+      const size_t dict_bytes = max_dict_size + LZHAM_MIN(m_max_dict_size, static_cast<uint>(CLZBase::cMaxHugeMatchLen));
+      const size_t hash_bytes_total = sizeof(uint) << m_hash_bits;
+      const size_t long_range_hash_bytes_total = m_long_range_hash_bits ? (sizeof(uint) << m_long_range_hash_bits) : 0;
+      m_hash_ofs = align_to_page(dict_bytes, cStoragePageSize);
+      m_long_range_hash_ofs = align_to_page(m_hash_ofs + hash_bytes_total, cStoragePageSize);
+      m_nodes_ofs = align_to_page(m_long_range_hash_ofs + long_range_hash_bytes_total, cStoragePageSize);
+
+      if (pSnapshot)
+      {
+         if ((pSnapshot->m_max_dict_size != m_max_dict_size) || (pSnapshot->m_max_probes != m_max_probes) || (pSnapshot->m_match_finder != m_match_finder) ||
+             (pSnapshot->m_hash_bits != m_hash_bits) || (pSnapshot->m_hash_bytes != m_hash_bytes) || (pSnapshot->m_long_range_matching != long_range_matching) ||
+             (pSnapshot->m_image.get_size() != get_storage_size()))
+            return false;
+
+         m_pSnapshot = pSnapshot;
+         return restore_snapshot();
+      }
+
+      if (!m_storage.alloc(get_storage_size(), m_alloc_flags, m_numa_node))
+         return false;
+
+      init_storage_ptrs();
+
+      memset(m_hash, 0, hash_bytes_total);
+      if (m_long_range_hash)
+         memset(m_long_range_hash, 0, long_range_hash_bytes_total);
+
+      return true;
+   }
+
+   bool search_accelerator::create_snapshot(match_accel_snapshot& snapshot) const
+   {
+      LZHAM_ASSERT(!m_lookahead_size);
+
+      if (!m_storage.get_ptr())
+         return false;
 
-      if (!m_dict.try_resize_no_construct(max_dict_size + LZHAM_MIN(m_max_dict_size, static_cast<uint>(CLZBase::cMaxHugeMatchLen))))
+      if (!snapshot.m_image.init(m_storage.get_size()))
          return false;
 
-      if (!m_hash.try_resize_no_construct(cHashSize))
+      if (!snapshot.m_digram_hash.try_resize(m_digram_hash.size()))
+         return false;
+      if (m_digram_hash.size())
+         memcpy(snapshot.m_digram_hash.get_ptr(), m_digram_hash.get_ptr(), m_digram_hash.size_in_bytes());
+
+      snapshot.m_max_dict_size = m_max_dict_size;
+      snapshot.m_max_probes = m_max_probes;
+      snapshot.m_hash_bits = m_hash_bits;
+      snapshot.m_hash_bytes = m_hash_bytes;
+      snapshot.m_match_finder = m_match_finder;
+      snapshot.m_long_range_matching = (m_long_range_hash_bits != 0);
+      snapshot.m_lookahead_pos = m_lookahead_pos;
+      snapshot.m_cur_dict_size = m_cur_dict_size;
+
+      copy_used_storage(snapshot.m_image.get_ptr());
+
+      return true;
+   }
+
+   // pDst must be zeroed and get_storage_size() bytes. Only the parts of the dictionary and tree that have been written are copied, so
+   // untouched pages of an image stay shared with the OS's zero page in every view.
+   void search_accelerator::copy_used_storage(uint8* pDst) const
+   {
+      // Until the dictionary wraps only [0, m_lookahead_pos) has been written. The tree is never walked further back than m_cur_dict_size,
+      // so if it exceeds m_lookahead_pos the 32-bit position has wrapped around and everything is in use.
+      const bool partial = (m_lookahead_pos < m_max_dict_size) && (m_cur_dict_size <= m_lookahead_pos);
+      const uint num_dict_bytes_written = partial ? m_lookahead_pos : m_max_dict_size;
+      const uint num_mirror_bytes = LZHAM_MIN(m_max_dict_size, static_cast<uint>(CLZBase::cMaxHugeMatchLen));
+
+      memcpy(pDst, m_dict, num_dict_bytes_written);
+      memcpy(pDst + m_max_dict_size, m_dict + m_max_dict_size, num_mirror_bytes);
+
+      memcpy(pDst + m_hash_ofs, m_hash, sizeof(uint) << m_hash_bits);
+      if (m_long_range_hash)
+         memcpy(pDst + m_long_range_hash_ofs, m_long_range_hash, sizeof(uint) << m_long_range_hash_bits);
+      memcpy(pDst + m_nodes_ofs, m_storage.get_ptr() + m_nodes_ofs, get_link_size() * static_cast<size_t>(num_dict_bytes_written));
+   }
+
+   bool search_accelerator::share_storage(cow_view& view)
+   {
+      LZHAM_ASSERT(!m_lookahead_size);
+
+      if (!m_clone_image.get_ptr())
+      {
+         if (!m_clone_image.init(m_storage.get_size()))
+            return false;
+
+         copy_used_storage(m_clone_image.get_ptr());
+
+         if (m_clone_image.is_shared())
+         {
+            // Switch over to a private view of the image too, so every further clone until we add more bytes is just another mapping.
+            cow_view own_view;
+            if (!own_view.map(m_clone_image))
+            {
+               m_clone_image.deinit();
+               return false;
+            }
+
+            m_storage.swap(own_view);
+            init_storage_ptrs();
+         }
+      }
+
+      bool status = view.map(m_clone_image);
+
+      // A heap image is copied by every view anyway, so there's no point in keeping it around.
+      if (!m_clone_image.is_shared())
+         m_clone_image.deinit();
+
+      return status;
+   }
+
+   bool search_accelerator::init_clone(search_accelerator& other, CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads)
+   {
+      LZHAM_ASSERT(pLZBase);
+
+      if ((!other.m_storage.get_ptr()) || (other.m_lookahead_size))
+         return false;
+
+      m_match_finder = other.m_match_finder;
+
+      m_hash_bits = other.m_hash_bits;
+      m_hash_bytes = other.m_hash_bytes;
+      m_hash_thread_shift = other.m_hash_thread_shift;
+      m_long_range_hash_bits = other.m_long_range_hash_bits;
+
+      m_max_probes = other.m_max_probes;
+
+      m_pLZBase = pLZBase;
+      m_pTask_pool = max_helper_threads ? pPool : NULL;
+      m_max_helper_threads = m_pTask_pool ? max_helper_threads : 0;
+      m_max_matches = other.m_max_matches;
+      m_next_max_probes = other.m_next_max_probes;
+      m_next_max_matches = other.m_next_max_matches;
+      m_all_matches = other.m_all_matches;
+
+      m_max_dict_size = other.m_max_dict_size;
+      m_max_dict_size_mask = other.m_max_dict_size_mask;
+      m_cur_dict_size = other.m_cur_dict_size;
+      m_lookahead_size = 0;
+      m_lookahead_pos = other.m_lookahead_pos;
+      m_fill_lookahead_pos = other.m_fill_lookahead_pos;
+      m_fill_lookahead_size = other.m_fill_lookahead_size;
+      m_fill_dict_size = other.m_fill_dict_size;
+      m_num_completed_helper_threads = 0;
+      m_pSnapshot = other.m_pSnapshot;
+      m_clone_image.deinit();
+      m_long_range_matches.try_resize(0);
+
+      m_alloc_flags = other.m_alloc_flags;
+      m_numa_node = other.m_numa_node;
+      m_match_buf.free();
+      m_matches = NULL;
+
+      m_thread_work.clear();
+      m_total_thread_work.clear();
+      m_helper_progress.clear();
+      if ((!m_thread_work.try_resize(m_max_helper_threads)) || (!m_total_thread_work.try_resize(m_max_helper_threads)) || (!m_helper_progress.try_resize(m_max_helper_threads)))
+         return false;
+
+      if (!m_digram_hash.try_resize(other.m_digram_hash.size()))
+         return false;
+      if (m_digram_hash.size())
+         memcpy(m_digram_hash.get_ptr(), other.m_digram_hash.get_ptr(), m_digram_hash.size_in_bytes());
+
+      m_hash_ofs = other.m_hash_ofs;
+      m_long_range_hash_ofs = other.m_long_range_hash_ofs;
+      m_nodes_ofs = other.m_nodes_ofs;
+
+      if (!other.share_storage(m_storage))
          return false;
 
-      if (!m_nodes.try_resize_no_construct(max_dict_size))
+      init_storage_ptrs();
+
+      return true;
+   }
+
+   bool search_accelerator::restore_snapshot()
+   {
+      LZHAM_ASSERT(m_pSnapshot);
+
+      if (!m_storage.map(m_pSnapshot->m_image))
          return false;
 
-      memset(m_hash.get_ptr(), 0, m_hash.size_in_bytes());
+      init_storage_ptrs();
+
+      m_lookahead_pos = m_pSnapshot->m_lookahead_pos;
+      m_cur_dict_size = m_pSnapshot->m_cur_dict_size;
+
+      if (!m_digram_hash.try_resize(m_pSnapshot->m_digram_hash.size()))
+         return false;
+      if (m_digram_hash.size())
+         memcpy(m_digram_hash.get_ptr(), m_pSnapshot->m_digram_hash.get_ptr(), m_digram_hash.size_in_bytes());
 
       return true;
    }
 
-   void search_accelerator::reset()
+   bool search_accelerator::reset()
    {
+      m_clone_image.deinit();
+
       m_cur_dict_size = 0;
       m_lookahead_size = 0;
       m_lookahead_pos = 0;
@@ -83,12 +379,32 @@ namespace lzham
       m_fill_lookahead_size = 0;
       m_fill_dict_size = 0;
       m_num_completed_helper_threads = 0;
+      m_long_range_matches.try_resize(0);
+
+      for (uint i = 0; i < m_total_thread_work.size(); i++)
+         m_total_thread_work[i] = 0;
+
+      for (uint i = 0; i < cMaxWaitSlots; i++)
+      {
+         m_wait_slots[i].m_total_spins = 0;
+         m_wait_slots[i].m_total_spin_ticks = 0;
+         m_wait_slots[i].m_total_blocks = 0;
+         m_wait_slots[i].m_total_block_ticks = 0;
+      }
+
+      // Remapping the snapshot throws away every page written since, which is much cheaper than clearing and reseeding.
+      if (m_pSnapshot)
+         return restore_snapshot();
 
       // Clearing the hash tables is only necessary for determinism (otherwise, it's possible the matches returned after a reset will depend on the data processes before the reset).
-      if (m_hash.size()) 
-         memset(m_hash.get_ptr(), 0, m_hash.size_in_bytes());
+      if (m_hash) 
+         memset(m_hash, 0, sizeof(uint) << m_hash_bits);
+      if (m_long_range_hash)
+         memset(m_long_range_hash, 0, sizeof(uint) << m_long_range_hash_bits);
       if (m_digram_hash.size())
          memset(m_digram_hash.get_ptr(), 0, m_digram_hash.size_in_bytes());
+
+      return true;
    }
 
    void search_accelerator::flush()
@@ -96,6 +412,48 @@ namespace lzham
       m_cur_dict_size = 0;
    }
 
+   void search_accelerator::get_wait_stats(wait_stats& stats) const
+   {
+      utils::zero_object(stats);
+
+      for (uint i = 0; i < cMaxWaitSlots; i++)
+      {
+         stats.m_total_spins += m_wait_slots[i].m_total_spins;
+         stats.m_total_spin_ticks += m_wait_slots[i].m_total_spin_ticks;
+         stats.m_total_blocks += m_wait_slots[i].m_total_blocks;
+         stats.m_total_block_ticks += m_wait_slots[i].m_total_block_ticks;
+      }
+   }
+
+   void search_accelerator::wake_waiter(uint match_ref_ofs)
+   {
+      for (uint i = 0; i < cMaxWaitSlots; i++)
+      {
+         wait_slot& slot = m_wait_slots[i];
+
+         // Positions at the very end of the block may be published by several helpers, but only one of them wins the exchange.
+         if ((slot.m_wait_ofs == static_cast<atomic32_t>(match_ref_ofs)) && (atomic_compare_exchange32(&slot.m_wait_ofs, -1, match_ref_ofs) == static_cast<atomic32_t>(match_ref_ofs)))
+            slot.m_event.release();
+      }
+   }
+
+   // The exchange is a full barrier, so either the helper sees a waiter registered after it or the waiter sees the new match ref.
+   inline void search_accelerator::publish_match_ref(uint match_ref_ofs, int match_ref)
+   {
+      atomic_exchange32((atomic32_t*)&m_match_refs[match_ref_ofs], match_ref);
+
+      if (m_num_blocked_waiters)
+         wake_waiter(match_ref_ofs);
+   }
+
+   uint search_accelerator::get_min_helper_progress() const
+   {
+      uint min_progress = UINT_MAX;
+      for (uint i = 0; i < m_helper_progress.size(); i++)
+         min_progress = LZHAM_MIN(min_progress, static_cast<uint>(m_helper_progress[i]));
+      return min_progress;
+   }
+
    uint search_accelerator::get_max_add_bytes() const
    {
       uint add_pos = static_cast<uint>(m_lookahead_pos & (m_max_dict_size - 1));
@@ -122,6 +480,65 @@ namespace lzham
       4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
    };
 
+   // Records a candidate at delta_pos matching match_len bytes of the string at insert_pos. Returns true if it's the new longest match.
+   inline bool search_accelerator::add_match(dict_match*& pDstMatch, uint& best_match_len, uint match_len, uint max_match_len, uint delta_pos, uint insert_pos, const uint8* pIns, const uint8* pComp) const
+   {
+      if (match_len > best_match_len)
+      {
+         pDstMatch->m_len = static_cast<uint16>(match_len - CLZBase::cMinMatchLen);
+         pDstMatch->m_dist = delta_pos;
+         pDstMatch++;
+
+         best_match_len = match_len;
+         return true;
+      }
+      else if (m_all_matches)
+      {
+         pDstMatch->m_len = static_cast<uint16>(match_len - CLZBase::cMinMatchLen);
+         pDstMatch->m_dist = delta_pos;
+         pDstMatch++;
+      }
+      else if ((best_match_len > 2) && (best_match_len == match_len))
+      {
+         uint bestMatchDist = pDstMatch[-1].m_dist;
+         uint compMatchDist = delta_pos;
+
+         uint bestMatchSlot, bestMatchSlotOfs;
+         m_pLZBase->compute_lzx_position_slot(bestMatchDist, bestMatchSlot, bestMatchSlotOfs);
+
+         uint compMatchSlot, compMatchOfs;
+         m_pLZBase->compute_lzx_position_slot(compMatchDist, compMatchSlot, compMatchOfs);
+
+         // If both matches uses the same match slot, choose the one with the offset containing the lowest nibble as these bits separately entropy coded.
+         // This could choose a match which is further away in the absolute sense, but closer in a coding sense.
+         if ( (compMatchSlot < bestMatchSlot) ||
+            ((compMatchSlot >= 8) && (compMatchSlot == bestMatchSlot) && ((compMatchOfs & 15) < (bestMatchSlotOfs & 15))) )
+         {
+            LZHAM_ASSERT((pDstMatch[-1].m_len + (uint)CLZBase::cMinMatchLen) == best_match_len);
+            pDstMatch[-1].m_dist = delta_pos;
+         }
+         else if ((match_len < max_match_len) && (compMatchSlot <= bestMatchSlot))
+         {
+            // Choose the match which has lowest hamming distance in the mismatch byte for a tiny win on binary files.
+            // TODO: This competes against the prev. optimization.
+            uint desired_mismatch_byte = pIns[match_len];
+
+            uint cur_mismatch_byte = m_dict[(insert_pos - bestMatchDist + match_len) & m_max_dict_size_mask];
+            uint cur_mismatch_dist = g_hamming_dist[cur_mismatch_byte ^ desired_mismatch_byte];
+
+            uint new_mismatch_byte = pComp[match_len];
+            uint new_mismatch_dist = g_hamming_dist[new_mismatch_byte ^ desired_mismatch_byte];
+            if (new_mismatch_dist < cur_mismatch_dist)
+            {
+               LZHAM_ASSERT((pDstMatch[-1].m_len + (uint)CLZBase::cMinMatchLen) == best_match_len);
+               pDstMatch[-1].m_dist = delta_pos;
+            }
+         }
+      }
+
+      return false;
+   }
+
    void search_accelerator::find_all_matches_callback(uint64 data, void* pData_ptr)
    {
       scoped_perf_section find_all_matches_timer("find_all_matches_callback");
@@ -135,28 +552,27 @@ namespace lzham
       uint fill_dict_size = m_fill_dict_size;
       uint fill_lookahead_size = m_fill_lookahead_size;
 
-      uint c0 = 0, c1 = 0;
-      if (fill_lookahead_size >= 2)
-      {
-         c0 = m_dict[fill_lookahead_pos & m_max_dict_size_mask];
-         c1 = m_dict[(fill_lookahead_pos & m_max_dict_size_mask) + 1];
-      }
+      const uint8* pDict = m_dict;
+
+      volatile atomic32_t* pProgress = m_helper_progress.size() ? &m_helper_progress[thread_index] : NULL;
 
-      const uint8* pDict = m_dict.get_ptr();
+      const long_range_match* pLong_range_match = m_long_range_matches.get_ptr();
+      const long_range_match* pLong_range_match_end = pLong_range_match + m_long_range_matches.size();
 
-      while (fill_lookahead_size >= 3)
+      // Strings shorter than the hashed prefix can't be inserted.
+      while (fill_lookahead_size >= m_hash_bytes)
       {
+         if ((pProgress) && (!((fill_lookahead_pos - m_fill_lookahead_pos) & (cHelperProgressInterval - 1))))
+            *pProgress = fill_lookahead_pos - m_fill_lookahead_pos;
+
          uint insert_pos = fill_lookahead_pos & m_max_dict_size_mask;
 
-         uint c2 = pDict[insert_pos + 2];
-         uint h = hash3_to_16(c0, c1, c2);
-         c0 = c1;
-         c1 = c2;
+         uint h = hash_string(&pDict[insert_pos]);
 
-         LZHAM_ASSERT(!m_hash_thread_index.size() || (m_hash_thread_index[h] != UINT8_MAX));
+         LZHAM_ASSERT(!m_hash_thread_index.size() || (m_hash_thread_index[h >> m_hash_thread_shift] != UINT8_MAX));
 
          // Only process those strings that this worker thread was assigned to - this allows us to manipulate multiple trees in parallel with no worries about synchronization.
-         if (m_hash_thread_index.size() && (m_hash_thread_index[h] != thread_index))
+         if (m_hash_thread_index.size() && (m_hash_thread_index[h >> m_hash_thread_shift] != thread_index))
          {
             fill_lookahead_pos++;
             fill_lookahead_size--;
@@ -166,139 +582,105 @@ namespace lzham
 
          dict_match* pDstMatch = temp_matches;
 
-         uint cur_pos = m_hash[h];
-         m_hash[h] = static_cast<uint>(fill_lookahead_pos);
-
-         uint *pLeft = &m_nodes[insert_pos].m_left;
-         uint *pRight = &m_nodes[insert_pos].m_right;
-
          const uint max_match_len = LZHAM_MIN(static_cast<uint>(CLZBase::cMaxMatchLen), fill_lookahead_size);
          uint best_match_len = 2;
 
          const uint8* pIns = &pDict[insert_pos];
 
-         uint n = m_max_probes;
-         for ( ; ; )
-         {
-            uint delta_pos = fill_lookahead_pos - cur_pos;
-            if ((n-- == 0) || (!delta_pos) || (delta_pos >= fill_dict_size))
-            {
-               *pLeft = 0;
-               *pRight = 0;
-               break;
-            }
+         const uint lookahead_ofs = fill_lookahead_pos - m_fill_lookahead_pos;
+         while ((pLong_range_match != pLong_range_match_end) && (lookahead_ofs >= (pLong_range_match->m_ofs + pLong_range_match->m_len)))
+            pLong_range_match++;
 
-            uint pos = cur_pos & m_max_dict_size_mask;
-            node *pNode = &m_nodes[pos];
+         if ((pLong_range_match != pLong_range_match_end) && (lookahead_ofs >= pLong_range_match->m_ofs) && ((pLong_range_match->m_ofs + pLong_range_match->m_len - lookahead_ofs) >= max_match_len))
+         {
+            // Nothing can beat a maximum length match, so skip probing. The position is left out of the tree (or chain) too, which is safe
+            // because no other node ever links to it, and the bytes stay reachable through the earlier copy.
+            pDstMatch->m_len = static_cast<uint16>(max_match_len - CLZBase::cMinMatchLen);
+            pDstMatch->m_dist = pLong_range_match->m_dist;
+            pDstMatch++;
+         }
+         else if (m_chain)
+         {
+            uint cur_pos = m_hash[h];
+            m_hash[h] = static_cast<uint>(fill_lookahead_pos);
 
-            // Unfortunately, the initial compare match_len must be 0 because of the way we hash and truncate matches at the end of each block.
-            uint match_len = 0;
-            const uint8* pComp = &pDict[pos];
+            m_chain[insert_pos] = cur_pos;
 
-#if LZHAM_PLATFORM_X360
-            for ( ; match_len < max_match_len; match_len++)
-               if (pComp[match_len] != pIns[match_len])
-                  break;
-#else
-            // Compare a qword at a time for a bit more efficiency.
-            const uint64* pComp_end = reinterpret_cast<const uint64*>(pComp + max_match_len - 7);
-            const uint64* pComp_cur = reinterpret_cast<const uint64*>(pComp);
-            const uint64* pIns_cur = reinterpret_cast<const uint64*>(pIns);
-            while (pComp_cur < pComp_end)
+            // Links only ever point at positions inserted since they were last overwritten, so every step goes further back and stale links are
+            // cut off by the distance check.
+            for (uint n = m_max_probes; n; n--)
             {
-               if (*pComp_cur != *pIns_cur)
-                  break;
-               pComp_cur++;
-               pIns_cur++;
-            }
-            uint alt_match_len = static_cast<uint>(reinterpret_cast<const uint8*>(pComp_cur) - reinterpret_cast<const uint8*>(pComp));
-            for ( ; alt_match_len < max_match_len; alt_match_len++)
-               if (pComp[alt_match_len] != pIns[alt_match_len])
+               uint delta_pos = fill_lookahead_pos - cur_pos;
+               if ((!delta_pos) || (delta_pos >= fill_dict_size))
                   break;
-#ifdef LZVERIFY
-            for ( ; match_len < max_match_len; match_len++)
-               if (pComp[match_len] != pIns[match_len])
+
+               uint pos = cur_pos & m_max_dict_size_mask;
+               const uint8* pComp = &pDict[pos];
+               uint match_len = compute_match_len(pComp, pIns, 0, max_match_len);
+
+               if ((add_match(pDstMatch, best_match_len, match_len, max_match_len, delta_pos, insert_pos, pIns, pComp)) && (match_len == max_match_len))
                   break;
-            LZHAM_VERIFY(alt_match_len == match_len);
-#endif
-            match_len = alt_match_len;
-#endif
 
-            if (match_len > best_match_len)
+               cur_pos = m_chain[pos];
+            }
+         }
+         else
+         {
+            uint cur_pos = m_hash[h];
+            m_hash[h] = static_cast<uint>(fill_lookahead_pos);
+
+            uint *pLeft = &m_nodes[insert_pos].m_left;
+            uint *pRight = &m_nodes[insert_pos].m_right;
+
+            uint n = m_max_probes;
+            for ( ; ; )
             {
-               pDstMatch->m_len = static_cast<uint16>(match_len - CLZBase::cMinMatchLen);
-               pDstMatch->m_dist = delta_pos;
-               pDstMatch++;
+               uint delta_pos = fill_lookahead_pos - cur_pos;
+               if ((n-- == 0) || (!delta_pos) || (delta_pos >= fill_dict_size))
+               {
+                  *pLeft = 0;
+                  *pRight = 0;
+                  break;
+               }
 
-               best_match_len = match_len;
+               uint pos = cur_pos & m_max_dict_size_mask;
+               node *pNode = &m_nodes[pos];
 
-               if (match_len == max_match_len)
+               // Unfortunately, the initial compare match_len must be 0 because of the way we hash and truncate matches at the end of each block.
+               const uint8* pComp = &pDict[pos];
+               uint match_len = compute_match_len(pComp, pIns, 0, max_match_len);
+#ifdef LZVERIFY
+               uint alt_match_len;
+               for (alt_match_len = 0; alt_match_len < max_match_len; alt_match_len++)
+                  if (pComp[alt_match_len] != pIns[alt_match_len])
+                     break;
+               LZHAM_VERIFY(alt_match_len == match_len);
+#endif
+
+               if ((add_match(pDstMatch, best_match_len, match_len, max_match_len, delta_pos, insert_pos, pIns, pComp)) && (match_len == max_match_len))
                {
                   *pLeft = pNode->m_left;
                   *pRight = pNode->m_right;
                   break;
                }
-            }
-            else if (m_all_matches)
-            {
-               pDstMatch->m_len = static_cast<uint16>(match_len - CLZBase::cMinMatchLen);
-               pDstMatch->m_dist = delta_pos;
-               pDstMatch++;
-            }
-            else if ((best_match_len > 2) && (best_match_len == match_len))
-            {
-               uint bestMatchDist = pDstMatch[-1].m_dist;
-               uint compMatchDist = delta_pos;
-
-               uint bestMatchSlot, bestMatchSlotOfs;
-               m_pLZBase->compute_lzx_position_slot(bestMatchDist, bestMatchSlot, bestMatchSlotOfs);
 
-               uint compMatchSlot, compMatchOfs;
-               m_pLZBase->compute_lzx_position_slot(compMatchDist, compMatchSlot, compMatchOfs);
-
-               // If both matches uses the same match slot, choose the one with the offset containing the lowest nibble as these bits separately entropy coded.
-               // This could choose a match which is further away in the absolute sense, but closer in a coding sense.
-               if ( (compMatchSlot < bestMatchSlot) ||
-                  ((compMatchSlot >= 8) && (compMatchSlot == bestMatchSlot) && ((compMatchOfs & 15) < (bestMatchSlotOfs & 15))) )
+               uint new_pos;
+               if (pComp[match_len] < pIns[match_len])
                {
-                  LZHAM_ASSERT((pDstMatch[-1].m_len + (uint)CLZBase::cMinMatchLen) == best_match_len);
-                  pDstMatch[-1].m_dist = delta_pos;
+                  *pLeft = cur_pos;
+                  pLeft = &pNode->m_right;
+                  new_pos = pNode->m_right;
                }
-               else if ((match_len < max_match_len) && (compMatchSlot <= bestMatchSlot))
+               else
                {
-                  // Choose the match which has lowest hamming distance in the mismatch byte for a tiny win on binary files.
-                  // TODO: This competes against the prev. optimization.
-                  uint desired_mismatch_byte = pIns[match_len];
-
-                  uint cur_mismatch_byte = pDict[(insert_pos - bestMatchDist + match_len) & m_max_dict_size_mask];
-                  uint cur_mismatch_dist = g_hamming_dist[cur_mismatch_byte ^ desired_mismatch_byte];
-
-                  uint new_mismatch_byte = pComp[match_len];
-                  uint new_mismatch_dist = g_hamming_dist[new_mismatch_byte ^ desired_mismatch_byte];
-                  if (new_mismatch_dist < cur_mismatch_dist)
-                  {
-                     LZHAM_ASSERT((pDstMatch[-1].m_len + (uint)CLZBase::cMinMatchLen) == best_match_len);
-                     pDstMatch[-1].m_dist = delta_pos;
-                  }
+                  *pRight = cur_pos;
+                  pRight = &pNode->m_left;
+                  new_pos = pNode->m_left;
                }
+               if (new_pos == cur_pos)
+                  break;
+               cur_pos = new_pos;
             }
-
-            uint new_pos;
-            if (pComp[match_len] < pIns[match_len])
-            {
-               *pLeft = cur_pos;
-               pLeft = &pNode->m_right;
-               new_pos = pNode->m_right;
-            }
-            else
-            {
-               *pRight = cur_pos;
-               pRight = &pNode->m_left;
-               new_pos = pNode->m_left;
-            }
-            if (new_pos == cur_pos)
-               break;
-            cur_pos = new_pos;
          }
 
          const uint num_matches = (uint)(pDstMatch - temp_matches);
@@ -318,11 +700,11 @@ namespace lzham
             // FIXME: This is going to really hurt on platforms requiring export barriers.
             LZHAM_MEMORY_EXPORT_BARRIER
 
-            atomic_exchange32((atomic32_t*)&m_match_refs[static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos)], match_ref_ofs);
+            publish_match_ref(static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos), match_ref_ofs);
          }
          else
          {
-            atomic_exchange32((atomic32_t*)&m_match_refs[static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos)], -2);
+            publish_match_ref(static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos), -2);
          }
 
          fill_lookahead_pos++;
@@ -333,15 +715,25 @@ namespace lzham
       while (fill_lookahead_size)
       {
          uint insert_pos = fill_lookahead_pos & m_max_dict_size_mask;
-         m_nodes[insert_pos].m_left = 0;
-         m_nodes[insert_pos].m_right = 0;
+         if (m_chain)
+         {
+            m_chain[insert_pos] = 0;
+         }
+         else
+         {
+            m_nodes[insert_pos].m_left = 0;
+            m_nodes[insert_pos].m_right = 0;
+         }
 
-         atomic_exchange32((atomic32_t*)&m_match_refs[static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos)], -2);
+         publish_match_ref(static_cast<uint>(fill_lookahead_pos - m_fill_lookahead_pos), -2);
 
          fill_lookahead_pos++;
          fill_lookahead_size--;
          fill_dict_size++;
       }
+
+      if (pProgress)
+         *pProgress = m_fill_lookahead_size;
       
       atomic_increment32(&m_num_completed_helper_threads);
    }
@@ -401,11 +793,220 @@ namespace lzham
       return 0;
    }
 
-   bool search_accelerator::find_all_matches(uint num_bytes)
+   struct hash_group_desc
+   {
+      uint m_count;
+      uint m_index;
+   };
+
+   static inline bool hash_group_desc_greater(const hash_group_desc& lhs, const hash_group_desc& rhs)
+   {
+      // Ties are broken by index so the assignment (and the output with deterministic parsing) doesn't depend on the sort implementation.
+      return (lhs.m_count > rhs.m_count) || ((lhs.m_count == rhs.m_count) && (lhs.m_index < rhs.m_index));
+   }
+
+   // Each thread owns all the trees in the hash groups assigned to it. Assigning groups round robin lets one thread end up with nearly all 
+   // the insertions on skewed data (long runs, repeated tags), so the groups are bin packed by how often they occur in this block instead.
+   bool search_accelerator::assign_hash_threads(uint num_bytes)
    {
-      if (!m_matches.try_resize_no_construct(m_max_probes * num_bytes))
+      const uint num_groups = 1U << cHashThreadIndexBits;
+
+      if (!m_hash_thread_index.try_resize_no_construct(num_groups))
          return false;
 
+      if (m_hash_group_counts.size() != num_groups)
+      {
+         if (!m_hash_group_counts.try_resize(num_groups))
+            return false;
+      }
+
+      memset(m_hash_thread_index.get_ptr(), 0xFF, m_hash_thread_index.size_in_bytes());
+
+      for (uint i = 0; i < m_max_helper_threads; i++)
+         m_thread_work[i] = 0;
+
+      m_hash_groups.try_resize(0);
+
+      if (num_bytes < m_hash_bytes)
+         return true;
+
+      // Count each group's insertions, remembering the unique groups in order of first occurrence.
+      const uint num_insertions = num_bytes - m_hash_bytes + 1;
+      const uint8* pDict = &m_dict[m_lookahead_pos & m_max_dict_size_mask];
+      uint* pCounts = m_hash_group_counts.get_ptr();
+
+      for (uint i = 0; i < num_insertions; i++)
+      {
+         const uint g = hash_string(pDict + i) >> m_hash_thread_shift;
+         if (!pCounts[g]++)
+         {
+            if (!m_hash_groups.try_push_back(g))
+               return false;
+         }
+      }
+
+      const uint num_threads = m_max_helper_threads;
+      const uint target_work = (num_insertions + num_threads - 1) / num_threads;
+      const uint heavy_thresh = LZHAM_MAX(1U, target_work / cHashGroupHeavyFactor);
+
+      lzham::vector<hash_group_desc> heavy_groups;
+      for (uint i = 0; i < m_hash_groups.size(); i++)
+      {
+         const uint g = m_hash_groups[i];
+         if (pCounts[g] >= heavy_thresh)
+         {
+            hash_group_desc desc;
+            desc.m_count = pCounts[g];
+            desc.m_index = g;
+            if (!heavy_groups.try_push_back(desc))
+               return false;
+         }
+      }
+
+      // Longest processing time first: each heavy group goes to the currently least loaded thread.
+      std::sort(heavy_groups.begin(), heavy_groups.end(), hash_group_desc_greater);
+
+      for (uint i = 0; i < heavy_groups.size(); i++)
+      {
+         uint best_thread = 0;
+         for (uint t = 1; t < num_threads; t++)
+            if (m_thread_work[t] < m_thread_work[best_thread])
+               best_thread = t;
+
+         m_hash_thread_index[heavy_groups[i].m_index] = static_cast<uint8>(best_thread);
+         m_thread_work[best_thread] += heavy_groups[i].m_count;
+      }
+
+      // The light groups are each much smaller than a thread's fair share, so filling the threads in turn up to the target keeps them balanced.
+      uint cur_thread = 0;
+      for (uint i = 0; i < m_hash_groups.size(); i++)
+      {
+         const uint g = m_hash_groups[i];
+         const uint count = pCounts[g];
+         pCounts[g] = 0;
+
+         if (m_hash_thread_index[g] != UINT8_MAX)
+            continue;
+
+         for (uint j = 0; (j < num_threads) && (m_thread_work[cur_thread] >= target_work); j++)
+         {
+            if (++cur_thread == num_threads)
+               cur_thread = 0;
+         }
+
+         m_hash_thread_index[g] = static_cast<uint8>(cur_thread);
+         m_thread_work[cur_thread] += count;
+      }
+
+      for (uint i = 0; i < num_threads; i++)
+         m_total_thread_work[i] += m_thread_work[i];
+
+      return true;
+   }
+
+   // Gear hash of a byte string: each byte's value is shifted up one bit per following byte, so only the last 64 bytes affect the hash.
+   static inline uint64 long_range_gear(uint c)
+   {
+      uint64 x = (c + 1) * 0x9E3779B97F4A7C15ULL;
+      return x ^ (x >> 29);
+   }
+
+   // Length of the match between the bytes at pos and dist bytes back, up to max_len (which may exceed CLZBase::cMaxMatchLen).
+   uint search_accelerator::compute_long_range_match_len(uint pos, uint dist, uint max_len) const
+   {
+      uint len = 0;
+      while (len < max_len)
+      {
+         const uint n = LZHAM_MIN(static_cast<uint>(CLZBase::cMaxMatchLen), max_len - len);
+         const uint l = compute_match_len(&m_dict[(pos - dist + len) & m_max_dict_size_mask], &m_dict[(pos + len) & m_max_dict_size_mask], 0, n);
+         len += l;
+         if (l < n)
+            break;
+      }
+      return len;
+   }
+
+   // The probe limit keeps the trees from finding most repeats more than a few MB back, but duplicated files or disk images are full of them.
+   // Anchors are picked by content, so the copy of a repeat hits the same anchors as the original, and one table lookup per anchor finds it.
+   bool search_accelerator::find_long_range_matches(uint num_bytes)
+   {
+      m_long_range_matches.try_resize(0);
+
+      if (!m_long_range_hash)
+         return true;
+
+      const uint hash_shift = 64 - cLongRangeAnchorBits - m_long_range_hash_bits;
+      const uint hash_mask = (1U << m_long_range_hash_bits) - 1;
+
+      // Prime the rolling hash with the end of the history, so anchors can be found right from the start of the lookahead.
+      const uint num_history_bytes = LZHAM_MIN(m_cur_dict_size, cLongRangeWindowSize);
+      uint64 h = 0;
+      for (uint i = num_history_bytes; i; i--)
+         h = (h << 1) + long_range_gear(m_dict[(m_lookahead_pos - i) & m_max_dict_size_mask]);
+
+      const uint first_anchor_ofs = (num_history_bytes < cLongRangeWindowSize) ? (cLongRangeWindowSize - num_history_bytes) : 1;
+
+      // Matches are disjoint and in order, and none starts before the end of the previous one.
+      uint covered_ofs = 0;
+
+      for (uint ofs = 1; ofs < num_bytes; ofs++)
+      {
+         h = (h << 1) + long_range_gear(m_dict[(m_lookahead_pos + ofs - 1) & m_max_dict_size_mask]);
+
+         if ((h >> (64 - cLongRangeAnchorBits)) || (ofs < first_anchor_ofs))
+            continue;
+
+         const uint pos = m_lookahead_pos + ofs;
+
+         uint* pEntry = &m_long_range_hash[static_cast<uint>(h >> hash_shift) & hash_mask];
+         const uint prev_pos = *pEntry;
+         *pEntry = pos;
+
+         if (ofs < covered_ofs)
+            continue;
+
+         // Anchors always have a full window of bytes before them, so position 0 is never one and means the entry is empty.
+         const uint dist = pos - prev_pos;
+         if ((!prev_pos) || (!dist) || (dist > (m_cur_dict_size + ofs)))
+            continue;
+
+         const uint forward_len = compute_long_range_match_len(pos, dist, num_bytes - ofs);
+
+         uint backward_len = 0;
+         while ((ofs - backward_len) > covered_ofs)
+         {
+            const uint back_ofs = ofs - backward_len - 1;
+            if ((dist > (m_cur_dict_size + back_ofs)) || (m_dict[(m_lookahead_pos + back_ofs) & m_max_dict_size_mask] != m_dict[(m_lookahead_pos + back_ofs - dist) & m_max_dict_size_mask]))
+               break;
+            backward_len++;
+         }
+
+         if ((forward_len + backward_len) < cLongRangeMinMatchLen)
+            continue;
+
+         long_range_match match;
+         match.m_ofs = ofs - backward_len;
+         match.m_len = forward_len + backward_len;
+         match.m_dist = dist;
+         if (!m_long_range_matches.try_push_back(match))
+            return false;
+
+         covered_ofs = ofs + forward_len;
+      }
+
+      return true;
+   }
+
+   bool search_accelerator::find_all_matches(uint num_bytes)
+   {
+      const size_t match_buf_size = sizeof(dict_match) * m_max_probes * num_bytes;
+      if (m_match_buf.get_size() < match_buf_size)
+      {
+         if (!m_match_buf.alloc(match_buf_size, m_alloc_flags, m_numa_node))
+            return false;
+         m_matches = reinterpret_cast<dict_match*>(m_match_buf.get_ptr());
+      }
+
       if (!m_match_refs.try_resize_no_construct(num_bytes))
          return false;
 
@@ -417,6 +1018,16 @@ namespace lzham
 
       m_next_match_ref = 0;
 
+      for (uint i = 0; i < m_helper_progress.size(); i++)
+         m_helper_progress[i] = 0;
+
+      // The hash table engine is probed by the parser as it goes.
+      if (m_match_finder == cMatchFinderHashTable)
+         return true;
+
+      if (!find_long_range_matches(num_bytes))
+         return false;
+
       if (!m_pTask_pool)
       {
          find_all_matches_callback(0, NULL);
@@ -425,40 +1036,8 @@ namespace lzham
       }
       else
       {
-         if (!m_hash_thread_index.try_resize_no_construct(0x10000))
+         if (!assign_hash_threads(num_bytes))
             return false;
-
-         memset(m_hash_thread_index.get_ptr(), 0xFF, m_hash_thread_index.size_in_bytes());
-
-         uint next_thread_index = 0;
-         const uint8* pDict = &m_dict[m_lookahead_pos & m_max_dict_size_mask];
-         uint num_unique_trigrams = 0;
-
-         if (num_bytes >= 3)
-         {
-            uint c0 = pDict[0];
-            uint c1 = pDict[1];
-
-            const int limit = ((int)num_bytes - 2);
-            for (int i = 0; i < limit; i++)
-            {
-               uint c2 = pDict[2];
-               uint t = hash3_to_16(c0, c1, c2);
-               c0 = c1;
-               c1 = c2;
-
-               pDict++;
-
-               if (m_hash_thread_index[t] == UINT8_MAX)
-               {
-                  num_unique_trigrams++;
-
-                  m_hash_thread_index[t] = static_cast<uint8>(next_thread_index);
-                  if (++next_thread_index == m_max_helper_threads)
-                        next_thread_index = 0;
-               }
-            }
-         }
          
          m_num_completed_helper_threads = 0;
 
@@ -474,6 +1053,12 @@ namespace lzham
       LZHAM_ASSERT(num_bytes <= m_max_dict_size);
       LZHAM_ASSERT(!m_lookahead_size);
 
+      // Clones already mapped the image keep their copy-on-write views of it.
+      m_clone_image.deinit();
+
+      m_max_probes = m_next_max_probes;
+      m_max_matches = m_next_max_matches;
+
       uint add_pos = m_lookahead_pos & m_max_dict_size_mask;
       LZHAM_ASSERT((add_pos + num_bytes) <= m_max_dict_size);
 
@@ -493,6 +1078,12 @@ namespace lzham
       return find_all_matches(num_bytes);
    }
 
+   void search_accelerator::set_max_probes(uint max_probes, uint max_matches)
+   {
+      m_next_max_probes = LZHAM_MIN(cMatchAccelMaxSupportedProbes, max_probes);
+      m_next_max_matches = LZHAM_MIN(m_next_max_probes, max_matches);
+   }
+
    void search_accelerator::add_bytes_end()
    {
       if (m_pTask_pool)
@@ -500,31 +1091,51 @@ namespace lzham
          m_pTask_pool->join();
       }
 
-      LZHAM_ASSERT((uint)m_next_match_ref <= m_matches.size());
+      LZHAM_ASSERT((uint)m_next_match_ref <= (m_match_buf.get_size() / sizeof(dict_match)));
    }
 
-   dict_match* search_accelerator::find_matches(uint lookahead_ofs, bool spin)
+   // Waits until the match finder job(s) catch up to the caller's lookahead position. Spins briefly if they're close, otherwise sleeps until
+   // the helper that owns the position publishes it.
+   int search_accelerator::wait_for_match_ref(uint match_ref_ofs, bool spin)
    {
-      LZHAM_ASSERT(lookahead_ofs < m_lookahead_size);
+      const volatile atomic32_t* pMatch_ref = &m_match_refs[match_ref_ofs];
 
-      const uint match_ref_ofs = static_cast<uint>(m_lookahead_pos - m_fill_lookahead_pos + lookahead_ofs);
+      wait_slot* pSlot = NULL;
+      for (uint i = 0; i < cMaxWaitSlots; i++)
+      {
+         if ((!m_wait_slots[i].m_in_use) && (!atomic_compare_exchange32(&m_wait_slots[i].m_in_use, 1, 0)))
+         {
+            pSlot = &m_wait_slots[i];
+            break;
+         }
+      }
 
       int match_ref;
+
+      if (!pSlot)
+      {
+         // More waiting threads than slots (shouldn't happen, see cMaxWaitSlots), so just poll.
+         while ((match_ref = static_cast<int>(*pMatch_ref)) == -1)
+            lzham_sleep(1);
+         return match_ref;
+      }
+
+      const timer_ticks start_ticks = lzham_timer::get_ticks();
+      timer_ticks block_ticks = 0;
       uint spin_count = 0;
+      bool blocked = false;
 
-      // This may spin until the match finder job(s) catch up to the caller's lookahead position.
       for ( ; ; )
       {
-         match_ref = m_match_refs[match_ref_ofs];
-         if (match_ref == -2)
-            return NULL;
-         else if (match_ref != -1)
+         match_ref = static_cast<int>(*pMatch_ref);
+         if (match_ref != -1)
             break;
 
-         spin_count++;
          const uint cMaxSpinCount = 1000;
-         if ((spin) && (spin_count < cMaxSpinCount))
+         if ((spin) && (spin_count < cMaxSpinCount) && (match_ref_ofs < (get_min_helper_progress() + cSpinWindowSize)))
          {
+            spin_count++;
+
             lzham_yield_processor();
             lzham_yield_processor();
             lzham_yield_processor();
@@ -535,20 +1146,105 @@ namespace lzham
             lzham_yield_processor();
 
             LZHAM_MEMORY_IMPORT_BARRIER
+            continue;
+         }
+
+         const timer_ticks block_start_ticks = lzham_timer::get_ticks();
+
+         atomic_exchange32(&pSlot->m_wait_ofs, match_ref_ofs);
+         atomic_increment32(&m_num_blocked_waiters);
+
+         if (*pMatch_ref != -1)
+         {
+            // Already published. If a helper beat us to clearing the slot, it has released (or is about to release) the event, which must be consumed.
+            if (atomic_compare_exchange32(&pSlot->m_wait_ofs, -1, match_ref_ofs) != static_cast<atomic32_t>(match_ref_ofs))
+               pSlot->m_event.wait();
          }
          else
          {
-            spin_count = cMaxSpinCount;
-
-            lzham_sleep(1);
+            pSlot->m_event.wait();
          }
+
+         atomic_decrement32(&m_num_blocked_waiters);
+
+         block_ticks += lzham_timer::get_ticks() - block_start_ticks;
+         blocked = true;
       }
 
+      const timer_ticks total_ticks = lzham_timer::get_ticks() - start_ticks;
+
+      if (spin_count)
+      {
+         pSlot->m_total_spins++;
+         pSlot->m_total_spin_ticks += total_ticks - block_ticks;
+      }
+
+      if (blocked)
+      {
+         pSlot->m_total_blocks++;
+         pSlot->m_total_block_ticks += block_ticks;
+      }
+
+      atomic_exchange32(&pSlot->m_in_use, 0);
+
+      return match_ref;
+   }
+
+   dict_match* search_accelerator::find_matches(uint lookahead_ofs, bool spin)
+   {
+      LZHAM_ASSERT(lookahead_ofs < m_lookahead_size);
+
+      const uint match_ref_ofs = static_cast<uint>(m_lookahead_pos - m_fill_lookahead_pos + lookahead_ofs);
+
+      int match_ref = static_cast<int>(m_match_refs[match_ref_ofs]);
+      if (match_ref == -1)
+         match_ref = wait_for_match_ref(match_ref_ofs, spin);
+      
+      if (match_ref == -2)
+         return NULL;
+
       LZHAM_MEMORY_IMPORT_BARRIER
 
       return &m_matches[match_ref];
    }
 
+   uint search_accelerator::find_hash_match(uint lookahead_ofs, uint max_match_len, uint& match_dist)
+   {
+      LZHAM_ASSERT(m_match_finder == cMatchFinderHashTable);
+      LZHAM_ASSERT(lookahead_ofs < m_lookahead_size);
+      LZHAM_ASSERT(max_match_len <= (m_lookahead_size - lookahead_ofs));
+
+      if ((m_lookahead_size - lookahead_ofs) < m_hash_bytes)
+         return 0;
+
+      const uint cur_pos = m_lookahead_pos + lookahead_ofs;
+      const uint8* pIns = &m_dict[cur_pos & m_max_dict_size_mask];
+
+      uint* pBucket = &m_hash[hash_string(pIns)];
+      const uint prev_pos = *pBucket;
+      *pBucket = cur_pos;
+
+      // Stale entries (overwritten by the ring buffer, or from before a reset) are cut off by the distance check, as in the chains.
+      const uint dist = cur_pos - prev_pos;
+      if ((!dist) || (dist > (m_cur_dict_size + lookahead_ofs)))
+         return 0;
+
+      match_dist = dist;
+      return compute_match_len(&m_dict[prev_pos & m_max_dict_size_mask], pIns, 0, max_match_len);
+   }
+
+   void search_accelerator::insert_hash(uint lookahead_ofs)
+   {
+      LZHAM_ASSERT(m_match_finder == cMatchFinderHashTable);
+      LZHAM_ASSERT(lookahead_ofs < m_lookahead_size);
+
+      if ((m_lookahead_size - lookahead_ofs) < m_hash_bytes)
+         return;
+
+      const uint cur_pos = m_lookahead_pos + lookahead_ofs;
+      m_hash[hash_string(&m_dict[cur_pos & m_max_dict_size_mask])] = cur_pos;
+   }
+
    void search_accelerator::advance_bytes(uint num_bytes)
    {
       LZHAM_ASSERT(num_bytes <= m_lookahead_size);
@@ -3,10 +3,34 @@
 #pragma once
 #include "lzham_lzbase.h"
 #include "lzham_threading.h"
+#include "lzham_match_len.h"
+#include "lzham_cow_memory.h"
 
 namespace lzham
 {
    const uint cMatchAccelMaxSupportedProbes = 128;
+
+   const uint cMatchAccelMinHashBits = LZHAM_MIN_MATCH_HASH_BITS;
+   const uint cMatchAccelMaxHashBits = LZHAM_MAX_MATCH_HASH_BITS;
+
+   enum match_finder_type
+   {
+      cMatchFinderBinaryTree,
+      cMatchFinderHashChain,
+      cMatchFinderHashTable,
+
+      cMatchFinderTotal
+   };
+
+   // Long range matching: a position is an anchor when the top cLongRangeAnchorBits of a rolling hash over the preceding cLongRangeWindowSize
+   // bytes are all 0, so on average one position in 1<<cLongRangeAnchorBits is indexed, and a repeat lands on the same anchors as the original.
+   const uint cLongRangeWindowSize = 64;
+   const uint cLongRangeAnchorBits = 6;
+   const uint cLongRangeMinHashBits = 10;
+   const uint cLongRangeMaxHashBits = 22;
+
+   // Repeats shorter than this are left to the regular match finder.
+   const uint cLongRangeMinMatchLen = 512;
       
    struct node
    {
@@ -29,6 +53,38 @@ namespace lzham
 #pragma pack(pop)  
 
    LZHAM_DEFINE_BITWISE_MOVABLE(dict_match);
+
+   // A run of lookahead bytes found by the long range pre-pass to repeat m_dist bytes back.
+   struct long_range_match
+   {
+      uint m_ofs;
+      uint m_len;
+      uint m_dist;
+   };
+
+   LZHAM_DEFINE_BITWISE_MOVABLE(long_range_match);
+
+   // The match finder's state right after a seed dictionary has been added, which any number of search_accelerators initialized with the
+   // same settings can start from at once. Immutable once search_accelerator::create_snapshot() returns.
+   struct match_accel_snapshot
+   {
+      match_accel_snapshot() : m_max_dict_size(0), m_max_probes(0), m_hash_bits(0), m_hash_bytes(0), m_match_finder(cMatchFinderBinaryTree), m_long_range_matching(false), m_lookahead_pos(0), m_cur_dict_size(0) { }
+
+      // The tree layout depends on all of these, so they must match exactly.
+      uint m_max_dict_size;
+      uint m_max_probes;
+      uint m_hash_bits;
+      uint m_hash_bytes;
+      match_finder_type m_match_finder;
+      bool m_long_range_matching;
+
+      uint m_lookahead_pos;
+      uint m_cur_dict_size;
+
+      // The dictionary, hash tables and tree nodes, laid out exactly as in search_accelerator::m_storage.
+      cow_image m_image;
+      lzham::vector<uint> m_digram_hash;
+   };
    
    class search_accelerator
    {
@@ -38,11 +94,39 @@ namespace lzham
       // If all_matches is true, the match finder returns all found matches with no filtering.
       // Otherwise, the finder will tend to return lists of matches with mostly unique lengths.
       // For each length, it will discard matches with worse distances (in the coding sense).
-      bool init(CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads, uint max_dict_size, uint max_matches, bool all_matches, uint max_probes);
+      // hash_bits is the log2 size of the table of tree roots, and hash_bytes (3 or 4) is the number of leading bytes hashed to pick a root.
+      // The hash chain engine links each position to the previous one with the same hash instead of keeping a tree, halving the per byte
+      // overhead. It's only a good match for low max_probes, because it visits candidates newest first rather than by prefix.
+      // If long_range_matching is true, each block is first scanned for repeats of at least cLongRangeMinMatchLen bytes anywhere in the dictionary,
+      // however far beyond the probe horizon. Positions inside one are reported with just that match and skip the tree (or chain) entirely.
+      // The hash table engine keeps only the newest position of each hash and computes nothing up front. Its caller probes it position by
+      // position with find_hash_match() (and indexes skipped positions with insert_hash()), and must not call find_matches() or get_len2_match().
+      // If pSnapshot is not NULL the accelerator maps it copy-on-write instead of starting out empty, and reset() returns to it.
+      // The snapshot must outlive the accelerator, and must have been created with the same max_dict_size, max_probes, hash, match finder and long range settings.
+      // alloc_flags and numa_node are passed to lzham_large_alloc() for the dictionary, trees and match lists (but a mapped snapshot keeps normal pages).
+      bool init(CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads, uint max_dict_size, uint max_matches, bool all_matches, uint max_probes, uint hash_bits, uint hash_bytes, match_finder_type match_finder, bool long_range_matching, uint alloc_flags, int numa_node, const match_accel_snapshot* pSnapshot = NULL);
+
+      // Captures the current state, which must be between blocks (no lookahead).
+      bool create_snapshot(match_accel_snapshot& snapshot) const;
+
+      // Initializes this accelerator to a copy of other's current state, which must be between blocks. other's dictionary and trees are
+      // shared copy-on-write where the OS supports it, so cloning it repeatedly before it adds more bytes doesn't copy them again.
+      bool init_clone(search_accelerator& other, CLZBase* pLZBase, task_pool* pPool, uint max_helper_threads);
       
-      void reset();
+      bool reset();
       void flush();
       
+      inline match_finder_type get_match_finder() const { return m_match_finder; }
+      inline uint get_hash_bits() const { return m_hash_bits; }
+      inline uint get_hash_bytes() const { return m_hash_bytes; }
+
+      inline uint get_max_probes() const { return m_max_probes; }
+      // Takes effect at the next add_bytes_begin(), as helper threads may still be finding matches in the current lookahead.
+      void set_max_probes(uint max_probes, uint max_matches);
+
+      // # of long range matches found in the current lookahead.
+      inline uint get_num_long_range_matches() const { return m_long_range_matches.size(); }
+
       inline uint get_max_dict_size() const { return m_max_dict_size; }
       inline uint get_max_dict_size_mask() const { return m_max_dict_size_mask; }
       inline uint get_cur_dict_size() const { return m_cur_dict_size; }
@@ -55,6 +139,20 @@ namespace lzham
       inline const uint8* get_ptr(uint pos) const { return &m_dict[pos]; }
       
       uint get_max_helper_threads() const { return m_max_helper_threads; }
+
+      // # of insert positions assigned to each helper thread for the most recent block, and since init() or reset(), for verifying load balance.
+      inline uint get_helper_thread_work(uint thread_index) const { return (thread_index < m_thread_work.size()) ? m_thread_work[thread_index] : 0; }
+      inline uint64 get_total_helper_thread_work(uint thread_index) const { return (thread_index < m_total_thread_work.size()) ? m_total_thread_work[thread_index] : 0; }
+
+      // Totals since init() or reset() of the time find_matches() spent spinning or blocked waiting for the helper threads, in lzham_timer ticks.
+      struct wait_stats
+      {
+         uint64 m_total_spins;
+         uint64 m_total_spin_ticks;
+         uint64 m_total_blocks;
+         uint64 m_total_block_ticks;
+      };
+      void get_wait_stats(wait_stats& stats) const;
       
       inline uint operator[](uint pos) const { return m_dict[pos]; }
             
@@ -70,6 +168,11 @@ namespace lzham
       
       uint get_len2_match(uint lookahead_ofs);
       dict_match* find_matches(uint lookahead_ofs, bool spin = true);
+
+      // Hash table engine only. Returns the length of the match (up to max_match_len) against the newest earlier position with the same hash,
+      // or 0 if there's none, and makes lookahead_ofs the newest position of its hash.
+      uint find_hash_match(uint lookahead_ofs, uint max_match_len, uint& match_dist);
+      void insert_hash(uint lookahead_ofs);
             
       void advance_bytes(uint num_bytes);
       
@@ -89,12 +192,7 @@ namespace lzham
          const uint8* pComp = &m_dict[comp_pos];
          const uint8* pLookahead = &m_dict[lookahead_pos];
          
-         uint match_len;
-         for (match_len = start_match_len; match_len < max_match_len; match_len++)
-            if (pComp[match_len] != pLookahead[match_len])
-               break;
-
-         return match_len;
+         return compute_match_len(pComp, pLookahead, start_match_len, max_match_len);
       }
                   
    public:
@@ -110,16 +208,80 @@ namespace lzham
                   
       uint m_cur_dict_size;
             
-      lzham::vector<uint8> m_dict;
+      match_finder_type m_match_finder;
+
+      // m_dict, m_hash, m_long_range_hash and m_nodes (or m_chain) are carved out of one block, each starting on a page boundary so snapshots are shared at page granularity.
+      enum { cStoragePageSize = 4096 };
+      cow_view m_storage;
+      size_t m_hash_ofs;
+      size_t m_long_range_hash_ofs;
+      size_t m_nodes_ofs;
+      const match_accel_snapshot* m_pSnapshot;
+
+      uint m_alloc_flags;
+      int m_numa_node;
+
+      // Image of m_storage handed out to clones, valid until the next add_bytes_begin() or reset().
+      cow_image m_clone_image;
+
+      uint8* m_dict;
       
-      enum { cHashSize = 65536 };
-      lzham::vector<uint> m_hash;
-      lzham::vector<node> m_nodes;
+      uint m_hash_bits;
+      uint m_hash_bytes;
+      uint* m_hash;
+      node* m_nodes;
+      uint* m_chain;
+
+      // Most recent anchor position for each anchor hash, or NULL if long range matching is disabled.
+      uint m_long_range_hash_bits;
+      uint* m_long_range_hash;
+      lzham::vector<long_range_match> m_long_range_matches;
 
-      lzham::vector<dict_match> m_matches;
+      // The match lists of the current lookahead, indexed by m_match_refs.
+      cow_view m_match_buf;
+      dict_match* m_matches;
       lzham::vector<atomic32_t> m_match_refs;
       
+      // Helper thread assignments are tracked per group of 1<<m_hash_thread_shift adjacent hash buckets, so this table stays 64K entries at any hash size.
+      enum { cHashThreadIndexBits = 16 };
+      uint m_hash_thread_shift;
       lzham::vector<uint8> m_hash_thread_index;
+
+      // Groups occurring more than 1/cHashGroupHeavyFactor of a thread's fair share are bin packed largest first, the rest fill in the gaps.
+      // A group is never split: its trees must be updated in position order by one thread. So a single group bigger than a fair share (a long
+      // run of one byte, a tag repeated all through the block) still lands on one thread, which then does more than its share while the others
+      // finish early. Bin packing only balances what's left around it.
+      enum { cHashGroupHeavyFactor = 8 };
+      lzham::vector<uint> m_hash_group_counts;
+      lzham::vector<uint> m_hash_groups;
+      lzham::vector<uint> m_thread_work;
+      lzham::vector<uint64> m_total_thread_work;
+
+      // Each helper thread publishes how far through the lookahead it has gotten every cHelperProgressInterval positions.
+      // find_matches() only spins if the slowest helper is within cSpinWindowSize positions of the one it needs, otherwise it blocks.
+      enum { cHelperProgressInterval = 64, cSpinWindowSize = 256 };
+      lzham::vector<atomic32_t> m_helper_progress;
+
+      // A thread waiting in find_matches() claims a slot, stores the match ref index it needs in m_wait_ofs, and sleeps on m_event.
+      // Whichever helper publishes that index clears m_wait_ofs and releases the event, so every wakeup is for a ready position.
+      // There's a slot for every parse job that can run at once, plus the thread coding the block.
+      enum { cMaxWaitSlots = LZHAM_MAX_PARSE_THREADS + 1 };
+      struct wait_slot
+      {
+         wait_slot() : m_in_use(0), m_wait_ofs(-1), m_event(0, 32767), m_total_spins(0), m_total_spin_ticks(0), m_total_blocks(0), m_total_block_ticks(0) { }
+
+         volatile atomic32_t m_in_use;
+         volatile atomic32_t m_wait_ofs;
+         semaphore m_event;
+
+         // Only touched by the slot's owner.
+         uint64 m_total_spins;
+         uint64 m_total_spin_ticks;
+         uint64 m_total_blocks;
+         uint64 m_total_block_ticks;
+      };
+      wait_slot m_wait_slots[cMaxWaitSlots];
+      volatile atomic32_t m_num_blocked_waiters;
       
       enum { cDigramHashSize = 4096 };
       lzham::vector<uint> m_digram_hash;
@@ -131,6 +293,8 @@ namespace lzham
       
       uint m_max_probes;
       uint m_max_matches;
+      uint m_next_max_probes;
+      uint m_next_max_matches;
       
       bool m_all_matches;
                   
@@ -138,9 +302,27 @@ namespace lzham
       
       volatile atomic32_t m_num_completed_helper_threads;
                   
+      inline uint hash_string(const uint8* p) const;
+
+      uint get_link_size() const;
+      size_t get_storage_size() const;
+      void init_storage_ptrs();
+      void copy_used_storage(uint8* pDst) const;
+      bool restore_snapshot();
+      bool share_storage(cow_view& view);
+
+      inline bool add_match(dict_match*& pDstMatch, uint& best_match_len, uint match_len, uint max_match_len, uint delta_pos, uint insert_pos, const uint8* pIns, const uint8* pComp) const;
       void find_all_matches_callback(uint64 data, void* pData_ptr);
       bool find_all_matches(uint num_bytes);
+      bool find_long_range_matches(uint num_bytes);
+      uint compute_long_range_match_len(uint pos, uint dist, uint max_len) const;
       bool find_len2_matches();
+      bool assign_hash_threads(uint num_bytes);
+
+      inline void publish_match_ref(uint match_ref_ofs, int match_ref);
+      void wake_waiter(uint match_ref_ofs);
+      int wait_for_match_ref(uint match_ref_ofs, bool spin);
+      uint get_min_helper_progress() const;
    };
 
 } // namespace lzham
@@ -0,0 +1,104 @@
+// File: lzham_match_len.cpp
+// See Copyright Notice and license at the end of include/lzham.h
+#include "lzham_core.h"
+#include "lzham_match_len.h"
+
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace lzham
+{
+   uint match_len_scalar(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len)
+   {
+#if LZHAM_USE_UNALIGNED_INT_LOADS && LZHAM_LITTLE_ENDIAN_CPU
+   #if LZHAM_CPU_HAS_64BIT_REGISTERS
+      while ((match_len + sizeof(uint64)) <= max_match_len)
+      {
+         const uint64 x = *reinterpret_cast<const uint64*>(pA + match_len) ^ *reinterpret_cast<const uint64*>(pB + match_len);
+         if (x)
+            return match_len + (math::count_trailing_zero_bits(x) >> 3);
+         match_len += sizeof(uint64);
+      }
+   #endif
+      while ((match_len + sizeof(uint32)) <= max_match_len)
+      {
+         const uint32 x = *reinterpret_cast<const uint32*>(pA + match_len) ^ *reinterpret_cast<const uint32*>(pB + match_len);
+         if (x)
+            return match_len + (math::count_trailing_zero_bits(x) >> 3);
+         match_len += sizeof(uint32);
+      }
+#endif
+      for ( ; match_len < max_match_len; match_len++)
+         if (pA[match_len] != pB[match_len])
+            break;
+
+      return match_len;
+   }
+
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+   LZHAM_TARGET_SSE2 static uint match_len_sse2(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len)
+   {
+      while ((match_len + 16) <= max_match_len)
+      {
+         const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + match_len));
+         const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + match_len));
+         const uint mismatch_mask = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) ^ 0xFFFFU;
+         if (mismatch_mask)
+            return match_len + math::count_trailing_zero_bits(static_cast<uint32>(mismatch_mask));
+         match_len += 16;
+      }
+
+      return match_len_scalar(pA, pB, match_len, max_match_len);
+   }
+
+   LZHAM_TARGET_AVX2 static uint match_len_avx2(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len)
+   {
+      while ((match_len + 32) <= max_match_len)
+      {
+         const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pA + match_len));
+         const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pB + match_len));
+         const uint mismatch_mask = ~static_cast<uint>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+         if (mismatch_mask)
+            return match_len + math::count_trailing_zero_bits(static_cast<uint32>(mismatch_mask));
+         match_len += 32;
+      }
+
+      if ((match_len + 16) <= max_match_len)
+      {
+         const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + match_len));
+         const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + match_len));
+         const uint mismatch_mask = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) ^ 0xFFFFU;
+         if (mismatch_mask)
+            return match_len + math::count_trailing_zero_bits(static_cast<uint32>(mismatch_mask));
+         match_len += 16;
+      }
+
+      return match_len_scalar(pA, pB, match_len, max_match_len);
+   }
+#endif // LZHAM_USE_X86_SIMD_INTRINSICS
+
+   static match_len_func_ptr select_match_len_func()
+   {
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+      const uint features = lzham_get_cpu_features();
+      if (features & cCPUFeatureAVX2)
+         return match_len_avx2;
+      if (features & cCPUFeatureSSE2)
+         return match_len_sse2;
+#endif
+      return match_len_scalar;
+   }
+
+   // Initial target of g_pMatch_len_func: picks the best kernel, then forwards. Every thread selects the same kernel, so the unsynchronized store is harmless.
+   static uint match_len_dispatch(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len)
+   {
+      match_len_func_ptr pFunc = select_match_len_func();
+      g_pMatch_len_func = pFunc;
+      return (*pFunc)(pA, pB, match_len, max_match_len);
+   }
+
+   match_len_func_ptr g_pMatch_len_func = match_len_dispatch;
+
+} // namespace lzham
@@ -0,0 +1,37 @@
+// File: lzham_match_len.h
+// See Copyright Notice and license at the end of include/lzham.h
+#pragma once
+
+namespace lzham
+{
+   // Returns the number of bytes pA and pB have in common starting at offset match_len, plus match_len.
+   // Never reads at or beyond offset max_match_len of either buffer.
+   typedef uint (*match_len_func_ptr)(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len);
+
+   // Selected on first use from the scalar, SSE2 or AVX2 kernels depending on the CPU.
+   extern match_len_func_ptr g_pMatch_len_func;
+
+   uint match_len_scalar(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len);
+
+   // Most compares mismatch within the first few bytes, so check the first qword inline before dispatching to the wide kernels.
+   LZHAM_FORCE_INLINE uint compute_match_len(const uint8* pA, const uint8* pB, uint match_len, uint max_match_len)
+   {
+      LZHAM_ASSERT(match_len <= max_match_len);
+
+#if LZHAM_USE_UNALIGNED_INT_LOADS && LZHAM_LITTLE_ENDIAN_CPU && LZHAM_CPU_HAS_64BIT_REGISTERS
+      if ((match_len + sizeof(uint64)) <= max_match_len)
+      {
+         const uint64 x = *reinterpret_cast<const uint64*>(pA + match_len) ^ *reinterpret_cast<const uint64*>(pB + match_len);
+         if (x)
+            return match_len + (math::count_trailing_zero_bits(x) >> 3);
+         match_len += sizeof(uint64);
+      }
+#endif
+
+      if (match_len == max_match_len)
+         return match_len;
+
+      return (*g_pMatch_len_func)(pA, pB, match_len, max_match_len);
+   }
+
+} // namespace lzham
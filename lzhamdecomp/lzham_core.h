@@ -145,7 +145,21 @@
 
 const bool c_lzham_big_endian_platform = !c_lzham_little_endian_platform;
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+   #define LZHAM_CPU_X86_FAMILY 1
+#else
+   #define LZHAM_CPU_X86_FAMILY 0
+#endif
+
+// SSE2/AVX2/BMI2 code paths are compiled in (and selected at runtime) only when the compiler can target them on a per-function basis.
+#if LZHAM_CPU_X86_FAMILY && !defined(LZHAM_ANSI_CPLUSPLUS) && (defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))) || (defined(_MSC_VER) && (_MSC_VER >= 1800)))
+   #define LZHAM_USE_X86_SIMD_INTRINSICS 1
+#else
+   #define LZHAM_USE_X86_SIMD_INTRINSICS 0
+#endif
+
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <math.h>
 #include <malloc.h>
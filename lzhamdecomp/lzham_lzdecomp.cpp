@@ -10,6 +10,26 @@
 #include "lzham_symbol_codec.h"
 #include "lzham_checksum.h"
 #include "lzham_lzdecompbase.h"
+#include "lzham_match_copy.h"
+
+// Set to 0 to decode every compressed block with the fully checked (coroutine) loop.
+#ifndef LZHAM_FAST_DECODE_LOOP
+   #if defined(LZHAM_LZDEBUG) || LZHAM_USE_ALL_ARITHMETIC_CODING
+      #define LZHAM_FAST_DECODE_LOOP 0
+   #else
+      #define LZHAM_FAST_DECODE_LOOP 1
+   #endif
+#endif
+
+// Set to 1 to build a second copy of the decoder targeting BMI2 (shlx/shrx/bzhi for the bit buffer's variable shifts), picked at runtime.
+// Set to 0 to build only the generic copy, which is also how to test that copy on a BMI2 machine.
+#ifndef LZHAM_DECOMP_BMI2_DISPATCH
+   #if LZHAM_USE_X86_SIMD_INTRINSICS && defined(__GNUC__) && LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+      #define LZHAM_DECOMP_BMI2_DISPATCH 1
+   #else
+      #define LZHAM_DECOMP_BMI2_DISPATCH 0
+   #endif
+#endif
 
 using namespace lzham;
 
@@ -25,21 +45,43 @@ namespace lzham
    static const uint s_huge_match_base_len[4] = { CLZDecompBase::cMaxMatchLen + 1, CLZDecompBase::cMaxMatchLen + 1 + 256, CLZDecompBase::cMaxMatchLen + 1 + 256 + 1024, CLZDecompBase::cMaxMatchLen + 1 + 256 + 1024 + 4096 };
    static const uint8 s_huge_match_code_len[4] = { 8, 10, 12, 16 };
 
+   // The fast decode loop runs while at least this many input bytes are left. A single literal or match takes at most 5 arithmetic
+   // coded bits (2 bytes each), 3 Huffman codes of up to 16 bits, a huge match length (19 bits) and 21 extra distance bits, or 21 bytes,
+   // and the bit buffer can be up to cSymbolCodecDecodeFastMaxOverread bytes ahead of that.
+   static const uint cFastLoopMinInputBytes = 64;
+
+   // Set in m_raw_decomp_buf_alloc_flags, next to the lzham_large_alloc() flags, when the dictionary came from lzham_mirrored_alloc().
+   static const uint cDecompBufMirrored = 0x100;
+
+   // Without a mirrored mapping, this many bytes from the start of the dictionary are copied past its end on demand (the compressor's
+   // search_accelerator mirrors its dictionary the same way), which covers the source of any match the compressor emits.
+   static inline uint get_dict_tail_mirror_size(uint dict_size)
+   {
+      return LZHAM_MIN(static_cast<uint>(CLZDecompBase::cMaxHugeMatchLen), dict_size);
+   }
+
    struct lzham_decompressor
    {
       void init();
       
-      template<bool unbuffered> lzham_decompress_status_t decompress();
+      template<bool unbuffered> LZHAM_FORCE_INLINE lzham_decompress_status_t decompress();
+#if LZHAM_DECOMP_BMI2_DISPATCH
+      template<bool unbuffered> LZHAM_TARGET_BMI2 lzham_decompress_status_t decompress_bmi2() { return decompress<unbuffered>(); }
+#endif
       
       void reset_all_tables();
       void reset_huffman_table_update_rates();
 
+      void init_dict_mirror();
+      bool sync_dict_mirror(uint src_ofs, uint n, uint dst_ofs);
+
       int m_state;
 
       CLZDecompBase m_lzBase;
       symbol_codec m_codec;
 
       uint32 m_raw_decomp_buf_size;
+      uint m_raw_decomp_buf_alloc_flags;
       uint8 *m_pRaw_decomp_buf;
       uint8 *m_pDecomp_buf;
       uint32 m_decomp_adler32;
@@ -103,6 +145,15 @@ namespace lzham
 
       uint m_seed_bytes_to_ignore_when_flushing;
 
+      // Highest dictionary offset flushed so far. Every wrap of dst_ofs is preceded by a flush, so clones only need to copy the dictionary up to here (or dst_ofs).
+      uint m_dict_high_water;
+
+      // The m_dict_mirror_size bytes past the end of the dictionary mirror its start. With a mirrored mapping that always holds, otherwise only the
+      // first m_dict_mirror_ofs of them are up to date. Every flush is followed by dst_ofs restarting at 0, so flushing resets it.
+      uint m_dict_mirror_size;
+      uint m_dict_mirror_ofs;
+      bool m_dict_mirrored;
+
       uint m_file_src_file_adler32;
 
       uint m_rep_lit0;
@@ -167,18 +218,26 @@ namespace lzham
       #define LZHAM_BULK_MEMCPY memcpy
       #define LZHAM_MEMCPY memcpy
    #endif
-   // Flush the output buffer/dictionary by doing a coroutine return to the caller.
+   // Flush the output buffer/dictionary by doing a coroutine return to the caller. With an output ring the caller reads the bytes in place.
    // The caller must permit the decompressor to flush total_bytes from the dictionary, or (in the 
    // case of corrupted data, or a bug) we must report a DEST_BUF_TOO_SMALL error.
    #define LZHAM_FLUSH_OUTPUT_BUFFER(total_bytes) \
       LZHAM_SAVE_STATE \
+      m_codec.decode_unread_bit_buf_bytes(); \
       m_pFlush_src = m_pDecomp_buf + m_seed_bytes_to_ignore_when_flushing; \
       m_flush_num_bytes_remaining = total_bytes - m_seed_bytes_to_ignore_when_flushing; \
       m_seed_bytes_to_ignore_when_flushing = 0; \
+      m_dict_high_water = LZHAM_MAX(m_dict_high_water, static_cast<uint>(total_bytes)); \
+      m_dict_mirror_ofs = 0; \
       while (m_flush_num_bytes_remaining) \
       { \
          m_flush_n = LZHAM_MIN(m_flush_num_bytes_remaining, *m_pOut_buf_size); \
-         if (0 == (m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_COMPUTE_ADLER32)) \
+         if (m_params.m_pOutput_ring) \
+         { \
+            if (m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_COMPUTE_ADLER32) \
+               m_decomp_adler32 = adler32(m_pFlush_src, m_flush_n, m_decomp_adler32); \
+         } \
+         else if (0 == (m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_COMPUTE_ADLER32)) \
          { \
             LZHAM_BULK_MEMCPY(m_pOut_buf, m_pFlush_src, m_flush_n); \
          } \
@@ -208,6 +267,75 @@ namespace lzham
    #else
       #define LZHAM_DECOMPRESS_DECODE_ADAPTIVE_SYMBOL(codec, result, model) LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN(codec, result, model)
    #endif
+
+   #define LZHAM_DECOMPRESS_DECODE_HUGE_MATCH_LEN_FAST(codec, match_len) \
+   { \
+      match_len = 0; \
+      do \
+      { \
+         uint b; LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, b, 1); \
+         if (!b) \
+            break; \
+         match_len++; \
+      } while (match_len < 3); \
+      uint k; LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, k, s_huge_match_code_len[match_len]); \
+      match_len = s_huge_match_base_len[match_len] + k; \
+   }
+
+   // Copies a match that doesn't wrap around the end of the dictionary. prev_char and prev_prev_char are left holding the last 2 bytes output.
+   static LZHAM_FORCE_INLINE void copy_match(uint8* pCopy_dst, const uint8* pCopy_src, uint match_len, int match_dist, uint& prev_char, uint& prev_prev_char)
+   {
+      if (LZHAM_BUILTIN_EXPECT(match_dist == 1, 0))
+      {
+         // Handle byte runs.
+         uint8 c = *pCopy_src;
+         if (LZHAM_BUILTIN_EXPECT(match_len < 8, 1))
+         {
+            for (int i = match_len; i > 0; i--)
+               *pCopy_dst++ = c;
+            if (LZHAM_BUILTIN_EXPECT(match_len == 1, 1))
+               prev_prev_char = prev_char;
+            else
+               prev_prev_char = c;
+         }
+         else
+         {
+            memset(pCopy_dst, c, match_len);
+            prev_prev_char = c;
+         }
+         prev_char = c;
+      }
+      else if (LZHAM_BUILTIN_EXPECT(match_len == 1, 1))
+      {
+         // Handle single byte matches.
+         prev_prev_char = prev_char;
+         prev_char = *pCopy_src;
+         *pCopy_dst = static_cast<uint8>(prev_char);
+      }
+      else
+      {
+         // Handle matches of length 2 or higher.
+         uint bytes_to_copy = match_len - 2;
+         if (LZHAM_BUILTIN_EXPECT(((bytes_to_copy < 8) || ((int)bytes_to_copy > match_dist)), 1))
+         {
+            for (int i = bytes_to_copy; i > 0; i--)
+               *pCopy_dst++ = *pCopy_src++;
+         }
+         else
+         {
+            LZHAM_MEMCPY(pCopy_dst, pCopy_src, bytes_to_copy);
+            pCopy_dst += bytes_to_copy;
+            pCopy_src += bytes_to_copy;
+         }
+         // Handle final 2 bytes of match specially, because we always track the last 2 bytes output in 
+         // local variables (needed for computing context) to avoid load hit stores on some CPU's.
+         prev_prev_char = *pCopy_src++;
+         *pCopy_dst++ = static_cast<uint8>(prev_prev_char);
+
+         prev_char = *pCopy_src++;
+         *pCopy_dst++ = static_cast<uint8>(prev_char);
+      }
+   }
    
    //------------------------------------------------------------------------------------------------------------------
    void lzham_decompressor::init()
@@ -237,6 +365,8 @@ namespace lzham
       m_orig_out_buf_size = 0;
       m_decomp_adler32 = cInitAdler32;
       m_seed_bytes_to_ignore_when_flushing = 0;
+      m_dict_high_water = 0;
+      init_dict_mirror();
       
       m_z_last_status = LZHAM_DECOMP_STATUS_NOT_FINISHED;
       m_z_first_call = 1;
@@ -299,12 +429,50 @@ namespace lzham
 
       m_dist_lsb_table.reset_update_rate();
    }
+
+   //------------------------------------------------------------------------------------------------------------------
+   void lzham_decompressor::init_dict_mirror()
+   {
+      const uint dict_size = 1U << m_params.m_dict_size_log2;
+      m_dict_mirrored = (m_raw_decomp_buf_alloc_flags & cDecompBufMirrored) != 0;
+      if (!m_pDecomp_buf)
+         m_dict_mirror_size = 0;
+      else if (m_params.m_pOutput_ring)
+         m_dict_mirror_size = LZHAM_MIN(m_params.m_output_ring_size - dict_size, get_dict_tail_mirror_size(dict_size));
+      else
+         m_dict_mirror_size = m_dict_mirrored ? dict_size : get_dict_tail_mirror_size(dict_size);
+      m_dict_mirror_ofs = 0;
+   }
+
+   //------------------------------------------------------------------------------------------------------------------
+   // Returns true if the n bytes at src_ofs can be read in one go, running off the end of the dictionary into its mirror if need be.
+   bool lzham_decompressor::sync_dict_mirror(uint src_ofs, uint n, uint dst_ofs)
+   {
+      const uint dict_size = 1U << m_params.m_dict_size_log2;
+      if ((src_ofs + n) <= dict_size)
+         return true;
+
+      const uint mirror_bytes_needed = src_ofs + n - dict_size;
+      if (mirror_bytes_needed > m_dict_mirror_size)
+         return false;
+      if ((m_dict_mirrored) || (mirror_bytes_needed <= m_dict_mirror_ofs))
+         return true;
+
+      // Only bytes that have already been output can be mirrored ahead of the copy, and a match may run on into its own output.
+      if (mirror_bytes_needed > dst_ofs)
+         return false;
+
+      const uint new_mirror_ofs = LZHAM_MIN(dst_ofs, m_dict_mirror_size);
+      memcpy(m_pDecomp_buf + dict_size + m_dict_mirror_ofs, m_pDecomp_buf + m_dict_mirror_ofs, new_mirror_ofs - m_dict_mirror_ofs);
+      m_dict_mirror_ofs = new_mirror_ofs;
+      return true;
+   }
       
    //------------------------------------------------------------------------------------------------------------------
    // Decompression method. Implemented as a coroutine so it can be paused and resumed to support streaming.
    //------------------------------------------------------------------------------------------------------------------
    template<bool unbuffered>
-   lzham_decompress_status_t lzham_decompressor::decompress()
+   LZHAM_FORCE_INLINE lzham_decompress_status_t lzham_decompressor::decompress()
    {
       // Important: This function is a coroutine. ANY locals variables that need to be preserved across coroutine
       // returns must be either be a member variable, or a local which is saved/restored to a member variable at
@@ -320,7 +488,6 @@ namespace lzham
       const size_t out_buf_size = *m_pOut_buf_size;
       
       uint8* pDst = unbuffered ? reinterpret_cast<uint8*>(m_pOut_buf) : reinterpret_cast<uint8*>(m_pDecomp_buf);
-      uint8* pDst_end = unbuffered ?  (reinterpret_cast<uint8*>(m_pOut_buf) + out_buf_size) : (reinterpret_cast<uint8*>(m_pDecomp_buf) + dict_size);      
       
       LZHAM_SYMBOL_CODEC_DECODE_DECLARE(codec);
 
@@ -335,7 +502,10 @@ namespace lzham
          LZHAM_BULK_MEMCPY(pDst, m_params.m_pSeed_bytes, m_params.m_num_seed_bytes);
          dst_ofs += m_params.m_num_seed_bytes;
          if (dst_ofs >= dict_size)
+         {
+            m_dict_high_water = dict_size;
             dst_ofs = 0;
+         }
          else
             m_seed_bytes_to_ignore_when_flushing = dst_ofs;
       }
@@ -464,6 +634,7 @@ namespace lzham
                }
                else
                {
+                  codec.decode_unread_bit_buf_bytes();
                   *m_pIn_buf_size = static_cast<size_t>(codec.decode_get_bytes_consumed());
                   *m_pOut_buf_size = dst_ofs;
                   
@@ -476,7 +647,12 @@ namespace lzham
                
                LZHAM_SYMBOL_CODEC_DECODE_BEGIN(codec);
 
-               dst_ofs = 0;
+               // Nothing after a full flush refers back before it, so an output ring just carries on (the caller relies on where each byte lands),
+               // skipping what's already been flushed.
+               if (m_params.m_pOutput_ring)
+                  m_seed_bytes_to_ignore_when_flushing = dst_ofs;
+               else
+                  dst_ofs = 0;
             }
          }
          else if (m_block_type == CLZDecompBase::cRawBlock)
@@ -642,6 +818,267 @@ namespace lzham
             for ( ; ; )
 #endif
             {
+#if LZHAM_FAST_DECODE_LOOP
+               // While plenty of input is left and a literal can't reach the end of the output, decode without checking for either
+               // (see cFastLoopMinInputBytes). Matches are still checked once each, then the checked loop below takes over near the edges.
+               if (LZHAM_BUILTIN_EXPECT((codec.m_pDecode_buf_end - pDecode_buf_next) > static_cast<ptrdiff_t>(cFastLoopMinInputBytes), 1))
+               {
+                  const uint8* pFast_decode_end;
+                  pFast_decode_end = codec.m_pDecode_buf_end - cFastLoopMinInputBytes;
+
+                  // In buffered mode dst_ofs must never be left at dict_size, because only the checked loop flushes.
+                  size_t fast_dst_end;
+                  fast_dst_end = unbuffered ? out_buf_size : dict_size_mask;
+
+                  // Matches ending at or before wild_copy_dst_end may overrun by cMatchCopyMaxOverrun bytes. In buffered mode that's only
+                  // safe until the dictionary first wraps, because after that the bytes ahead of dst_ofs are history (as is the mirror past its end).
+                  size_t wild_copy_dst_end;
+                  if (unbuffered)
+                     wild_copy_dst_end = (out_buf_size > cMatchCopyMaxOverrun) ? (out_buf_size - cMatchCopyMaxOverrun) : 0;
+                  else
+                     wild_copy_dst_end = (m_dict_high_water < dict_size) ? (dict_size - cMatchCopyMaxOverrun) : 0;
+
+                  uint fast_end_of_block;
+                  fast_end_of_block = 0;
+
+                  while (LZHAM_BUILTIN_EXPECT((pDecode_buf_next < pFast_decode_end) && (dst_ofs < fast_dst_end), 1))
+                  {
+                     uint match_model_index;
+                     match_model_index = LZHAM_IS_MATCH_MODEL_INDEX(prev_char, cur_state);
+
+                     uint is_match_bit; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_match_bit, m_is_match_model[match_model_index]);
+
+                     if (LZHAM_BUILTIN_EXPECT(!is_match_bit, 0))
+                     {
+                        if (LZHAM_BUILTIN_EXPECT(cur_state < CLZDecompBase::cNumLitStates, 1))
+                        {
+                           uint lit_pred;
+                           lit_pred = (prev_char >> (8 - CLZDecompBase::cNumLitPredBits / 2)) | (prev_prev_char >> (8 - CLZDecompBase::cNumLitPredBits / 2)) << (CLZDecompBase::cNumLitPredBits / 2);
+
+                           uint r; LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, r, m_lit_table[lit_pred]);
+                           pDst[dst_ofs] = static_cast<uint8>(r);
+                           prev_prev_char = prev_char;
+                           prev_char = r;
+                        }
+                        else
+                        {
+                           uint match_hist0_ofs, rep_lit0, rep_lit1;
+                           match_hist0_ofs = dst_ofs - match_hist0;
+                           rep_lit0 = pDst[match_hist0_ofs & dict_size_mask];
+                           rep_lit1 = pDst[(match_hist0_ofs - 1) & dict_size_mask];
+
+                           uint lit_pred;
+                           lit_pred = (rep_lit0 >> (8 - CLZDecompBase::cNumDeltaLitPredBits / 2)) |
+                              ((rep_lit1 >> (8 - CLZDecompBase::cNumDeltaLitPredBits / 2)) << CLZDecompBase::cNumDeltaLitPredBits / 2);
+
+                           uint r; LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, r, m_delta_lit_table[lit_pred]);
+                           r ^= rep_lit0;
+                           pDst[dst_ofs] = static_cast<uint8>(r);
+                           prev_prev_char = prev_char;
+                           prev_char = r;
+                        }
+
+                        cur_state = s_literal_next_state[cur_state];
+                        dst_ofs++;
+                        continue;
+                     }
+
+                     uint match_len;
+                     match_len = 1;
+
+                     uint is_rep; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_rep, m_is_rep_model[cur_state]);
+                     if (LZHAM_BUILTIN_EXPECT(is_rep, 1))
+                     {
+                        uint is_rep0; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_rep0, m_is_rep0_model[cur_state]);
+                        if (LZHAM_BUILTIN_EXPECT(is_rep0, 1))
+                        {
+                           uint is_rep0_len1; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_rep0_len1, m_is_rep0_single_byte_model[cur_state]);
+                           if (LZHAM_BUILTIN_EXPECT(is_rep0_len1, 1))
+                           {
+                              cur_state = (cur_state < CLZDecompBase::cNumLitStates) ? 9 : 11;
+                           }
+                           else
+                           {
+                              LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, match_len, m_rep_len_table[cur_state >= CLZDecompBase::cNumLitStates]);
+                              match_len += CLZDecompBase::cMinMatchLen;
+                              if (match_len == (CLZDecompBase::cMaxMatchLen + 1))
+                                 LZHAM_DECOMPRESS_DECODE_HUGE_MATCH_LEN_FAST(codec, match_len);
+
+                              cur_state = (cur_state < CLZDecompBase::cNumLitStates) ? 8 : 11;
+                           }
+                        }
+                        else
+                        {
+                           LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, match_len, m_rep_len_table[cur_state >= CLZDecompBase::cNumLitStates]);
+                           match_len += CLZDecompBase::cMinMatchLen;
+                           if (match_len == (CLZDecompBase::cMaxMatchLen + 1))
+                              LZHAM_DECOMPRESS_DECODE_HUGE_MATCH_LEN_FAST(codec, match_len);
+
+                           uint is_rep1; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_rep1, m_is_rep1_model[cur_state]);
+                           if (LZHAM_BUILTIN_EXPECT(is_rep1, 1))
+                           {
+                              uint temp = match_hist1;
+                              match_hist1 = match_hist0;
+                              match_hist0 = temp;
+                           }
+                           else
+                           {
+                              uint is_rep2; LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, is_rep2, m_is_rep2_model[cur_state]);
+                              if (LZHAM_BUILTIN_EXPECT(is_rep2, 1))
+                              {
+                                 uint temp = match_hist2;
+                                 match_hist2 = match_hist1;
+                                 match_hist1 = match_hist0;
+                                 match_hist0 = temp;
+                              }
+                              else
+                              {
+                                 uint temp = match_hist3;
+                                 match_hist3 = match_hist2;
+                                 match_hist2 = match_hist1;
+                                 match_hist1 = match_hist0;
+                                 match_hist0 = temp;
+                              }
+                           }
+
+                           cur_state = (cur_state < CLZDecompBase::cNumLitStates) ? 8 : 11;
+                        }
+                     }
+                     else
+                     {
+                        uint sym; LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, sym, m_main_table);
+                        sym -= CLZDecompBase::cLZXNumSpecialLengths;
+
+                        if (LZHAM_BUILTIN_EXPECT(static_cast<int>(sym) < 0, 0))
+                        {
+                           if (static_cast<int>(sym) == (CLZDecompBase::cLZXSpecialCodeEndOfBlockCode - CLZDecompBase::cLZXNumSpecialLengths))
+                           {
+                              fast_end_of_block = 1;
+                              break;
+                           }
+
+                           // Must be cLZXSpecialCodePartialStateReset.
+                           match_hist0 = 1;
+                           match_hist1 = 1;
+                           match_hist2 = 1;
+                           match_hist3 = 1;
+                           cur_state = 0;
+                           continue;
+                        }
+
+                        match_len = (sym & 7) + 2;
+
+                        uint match_slot;
+                        match_slot = (sym >> 3) + CLZDecompBase::cLZXLowestUsableMatchSlot;
+
+                        if (LZHAM_BUILTIN_EXPECT(match_len == 9, 0))
+                        {
+                           uint e; LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, e, m_large_len_table[cur_state >= CLZDecompBase::cNumLitStates]);
+                           match_len += e;
+                           if (match_len == (CLZDecompBase::cMaxMatchLen + 1))
+                              LZHAM_DECOMPRESS_DECODE_HUGE_MATCH_LEN_FAST(codec, match_len);
+                        }
+
+                        uint num_extra_bits;
+                        num_extra_bits = m_lzBase.m_lzx_position_extra_bits[match_slot];
+
+                        uint extra_bits;
+                        if (LZHAM_BUILTIN_EXPECT(num_extra_bits < 3, 0))
+                        {
+                           LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, extra_bits, num_extra_bits);
+                        }
+                        else
+                        {
+                           extra_bits = 0;
+                           if (LZHAM_BUILTIN_EXPECT(num_extra_bits > 4, 1))
+                           {
+                              LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, extra_bits, num_extra_bits - 4);
+                              extra_bits <<= 4;
+                           }
+
+                           uint j; LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, j, m_dist_lsb_table);
+                           extra_bits += j;
+                        }
+
+                        match_hist3 = match_hist2;
+                        match_hist2 = match_hist1;
+                        match_hist1 = match_hist0;
+                        match_hist0 = m_lzBase.m_lzx_position_base[match_slot] + extra_bits;
+
+                        cur_state = (cur_state < CLZDecompBase::cNumLitStates) ? CLZDecompBase::cNumLitStates : CLZDecompBase::cNumLitStates + 3;
+                     }
+
+                     if ( (unbuffered) && LZHAM_BUILTIN_EXPECT((((size_t)match_hist0 > dst_ofs) || ((dst_ofs + match_len) > out_buf_size)), 0) )
+                     {
+                        LZHAM_SYMBOL_CODEC_DECODE_END(codec);
+                        *m_pIn_buf_size = static_cast<size_t>(codec.decode_get_bytes_consumed());
+                        *m_pOut_buf_size = 0;
+                        for ( ; ; ) { LZHAM_CR_RETURN(m_state, LZHAM_DECOMP_STATUS_FAILED_BAD_CODE); }
+                     }
+
+                     uint src_ofs;
+                     const uint8* pCopy_src;
+                     src_ofs = (dst_ofs - match_hist0) & dict_size_mask;
+                     pCopy_src = pDst + src_ofs;
+
+                     if ( (!unbuffered) && LZHAM_BUILTIN_EXPECT( ((LZHAM_MAX(src_ofs, dst_ofs) + match_len) > dict_size_mask), 0) )
+                     {
+#undef LZHAM_SAVE_LOCAL_STATE
+#undef LZHAM_RESTORE_LOCAL_STATE
+#define LZHAM_SAVE_LOCAL_STATE m_match_len = match_len; m_src_ofs = src_ofs; m_pCopy_src = pCopy_src;
+#define LZHAM_RESTORE_LOCAL_STATE match_len = m_match_len; src_ofs = m_src_ofs; pCopy_src = m_pCopy_src;
+
+                        // Match source or destination wraps around the end of the dictionary, so copy it in pieces like the checked loop does.
+                        do
+                        {
+                           uint n;
+                           n = LZHAM_MIN(match_len, dict_size - dst_ofs);
+                           if (LZHAM_BUILTIN_EXPECT(!sync_dict_mirror(src_ofs, n, dst_ofs), 0))
+                              n = 1;
+
+                           copy_match(pDst + dst_ofs, pDst + src_ofs, n, match_hist0, prev_char, prev_prev_char);
+                           dst_ofs += n;
+                           src_ofs = (src_ofs + n) & dict_size_mask;
+                           match_len -= n;
+
+                           if (dst_ofs > dict_size_mask)
+                           {
+                              LZHAM_SYMBOL_CODEC_DECODE_END(codec);
+                              LZHAM_FLUSH_OUTPUT_BUFFER(dict_size);
+                              LZHAM_SYMBOL_CODEC_DECODE_BEGIN(codec);
+                              dst_ofs = 0;
+                           }
+                        } while (match_len > 0);
+
+#undef LZHAM_SAVE_LOCAL_STATE
+#undef LZHAM_RESTORE_LOCAL_STATE
+#define LZHAM_SAVE_LOCAL_STATE
+#define LZHAM_RESTORE_LOCAL_STATE
+
+                        // The flush may have handed the codec a new input buffer.
+                        fast_end_of_block = 0;
+                        break;
+                     }
+
+                     if (LZHAM_BUILTIN_EXPECT(((dst_ofs + match_len) <= wild_copy_dst_end) && (match_len > 1), 1))
+                     {
+                        wild_copy_match(pDst + dst_ofs, pCopy_src, match_len, match_hist0);
+                        // The copy reproduces the source, so track the last 2 bytes from there. Unless the match overlaps itself this doesn't load what was just stored.
+                        prev_prev_char = pCopy_src[match_len - 2];
+                        prev_char = pCopy_src[match_len - 1];
+                     }
+                     else
+                     {
+                        copy_match(pDst + dst_ofs, pCopy_src, match_len, match_hist0, prev_char, prev_prev_char);
+                     }
+                     dst_ofs += match_len;
+                  }
+
+                  if (fast_end_of_block)
+                     break;
+               }
+#endif
+
 #ifdef LZHAM_LZDEBUG
                uint sync_marker; LZHAM_SYMBOL_CODEC_DECODE_GET_BITS(codec, x, CLZDecompBase::cLZHAMDebugSyncMarkerBits);
                LZHAM_VERIFY(sync_marker == CLZDecompBase::cLZHAMDebugSyncMarkerValue);
@@ -1001,82 +1438,32 @@ namespace lzham
 
                   if ( (!unbuffered) && LZHAM_BUILTIN_EXPECT( ((LZHAM_MAX(src_ofs, dst_ofs) + match_len) > dict_size_mask), 0) )
                   {
-                     // Match source or destination wraps around the end of the dictionary to the beginning, so handle the copy one byte at a time.
+                     // Match source or destination wraps around the end of the dictionary to the beginning. Copy up to the end of the dictionary
+                     // at a time, reading the source through the mirror past its end, and only fall back to single bytes where the mirror can't supply them.
                      do
                      {
-                        uint8 c;
-                        c = *pCopy_src++;
-                        prev_prev_char = prev_char;
-                        prev_char = c;
-                        pDst[dst_ofs++] = c;
+                        uint n;
+                        n = LZHAM_MIN(match_len, dict_size - dst_ofs);
+                        if (LZHAM_BUILTIN_EXPECT(!sync_dict_mirror(src_ofs, n, dst_ofs), 0))
+                           n = 1;
 
-                        if (LZHAM_BUILTIN_EXPECT(pCopy_src == pDst_end, 0))
-                           pCopy_src = pDst;
+                        copy_match(pDst + dst_ofs, pDst + src_ofs, n, match_hist0, prev_char, prev_prev_char);
+                        dst_ofs += n;
+                        src_ofs = (src_ofs + n) & dict_size_mask;
+                        match_len -= n;
 
-                        if (LZHAM_BUILTIN_EXPECT(dst_ofs > dict_size_mask, 0))
+                        if (dst_ofs > dict_size_mask)
                         {
                            LZHAM_SYMBOL_CODEC_DECODE_END(codec);
                            LZHAM_FLUSH_OUTPUT_BUFFER(dict_size);
                            LZHAM_SYMBOL_CODEC_DECODE_BEGIN(codec);
                            dst_ofs = 0;
                         }
-
-                        match_len--;
-                     } while (LZHAM_BUILTIN_EXPECT(match_len > 0, 1));
+                     } while (match_len > 0);
                   }
                   else
                   {
-                     uint8* pCopy_dst = pDst + dst_ofs;
-                     if (LZHAM_BUILTIN_EXPECT(match_hist0 == 1, 0))
-                     {
-                        // Handle byte runs.
-                        uint8 c = *pCopy_src;
-                        if (LZHAM_BUILTIN_EXPECT(match_len < 8, 1))
-                        {
-                           for (int i = match_len; i > 0; i--)
-                              *pCopy_dst++ = c;
-                           if (LZHAM_BUILTIN_EXPECT(match_len == 1, 1))
-                              prev_prev_char = prev_char;
-                           else
-                              prev_prev_char = c;
-                        }
-                        else
-                        {
-                           memset(pCopy_dst, c, match_len);
-                           prev_prev_char = c;
-                        }
-                        prev_char = c;
-                     }
-                     else if (LZHAM_BUILTIN_EXPECT(match_len == 1, 1))
-                     {
-                        // Handle single byte matches.
-                        prev_prev_char = prev_char;
-                        prev_char = *pCopy_src;
-                        *pCopy_dst = static_cast<uint8>(prev_char);
-                     }
-                     else
-                     {
-                        // Handle matches of length 2 or higher.
-                        uint bytes_to_copy = match_len - 2;
-                        if (LZHAM_BUILTIN_EXPECT(((bytes_to_copy < 8) || ((int)bytes_to_copy > match_hist0)), 1))
-                        {
-                           for (int i = bytes_to_copy; i > 0; i--)
-                              *pCopy_dst++ = *pCopy_src++;
-                        }
-                        else
-                        {
-                           LZHAM_MEMCPY(pCopy_dst, pCopy_src, bytes_to_copy);
-                           pCopy_dst += bytes_to_copy;
-                           pCopy_src += bytes_to_copy;
-                        }
-                        // Handle final 2 bytes of match specially, because we always track the last 2 bytes output in 
-                        // local variables (needed for computing context) to avoid load hit stores on some CPU's.
-                        prev_prev_char = *pCopy_src++;
-                        *pCopy_dst++ = static_cast<uint8>(prev_prev_char);
-
-                        prev_char = *pCopy_src++;
-                        *pCopy_dst++ = static_cast<uint8>(prev_char);
-                     }
+                     copy_match(pDst + dst_ofs, pCopy_src, match_len, match_hist0, prev_char, prev_prev_char);
                      dst_ofs += match_len;
                   }
                } // lit or match
@@ -1159,11 +1546,22 @@ namespace lzham
       return m_status;
    }
 
-   static bool check_params(const lzham_decompress_params *pParams)
+   // Callers built against older versions of lzham.h pass a shorter lzham_decompress_params, missing the fields that were appended since.
+   // Copies whatever the caller's version has into params and zeros the rest, which selects each newer field's default.
+   static bool get_decompress_params(lzham_decompress_params &params, const lzham_decompress_params *pParams)
    {
-      if ((!pParams) || (pParams->m_struct_size != sizeof(lzham_decompress_params)))
+      const uint cMinStructSize = offsetof(lzham_decompress_params, m_numa_node);
+      if ((!pParams) || (pParams->m_struct_size < cMinStructSize) || (pParams->m_struct_size > sizeof(lzham_decompress_params)))
          return false;
 
+      utils::zero_object(params);
+      memcpy(&params, pParams, pParams->m_struct_size);
+      params.m_struct_size = sizeof(lzham_decompress_params);
+      return true;
+   }
+
+   static bool check_params(const lzham_decompress_params *pParams)
+   {
       if ((pParams->m_dict_size_log2 < CLZDecompBase::cMinDictSizeLog2) || (pParams->m_dict_size_log2 > CLZDecompBase::cMaxDictSizeLog2))
          return false;
 
@@ -1174,16 +1572,67 @@ namespace lzham
          if (pParams->m_num_seed_bytes > (1U << pParams->m_dict_size_log2))
             return false;
       }
+
+      if (pParams->m_pOutput_ring)
+      {
+         if ((pParams->m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED) != 0)
+            return false;
+         if (pParams->m_output_ring_size < (1U << pParams->m_dict_size_log2))
+            return false;
+      }
       return true;
    }
    
-   lzham_decompress_state_ptr LZHAM_CDECL lzham_lib_decompress_init(const lzham_decompress_params *pParams)
+   static inline uint get_decomp_buf_alloc_flags(const lzham_decompress_params *pParams)
+   {
+      uint alloc_flags = (pParams->m_decompress_flags & LZHAM_DECOMP_FLAG_LARGE_PAGES) ? cLargeAllocHugePages : 0;
+      if (pParams->m_decompress_flags & LZHAM_DECOMP_FLAG_MIRRORED_DICT)
+         alloc_flags |= cDecompBufMirrored;
+      return alloc_flags;
+   }
+
+   // The dictionary is hit all over by match copies, so it comes from lzham_large_alloc() to allow huge pages. The alignment padding is followed
+   // by the tail mirror. If a mirrored mapping is asked for but not available, cDecompBufMirrored is cleared from alloc_flags.
+   static uint8* alloc_decomp_buf(uint32 size, uint& alloc_flags, const lzham_decompress_params *pParams)
+   {
+      if (alloc_flags & cDecompBufMirrored)
+      {
+         uint8* p = static_cast<uint8*>(lzham_mirrored_alloc(size));
+         if (p)
+            return p;
+         alloc_flags &= ~cDecompBufMirrored;
+      }
+
+      return static_cast<uint8*>(lzham_large_alloc(size + 15 + get_dict_tail_mirror_size(size), alloc_flags, static_cast<int>(pParams->m_numa_node) - 1));
+   }
+
+   static void free_raw_decomp_buf(uint8* pRaw_decomp_buf, uint32 size, uint alloc_flags)
+   {
+      if (alloc_flags & cDecompBufMirrored)
+         lzham_mirrored_free(pRaw_decomp_buf, size);
+      else
+         lzham_large_free(pRaw_decomp_buf, size + 15 + get_dict_tail_mirror_size(size), alloc_flags);
+   }
+
+   static void free_decomp_buf(lzham_decompressor *pState)
+   {
+      if (pState->m_pRaw_decomp_buf)
+         free_raw_decomp_buf(pState->m_pRaw_decomp_buf, pState->m_raw_decomp_buf_size, pState->m_raw_decomp_buf_alloc_flags);
+      pState->m_pRaw_decomp_buf = NULL;
+      pState->m_raw_decomp_buf_size = 0;
+      pState->m_raw_decomp_buf_alloc_flags = 0;
+      pState->m_pDecomp_buf = NULL;
+   }
+
+   lzham_decompress_state_ptr LZHAM_CDECL lzham_lib_decompress_init(const lzham_decompress_params *pCaller_params)
    {
       LZHAM_ASSUME(CLZDecompBase::cMinDictSizeLog2 == LZHAM_MIN_DICT_SIZE_LOG2);
       LZHAM_ASSUME(CLZDecompBase::cMaxDictSizeLog2 == LZHAM_MAX_DICT_SIZE_LOG2_X64);
 
-      if (!check_params(pParams))
+      lzham_decompress_params params;
+      if ((!get_decompress_params(params, pCaller_params)) || (!check_params(&params)))
          return NULL;
+      const lzham_decompress_params *pParams = &params;
       
       lzham_decompressor *pState = lzham_new<lzham_decompressor>();
       if (!pState)
@@ -1191,22 +1640,27 @@ namespace lzham
 
       pState->m_params = *pParams;
 
-      if (pState->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED)
+      pState->m_pRaw_decomp_buf = NULL;
+      pState->m_raw_decomp_buf_size = 0;
+      pState->m_raw_decomp_buf_alloc_flags = 0;
+      pState->m_pDecomp_buf = NULL;
+
+      if (pState->m_params.m_pOutput_ring)
       {
-         pState->m_pRaw_decomp_buf = NULL;
-         pState->m_raw_decomp_buf_size = 0;
-         pState->m_pDecomp_buf = NULL;
+         pState->m_pDecomp_buf = pState->m_params.m_pOutput_ring;
       }
-      else
+      else if ((pState->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED) == 0)
       {
          uint32 decomp_buf_size = 1U << pState->m_params.m_dict_size_log2;
-         pState->m_pRaw_decomp_buf = static_cast<uint8*>(lzham_malloc(decomp_buf_size + 15));
+         uint alloc_flags = get_decomp_buf_alloc_flags(pParams);
+         pState->m_pRaw_decomp_buf = alloc_decomp_buf(decomp_buf_size, alloc_flags, pParams);
          if (!pState->m_pRaw_decomp_buf)
          {
             lzham_delete(pState);
             return NULL;
          }
          pState->m_raw_decomp_buf_size = decomp_buf_size;
+         pState->m_raw_decomp_buf_alloc_flags = alloc_flags;
          pState->m_pDecomp_buf = math::align_up_pointer(pState->m_pRaw_decomp_buf, 16);
       }
 
@@ -1215,33 +1669,48 @@ namespace lzham
       return pState;
    }
 
-   lzham_decompress_state_ptr LZHAM_CDECL lzham_lib_decompress_reinit(lzham_decompress_state_ptr p, const lzham_decompress_params *pParams)
+   lzham_decompress_state_ptr LZHAM_CDECL lzham_lib_decompress_reinit(lzham_decompress_state_ptr p, const lzham_decompress_params *pCaller_params)
    {
       if (!p)
-         return lzham_lib_decompress_init(pParams);
+         return lzham_lib_decompress_init(pCaller_params);
       
       lzham_decompressor *pState = static_cast<lzham_decompressor *>(p);
 
-      if (!check_params(pParams))
+      lzham_decompress_params params;
+      if ((!get_decompress_params(params, pCaller_params)) || (!check_params(&params)))
          return NULL;
+      const lzham_decompress_params *pParams = &params;
       
-      if (pState->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED)
+      if (pParams->m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED)
+      {
+         free_decomp_buf(pState);
+      }
+      else if (pParams->m_pOutput_ring)
       {
-         lzham_free(pState->m_pRaw_decomp_buf);
-         pState->m_pRaw_decomp_buf = NULL;
-         pState->m_raw_decomp_buf_size = 0;
-         pState->m_pDecomp_buf = NULL;
+         free_decomp_buf(pState);
+         pState->m_pDecomp_buf = pParams->m_pOutput_ring;
       }
       else
       {
-         uint32 new_dict_size = 1U << pState->m_params.m_dict_size_log2;
-         if ((!pState->m_pRaw_decomp_buf) || (pState->m_raw_decomp_buf_size < new_dict_size))
+         // init() resets the dictionary, so its contents don't have to survive a reallocation.
+         // A mirrored mapping has to end right where the dictionary does, other buffers can be reused for smaller dictionaries.
+         uint32 new_dict_size = 1U << pParams->m_dict_size_log2;
+         uint alloc_flags = get_decomp_buf_alloc_flags(pParams);
+         bool reuse_buf = (pState->m_pRaw_decomp_buf) && (pState->m_raw_decomp_buf_alloc_flags == alloc_flags);
+         if (alloc_flags & cDecompBufMirrored)
+            reuse_buf = reuse_buf && (pState->m_raw_decomp_buf_size == new_dict_size);
+         else
+            reuse_buf = reuse_buf && (pState->m_raw_decomp_buf_size >= new_dict_size);
+         if (!reuse_buf)
          {
-            uint8 *pNew_dict = static_cast<uint8*>(lzham_realloc(pState->m_pRaw_decomp_buf, new_dict_size + 15));
+            free_decomp_buf(pState);
+
+            uint8 *pNew_dict = alloc_decomp_buf(new_dict_size, alloc_flags, pParams);
             if (!pNew_dict)
                return NULL;
             pState->m_pRaw_decomp_buf = pNew_dict;
             pState->m_raw_decomp_buf_size = new_dict_size;
+            pState->m_raw_decomp_buf_alloc_flags = alloc_flags;
             pState->m_pDecomp_buf = math::align_up_pointer(pState->m_pRaw_decomp_buf, 16);
          }
       }
@@ -1253,6 +1722,63 @@ namespace lzham
       return pState;
    }
 
+   // Moves a pointer into [pOld_base, pOld_base + size) to the same offset from pNew_base, leaving other pointers alone.
+   template<typename T> static inline T* rebase_pointer(T* p, const void* pOld_base, size_t size, void* pNew_base)
+   {
+      const uint8* pOld = static_cast<const uint8*>(pOld_base);
+      const uint8* pByte = reinterpret_cast<const uint8*>(p);
+      if ((pByte < pOld) || (pByte >= (pOld + size)))
+         return p;
+      return reinterpret_cast<T*>(static_cast<uint8*>(pNew_base) + (pByte - pOld));
+   }
+
+   lzham_decompress_state_ptr LZHAM_CDECL lzham_lib_decompress_clone(lzham_decompress_state_ptr p)
+   {
+      const lzham_decompressor *pSrc_state = static_cast<const lzham_decompressor *>(p);
+      if ((!pSrc_state) || (!pSrc_state->m_params.m_dict_size_log2))
+         return NULL;
+
+      // An unbuffered decompressor's dictionary is the caller's output buffer (as is an output ring), which the copy can't share.
+      if ((pSrc_state->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED) || (pSrc_state->m_params.m_pOutput_ring))
+         return NULL;
+
+      uint alloc_flags = pSrc_state->m_raw_decomp_buf_alloc_flags;
+      uint8 *pRaw_decomp_buf = alloc_decomp_buf(pSrc_state->m_raw_decomp_buf_size, alloc_flags, &pSrc_state->m_params);
+      if (!pRaw_decomp_buf)
+         return NULL;
+
+      // Copies the models, including their decoding tables.
+      lzham_decompressor *pState = lzham_new<lzham_decompressor>(*pSrc_state);
+      if (!pState)
+      {
+         free_raw_decomp_buf(pRaw_decomp_buf, pSrc_state->m_raw_decomp_buf_size, alloc_flags);
+         return NULL;
+      }
+
+      pState->m_pRaw_decomp_buf = pRaw_decomp_buf;
+      pState->m_raw_decomp_buf_alloc_flags = alloc_flags;
+      pState->m_pDecomp_buf = math::align_up_pointer(pRaw_decomp_buf, 16);
+      pState->init_dict_mirror();
+
+      // The rest of the dictionary hasn't been written yet.
+      const uint dict_bytes_used = LZHAM_MIN(LZHAM_MAX(pSrc_state->m_dict_high_water, pSrc_state->m_dst_ofs), 1U << pSrc_state->m_params.m_dict_size_log2);
+      memcpy(pState->m_pDecomp_buf, pSrc_state->m_pDecomp_buf, dict_bytes_used);
+
+      // The coroutine may have stopped in the middle of a match copy, a flush, or a symbol, so it can hold pointers into the old dictionary or models.
+      const size_t dict_size = pSrc_state->m_raw_decomp_buf_size;
+      pState->m_pFlush_src = rebase_pointer(pState->m_pFlush_src, pSrc_state->m_pDecomp_buf, dict_size, pState->m_pDecomp_buf);
+      pState->m_pCopy_src = rebase_pointer(pState->m_pCopy_src, pSrc_state->m_pDecomp_buf, dict_size, pState->m_pDecomp_buf);
+      pState->m_codec.m_pSaved_huff_model = rebase_pointer(pState->m_codec.m_pSaved_huff_model, pSrc_state, sizeof(lzham_decompressor), pState);
+      pState->m_codec.m_pSaved_model = rebase_pointer(pState->m_codec.m_pSaved_model, pSrc_state, sizeof(lzham_decompressor), pState);
+
+      pState->m_pIn_buf = NULL;
+      pState->m_pIn_buf_size = NULL;
+      pState->m_pOut_buf = NULL;
+      pState->m_pOut_buf_size = NULL;
+
+      return pState;
+   }
+
    uint32 LZHAM_CDECL lzham_lib_decompress_deinit(lzham_decompress_state_ptr p)
    {
       lzham_decompressor *pState = static_cast<lzham_decompressor *>(p);
@@ -1261,7 +1787,7 @@ namespace lzham
 
       uint32 adler32 = pState->m_decomp_adler32;
 
-      lzham_free(pState->m_pRaw_decomp_buf);
+      free_decomp_buf(pState);
       lzham_delete(pState);
 
       return adler32;
@@ -1285,7 +1811,7 @@ namespace lzham
          return LZHAM_DECOMP_STATUS_INVALID_PARAMETER;
       }
 
-      if ((*pOut_buf_size) && (!pOut_buf))
+      if ((*pOut_buf_size) && (!pOut_buf) && (!pState->m_params.m_pOutput_ring))
       {
          return LZHAM_DECOMP_STATUS_INVALID_PARAMETER;
       }
@@ -1312,7 +1838,18 @@ namespace lzham
          }
       }
 
+      // Both copies keep everything that survives a coroutine return in the decompressor, so either can resume the other.
       lzham_decompress_status_t status;
+#if LZHAM_DECOMP_BMI2_DISPATCH
+      if (lzham_get_cpu_features() & cCPUFeatureBMI2)
+      {
+         if (pState->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED)
+            status = pState->decompress_bmi2<true>();
+         else
+            status = pState->decompress_bmi2<false>();
+         return status;
+      }
+#endif
       if (pState->m_params.m_decompress_flags & LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED)
          status = pState->decompress<true>();
       else
@@ -1323,10 +1860,10 @@ namespace lzham
 
    lzham_decompress_status_t LZHAM_CDECL lzham_lib_decompress_memory(const lzham_decompress_params *pParams, lzham_uint8* pDst_buf, size_t *pDst_len, const lzham_uint8* pSrc_buf, size_t src_len, lzham_uint32 *pAdler32)
    {
-      if (!pParams)
+      lzham_decompress_params params;
+      if (!get_decompress_params(params, pParams))
          return LZHAM_DECOMP_STATUS_INVALID_PARAMETER;
 
-      lzham_decompress_params params(*pParams);
       params.m_decompress_flags |= LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED;
 
       lzham_decompress_state_ptr pState = lzham_lib_decompress_init(&params);
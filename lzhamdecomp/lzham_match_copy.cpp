@@ -0,0 +1,180 @@
+// File: lzham_match_copy.cpp
+// See Copyright Notice and license at the end of include/lzham.h
+#include "lzham_core.h"
+#include "lzham_match_copy.h"
+
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace lzham
+{
+   void match_copy_scalar(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist)
+   {
+      uint8* pDst_end = pDst + match_len;
+
+#if LZHAM_USE_UNALIGNED_INT_LOADS
+      // Output whole periods of the pattern until it repeats at a distance of at least a qword. Each period written doubles the
+      // distance the pattern can be copied from, and pSrc stays put.
+      while (match_dist < sizeof(uint64))
+      {
+         for (uint i = 0; i < match_dist; i++)
+            pDst[i] = pSrc[i];
+         pDst += match_dist;
+         if (pDst >= pDst_end)
+            return;
+         match_dist <<= 1;
+      }
+
+      do
+      {
+         *reinterpret_cast<uint64*>(pDst) = *reinterpret_cast<const uint64*>(pSrc);
+         pDst += sizeof(uint64);
+         pSrc += sizeof(uint64);
+      } while (pDst < pDst_end);
+#else
+      LZHAM_NOTE_UNUSED(match_dist);
+      do
+      {
+         *pDst++ = *pSrc++;
+      } while (pDst < pDst_end);
+#endif
+   }
+
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+   LZHAM_TARGET_SSE2 static void match_copy_sse2(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist)
+   {
+      uint8* pDst_end = pDst + match_len;
+
+      __m128i v;
+      uint step;
+      if (match_dist >= 16)
+      {
+         do
+         {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc)));
+            pDst += 16;
+            pSrc += 16;
+         } while (pDst < pDst_end);
+         return;
+      }
+      else if (match_dist == 1)
+      {
+         v = _mm_set1_epi8(static_cast<char>(*pSrc));
+         step = 16;
+      }
+      else
+      {
+         // SSE2 has no byte shuffle, so expand the pattern through memory. The register holds a whole number of periods.
+         // Only the first match_dist bytes of the load are valid, the rest are overwritten.
+         union { __m128i m_v; uint8 m_bytes[16]; } pattern;
+         pattern.m_v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+         for (uint i = match_dist; i < 16; i++)
+            pattern.m_bytes[i] = pattern.m_bytes[i - match_dist];
+         v = pattern.m_v;
+         step = 16 - (16 % match_dist);
+      }
+
+      do
+      {
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst), v);
+         pDst += step;
+      } while (pDst < pDst_end);
+   }
+
+   // Shuffle control for distances 2-15: byte i of the 32 byte pattern comes from byte (i % match_dist) of the source.
+   static const uint8 s_pattern_shuffle[14][32] =
+   {
+         { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+         { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1 },
+         { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },
+         { 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1 },
+         { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1 },
+         { 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3 },
+         { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1 },
+   };
+
+   // The largest whole number of periods that fits in 32 bytes, for distances 2-15.
+   static const uint8 s_pattern_step[14] = { 32, 30, 32, 30, 30, 28, 32, 27, 30, 22, 24, 26, 28, 30 };
+
+   LZHAM_TARGET_AVX2 static void match_copy_avx2(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist)
+   {
+      uint8* pDst_end = pDst + match_len;
+
+      __m256i v;
+      uint step;
+      if (match_dist >= 32)
+      {
+         do
+         {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc)));
+            pDst += 32;
+            pSrc += 32;
+         } while (pDst < pDst_end);
+         return;
+      }
+      else if (match_dist >= 16)
+      {
+         do
+         {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc)));
+            pDst += 16;
+            pSrc += 16;
+         } while (pDst < pDst_end);
+         return;
+      }
+      else if (match_dist == 1)
+      {
+         v = _mm256_set1_epi8(static_cast<char>(*pSrc));
+         step = 32;
+      }
+      else
+      {
+         // Only the first match_dist bytes of the load are valid, the shuffle never selects the others.
+         const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+         const __m128i* pShuffle = reinterpret_cast<const __m128i*>(s_pattern_shuffle[match_dist - 2]);
+         const __m128i lo = _mm_shuffle_epi8(s, _mm_loadu_si128(pShuffle));
+         const __m128i hi = _mm_shuffle_epi8(s, _mm_loadu_si128(pShuffle + 1));
+         v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+         step = s_pattern_step[match_dist - 2];
+      }
+
+      do
+      {
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst), v);
+         pDst += step;
+      } while (pDst < pDst_end);
+   }
+#endif // LZHAM_USE_X86_SIMD_INTRINSICS
+
+   static match_copy_func_ptr select_match_copy_func()
+   {
+#if LZHAM_USE_X86_SIMD_INTRINSICS
+      const uint features = lzham_get_cpu_features();
+      if (features & cCPUFeatureAVX2)
+         return match_copy_avx2;
+      if (features & cCPUFeatureSSE2)
+         return match_copy_sse2;
+#endif
+      return match_copy_scalar;
+   }
+
+   // Initial target of g_pMatch_copy_func: picks the best kernel, then forwards. Every thread selects the same kernel, so the unsynchronized store is harmless.
+   static void match_copy_dispatch(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist)
+   {
+      match_copy_func_ptr pFunc = select_match_copy_func();
+      g_pMatch_copy_func = pFunc;
+      (*pFunc)(pDst, pSrc, match_len, match_dist);
+   }
+
+   match_copy_func_ptr g_pMatch_copy_func = match_copy_dispatch;
+
+} // namespace lzham
@@ -0,0 +1,38 @@
+// File: lzham_match_copy.h
+// See Copyright Notice and license at the end of include/lzham.h
+#pragma once
+
+namespace lzham
+{
+   // Wild match copies may write (and read) up to this many bytes past the end of the match, so the buffer needs this much slack after it.
+   const uint cMatchCopyMaxOverrun = 32;
+
+   // Copies match_len bytes from pSrc to pDst with the same result as a forward byte loop, where pSrc is match_dist bytes before pDst
+   // (so distances shorter than the length repeat the pattern). May write up to cMatchCopyMaxOverrun bytes past pDst + match_len.
+   typedef void (*match_copy_func_ptr)(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist);
+
+   // Selected on first use from the scalar, SSE2 or AVX2 kernels depending on the CPU.
+   extern match_copy_func_ptr g_pMatch_copy_func;
+
+   void match_copy_scalar(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist);
+
+   // Most matches are short and at least 16 bytes back, so copy those with one 16 byte move inline before dispatching to the wide kernels.
+   LZHAM_FORCE_INLINE void wild_copy_match(uint8* pDst, const uint8* pSrc, uint match_len, uint match_dist)
+   {
+      LZHAM_ASSERT(match_len > 0);
+
+#if LZHAM_USE_UNALIGNED_INT_LOADS && LZHAM_CPU_HAS_64BIT_REGISTERS
+      if (LZHAM_BUILTIN_EXPECT((match_len <= 16) && (match_dist >= 16), 1))
+      {
+         const uint64 a = reinterpret_cast<const uint64*>(pSrc)[0];
+         const uint64 b = reinterpret_cast<const uint64*>(pSrc)[1];
+         reinterpret_cast<uint64*>(pDst)[0] = a;
+         reinterpret_cast<uint64*>(pDst)[1] = b;
+         return;
+      }
+#endif
+
+      (*g_pMatch_copy_func)(pDst, pSrc, match_len, match_dist);
+   }
+
+} // namespace lzham
@@ -6,6 +6,10 @@
    #include <intrin.h>
    #if defined(_MSC_VER)
       #pragma intrinsic(_BitScanReverse)
+      #pragma intrinsic(_BitScanForward)
+      #if defined(_M_X64)
+         #pragma intrinsic(_BitScanForward64)
+      #endif
    #endif
 #endif
 
@@ -107,6 +111,43 @@ namespace lzham
          return l;
       }
 
+      // v must be non-zero.
+      inline uint count_trailing_zero_bits(uint32 v)
+      {
+         LZHAM_ASSERT(v);
+#if defined(__GNUC__)
+         return __builtin_ctz(v);
+#elif defined(LZHAM_USE_MSVC_INTRINSICS)
+         unsigned long l;
+         _BitScanForward(&l, v);
+         return l;
+#else
+         uint l = 0;
+         while (!(v & 1U))
+         {
+            v >>= 1;
+            l++;
+         }
+         return l;
+#endif
+      }
+
+      // v must be non-zero.
+      inline uint count_trailing_zero_bits(uint64 v)
+      {
+         LZHAM_ASSERT(v);
+#if defined(__GNUC__)
+         return __builtin_ctzll(v);
+#elif defined(LZHAM_USE_MSVC_INTRINSICS) && defined(_M_X64)
+         unsigned long l;
+         _BitScanForward64(&l, v);
+         return l;
+#else
+         const uint32 lo = static_cast<uint32>(v);
+         return lo ? count_trailing_zero_bits(lo) : (32 + count_trailing_zero_bits(static_cast<uint32>(v >> 32)));
+#endif
+      }
+
    }
 
 } // namespace lzham
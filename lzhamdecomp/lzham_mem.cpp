@@ -3,6 +3,26 @@
 #include "lzham_core.h"
 #include <malloc.h>
 
+#if LZHAM_USE_WIN32_API && !LZHAM_PLATFORM_X360
+   #define LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC 1
+#elif defined(__linux__)
+   #include <sys/mman.h>
+   #include <sys/syscall.h>
+   #include <unistd.h>
+   #define LZHAM_LARGE_ALLOC_USE_MMAP 1
+   // Older headers have MAP_HUGETLB but not the page size selector (log2 of the size, shifted by MAP_HUGE_SHIFT).
+   #if defined(MAP_HUGETLB) && !defined(MAP_HUGE_2MB)
+      #define MAP_HUGE_2MB (21 << 26)
+   #endif
+#endif
+
+#ifndef LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC
+   #define LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC 0
+#endif
+#ifndef LZHAM_LARGE_ALLOC_USE_MMAP
+   #define LZHAM_LARGE_ALLOC_USE_MMAP 0
+#endif
+
 using namespace lzham;
 
 #define LZHAM_MEM_STATS 0
@@ -243,6 +263,170 @@ namespace lzham
       return (*g_pMSize)(p, g_pUser_data);
    }
 
+#if LZHAM_LARGE_ALLOC_USE_MMAP
+   const size_t cHugePageSize = 2U * 1024U * 1024U;
+
+   static void bind_to_numa_node(void* p, size_t size, int numa_node)
+   {
+   #ifdef SYS_mbind
+      if ((numa_node < 0) || (numa_node >= static_cast<int>(sizeof(unsigned long) * 8)))
+         return;
+
+      // MPOL_PREFERRED, so the pages still come from another node rather than failing once numa_node runs out.
+      const int cMPOL_PREFERRED = 1;
+      unsigned long node_mask = 1UL << numa_node;
+      syscall(SYS_mbind, p, size, cMPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8 + 1, 0);
+   #else
+      LZHAM_NOTE_UNUSED(p);
+      LZHAM_NOTE_UNUSED(size);
+      LZHAM_NOTE_UNUSED(numa_node);
+   #endif
+   }
+#endif
+
+   // Huge page blocks are rounded up to whole huge pages, so the size passed to lzham_large_free() maps to the same length.
+   static size_t get_large_alloc_size(size_t size)
+   {
+#if LZHAM_LARGE_ALLOC_USE_MMAP
+      return (size + cHugePageSize - 1) & ~(cHugePageSize - 1);
+#elif LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC
+      const size_t large_page_size = GetLargePageMinimum();
+      if (large_page_size)
+         return (size + large_page_size - 1) & ~(large_page_size - 1);
+#endif
+      return size;
+   }
+
+   void* lzham_large_alloc(size_t size, uint flags, int numa_node)
+   {
+      if ((flags & cLargeAllocHugePages) == 0)
+         return lzham_malloc(size);
+
+      if (!size)
+         return NULL;
+
+      const size_t alloc_size = get_large_alloc_size(size);
+
+#if LZHAM_LARGE_ALLOC_USE_MMAP
+      // Explicit huge pages only work if the admin reserved some, so usually this falls back to transparent huge pages. Ask for 2MB pages
+      // explicitly: alloc_size is only rounded to cHugePageSize, and the system default huge page size may be bigger (1GB).
+   #ifdef MAP_HUGETLB
+      void* p = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+      if (p != MAP_FAILED)
+      {
+         bind_to_numa_node(p, alloc_size, numa_node);
+         return p;
+      }
+   #endif
+
+      // Transparent huge pages only back huge page aligned ranges, so over-allocate and trim the block to an aligned one.
+      uint8* pRaw = static_cast<uint8*>(mmap(NULL, alloc_size + cHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (pRaw == MAP_FAILED)
+      {
+         lzham_mem_error("lzham_large_alloc: out of memory");
+         return NULL;
+      }
+
+      uint8* pAligned = reinterpret_cast<uint8*>((reinterpret_cast<ptr_bits_t>(pRaw) + cHugePageSize - 1) & ~static_cast<ptr_bits_t>(cHugePageSize - 1));
+      const size_t head_size = pAligned - pRaw;
+      if (head_size)
+         munmap(pRaw, head_size);
+      if (head_size != cHugePageSize)
+         munmap(pAligned + alloc_size, cHugePageSize - head_size);
+
+   #ifdef MADV_HUGEPAGE
+      madvise(pAligned, alloc_size, MADV_HUGEPAGE);
+   #endif
+      bind_to_numa_node(pAligned, alloc_size, numa_node);
+
+      return pAligned;
+#elif LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC
+      LZHAM_NOTE_UNUSED(numa_node);
+
+      // Large pages need the SeLockMemoryPrivilege, which most processes don't have.
+      void* p = VirtualAlloc(NULL, alloc_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (!p)
+         p = VirtualAlloc(NULL, alloc_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+      if (!p)
+         lzham_mem_error("lzham_large_alloc: out of memory");
+      return p;
+#else
+      LZHAM_NOTE_UNUSED(numa_node);
+      LZHAM_NOTE_UNUSED(alloc_size);
+      return lzham_malloc(size);
+#endif
+   }
+
+   void lzham_large_free(void* p, size_t size, uint flags)
+   {
+      if ((flags & cLargeAllocHugePages) == 0)
+      {
+         lzham_free(p);
+         return;
+      }
+
+      if (!p)
+         return;
+
+#if LZHAM_LARGE_ALLOC_USE_MMAP
+      munmap(p, get_large_alloc_size(size));
+#elif LZHAM_LARGE_ALLOC_USE_VIRTUAL_ALLOC
+      LZHAM_NOTE_UNUSED(size);
+      VirtualFree(p, 0, MEM_RELEASE);
+#else
+      LZHAM_NOTE_UNUSED(size);
+      lzham_free(p);
+#endif
+   }
+
+   void* lzham_mirrored_alloc(size_t size)
+   {
+#if LZHAM_LARGE_ALLOC_USE_MMAP && defined(SYS_memfd_create)
+      const long page_size = sysconf(_SC_PAGESIZE);
+      if ((!size) || (page_size <= 0) || (size & (static_cast<size_t>(page_size) - 1)))
+         return NULL;
+
+      // The pages have to belong to a file to be mapped twice. memfd_create() gives an anonymous one that goes away with the last mapping.
+      const int fd = static_cast<int>(syscall(SYS_memfd_create, "lzham_mirror", 1U /* MFD_CLOEXEC */));
+      if (fd < 0)
+         return NULL;
+
+      uint8* p = NULL;
+      if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+      {
+         // Reserve the whole range first, then map the file over both halves of it.
+         void* pReserved = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if (pReserved != MAP_FAILED)
+         {
+            p = static_cast<uint8*>(pReserved);
+            if ((mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+                (mmap(p + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+            {
+               munmap(p, size * 2);
+               p = NULL;
+            }
+         }
+      }
+
+      close(fd);
+      return p;
+#else
+      LZHAM_NOTE_UNUSED(size);
+      return NULL;
+#endif
+   }
+
+   void lzham_mirrored_free(void* p, size_t size)
+   {
+#if LZHAM_LARGE_ALLOC_USE_MMAP && defined(SYS_memfd_create)
+      if (p)
+         munmap(p, size * 2);
+#else
+      LZHAM_NOTE_UNUSED(p);
+      LZHAM_NOTE_UNUSED(size);
+#endif
+   }
+
    void LZHAM_CDECL lzham_lib_set_memory_callbacks(lzham_realloc_func pRealloc, lzham_msize_func pMSize, void* pUser_data)
    {
       if ((!pRealloc) || (!pMSize))
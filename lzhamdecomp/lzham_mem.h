@@ -11,6 +11,19 @@ namespace lzham
    void     lzham_free(void* p);
    size_t   lzham_msize(void* p);
 
+   // For big buffers that are accessed randomly (dictionaries, match finder trees), where TLB misses add up. With cLargeAllocHugePages the
+   // block is mapped straight from the OS, bypassing lzham_set_memory_callbacks(), and backed by huge pages where the OS allows it. If numa_node
+   // is >= 0 the pages preferably come from that node (Linux only). Otherwise these just call lzham_malloc()/lzham_free().
+   // The block must be freed with the same size and flags it was allocated with.
+   enum { cLargeAllocHugePages = 1 };
+   void*    lzham_large_alloc(size_t size, uint flags, int numa_node = -1);
+   void     lzham_large_free(void* p, size_t size, uint flags);
+
+   // Maps the same size bytes of memory twice, back to back, so [size, size * 2) aliases [0, size) and accesses can run off the end of the
+   // first copy. size must be a multiple of the page size. Returns NULL if the OS can't do this (currently Linux only), so callers need a fallback.
+   void*    lzham_mirrored_alloc(size_t size);
+   void     lzham_mirrored_free(void* p, size_t size);
+
    template<typename T>
    inline T* lzham_new()
    {
@@ -7,6 +7,11 @@
 #include <xbdm.h>
 #endif
 
+#if LZHAM_USE_X86_SIMD_INTRINSICS && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
 #ifndef _MSC_VER
 int sprintf_s(char *buffer, size_t sizeOfBuffer, const char *format, ...)
 {
@@ -67,6 +72,58 @@ void lzham_output_debug_string(const char* p)
 #endif   
 }
 
+namespace lzham
+{
+   static uint detect_cpu_features()
+   {
+      uint features = 0;
+#if LZHAM_USE_X86_SIMD_INTRINSICS && defined(__GNUC__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("sse2"))
+         features |= cCPUFeatureSSE2;
+      if (__builtin_cpu_supports("avx2"))
+         features |= cCPUFeatureAVX2;
+      if (__builtin_cpu_supports("bmi2"))
+         features |= cCPUFeatureBMI2;
+#elif LZHAM_USE_X86_SIMD_INTRINSICS && defined(_MSC_VER)
+      int regs[4];
+      __cpuid(regs, 0);
+      const int max_leaf = regs[0];
+
+      __cpuid(regs, 1);
+      if (regs[3] & (1 << 26))
+         features |= cCPUFeatureSSE2;
+
+      // AVX2 also requires the OS to save the YMM state across context switches.
+      const bool os_saves_ymm = ((regs[2] & (1 << 27)) != 0) && ((regs[2] & (1 << 28)) != 0) && ((_xgetbv(0) & 6) == 6);
+
+      if (max_leaf >= 7)
+      {
+         __cpuidex(regs, 7, 0);
+         if ((os_saves_ymm) && (regs[1] & (1 << 5)))
+            features |= cCPUFeatureAVX2;
+         if (regs[1] & (1 << 8))
+            features |= cCPUFeatureBMI2;
+      }
+#endif
+      return features;
+   }
+
+   uint lzham_get_cpu_features()
+   {
+      // Detection is idempotent, so racing threads at worst detect the features more than once.
+      static volatile int s_cpu_features = -1;
+      int features = s_cpu_features;
+      if (features < 0)
+      {
+         features = static_cast<int>(detect_cpu_features());
+         s_cpu_features = features;
+      }
+      return static_cast<uint>(features);
+   }
+
+} // namespace lzham
+
 #if LZHAM_BUFFERED_PRINTF
 // This stuff was a quick hack only intended for debugging/development.
 namespace lzham
@@ -21,6 +21,16 @@ void lzham_fail(const char* pExp, const char* pFile, unsigned line);
    #define LZHAM_BUILTIN_EXPECT(c, v) c
 #endif
 
+#if LZHAM_USE_X86_SIMD_INTRINSICS && defined(__GNUC__)
+   #define LZHAM_TARGET_SSE2 __attribute__((target("sse2")))
+   #define LZHAM_TARGET_AVX2 __attribute__((target("avx2")))
+   #define LZHAM_TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+   #define LZHAM_TARGET_SSE2
+   #define LZHAM_TARGET_AVX2
+   #define LZHAM_TARGET_BMI2
+#endif
+
 #if defined(__GNUC__) && LZHAM_PLATFORM_PC
 extern __inline__ __attribute__((__always_inline__,__gnu_inline__)) void lzham_yield_processor()
 {
@@ -80,23 +90,28 @@ LZHAM_FORCE_INLINE void lzham_yield_processor()
    #define LZHAM_MEMORY_IMPORT_BARRIER
 #endif
 
-// Note: It's very important that LZHAM_READ_BIG_ENDIAN_UINT32() is fast on the target platform.
-// This is used to read every DWORD from the input stream.
+// Note: It's very important that LZHAM_READ_BIG_ENDIAN_UINT32() (and LZHAM_READ_BIG_ENDIAN_UINT64() on 64-bit CPU's) is fast on the target platform.
+// This is used to read every DWORD (or QWORD) from the input stream.
 
 #if LZHAM_USE_UNALIGNED_INT_LOADS
    #if LZHAM_BIG_ENDIAN_CPU
       #define LZHAM_READ_BIG_ENDIAN_UINT32(p) *reinterpret_cast<const uint32*>(p)
+      #define LZHAM_READ_BIG_ENDIAN_UINT64(p) *reinterpret_cast<const uint64*>(p)
    #else
       #if defined(LZHAM_USE_MSVC_INTRINSICS)
          #define LZHAM_READ_BIG_ENDIAN_UINT32(p) _byteswap_ulong(*reinterpret_cast<const uint32*>(p))
+         #define LZHAM_READ_BIG_ENDIAN_UINT64(p) _byteswap_uint64(*reinterpret_cast<const uint64*>(p))
       #elif defined(__GNUC__)
          #define LZHAM_READ_BIG_ENDIAN_UINT32(p) __builtin_bswap32(*reinterpret_cast<const uint32*>(p))
+         #define LZHAM_READ_BIG_ENDIAN_UINT64(p) __builtin_bswap64(*reinterpret_cast<const uint64*>(p))
       #else
          #define LZHAM_READ_BIG_ENDIAN_UINT32(p) utils::swap32(*reinterpret_cast<const uint32*>(p))
+         #define LZHAM_READ_BIG_ENDIAN_UINT64(p) utils::swap64(*reinterpret_cast<const uint64*>(p))
       #endif
    #endif
 #else
    #define LZHAM_READ_BIG_ENDIAN_UINT32(p) ((reinterpret_cast<const uint8*>(p)[0] << 24) | (reinterpret_cast<const uint8*>(p)[1] << 16) | (reinterpret_cast<const uint8*>(p)[2] << 8) | (reinterpret_cast<const uint8*>(p)[3]))
+   #define LZHAM_READ_BIG_ENDIAN_UINT64(p) ((static_cast<uint64>(static_cast<uint32>(LZHAM_READ_BIG_ENDIAN_UINT32(p))) << 32U) | static_cast<uint32>(LZHAM_READ_BIG_ENDIAN_UINT32(reinterpret_cast<const uint8*>(p) + 4)))
 #endif
 
 #if LZHAM_USE_WIN32_ATOMIC_FUNCTIONS
@@ -273,6 +288,16 @@ namespace lzham
 
 #endif
 
+   enum cpu_feature_flags
+   {
+      cCPUFeatureSSE2 = 1,
+      cCPUFeatureAVX2 = 2,
+      cCPUFeatureBMI2 = 4
+   };
+
+   // Returns the cpu_feature_flags supported by both the CPU and the OS. Always 0 on non-x86 platforms.
+   uint lzham_get_cpu_features();
+
 #if LZHAM_BUFFERED_PRINTF
    void lzham_buffered_printf(const char *format, ...);
    void lzham_flush_buffered_printf();
@@ -698,7 +698,8 @@ namespace lzham
 
       m_output_buf.try_resize(0);
       m_arith_output_buf.try_resize(0);
-      m_output_syms.try_resize(0);
+      m_arith_byte_bit_ofs.try_resize(0);
+      m_arith_bytes_pending = 0;
 
       m_pDecode_need_bytes_func = NULL;
       m_pDecode_private_data = NULL;
@@ -713,7 +714,7 @@ namespace lzham
 
       m_output_buf.clear();
       m_arith_output_buf.clear();
-      m_output_syms.clear();
+      m_arith_byte_bit_ofs.clear();
    }
 
    bool symbol_codec::start_encoding(uint expected_file_size)
@@ -726,7 +727,8 @@ namespace lzham
       if (!put_bits_init(expected_file_size))
          return false;
 
-      m_output_syms.try_resize(0);
+      m_arith_byte_bit_ofs.try_resize(0);
+      m_arith_bytes_pending = 0;
 
       arith_start_encoding();
 
@@ -744,14 +746,14 @@ namespace lzham
 
       if (num_bits > 16)
       {
-         if (!record_put_bits(bits >> 16, num_bits - 16))
+         if (!put_bits(bits >> 16, num_bits - 16))
             return false;
-         if (!record_put_bits(bits & 0xFFFF, 16))
+         if (!put_bits(bits & 0xFFFF, 16))
             return false;
       }
       else
       {
-         if (!record_put_bits(bits, num_bits))
+         if (!put_bits(bits, num_bits))
             return false;
       }
       return true;
@@ -760,28 +762,31 @@ namespace lzham
    bool symbol_codec::encode_arith_init()
    {
       LZHAM_ASSERT(m_mode == cEncoding);
+      LZHAM_ASSERT(m_arith_byte_bit_ofs.empty());
 
-      output_symbol sym;
-      sym.m_bits = 0;
-      sym.m_num_bits = output_symbol::cArithInit;
-      sym.m_arith_prob0 = 0;
-      if (!m_output_syms.try_push_back(sym))
-         return false;
-
-      return true;
+      // The decoder starts by reading the first 4 bytes.
+      return put_arith_byte_holes(4);
    }
 
    bool symbol_codec::encode_align_to_byte()
    {
       LZHAM_ASSERT(m_mode == cEncoding);
 
-      output_symbol sym;
-      sym.m_bits = 0;
-      sym.m_num_bits = output_symbol::cAlignToByteSym;
-      sym.m_arith_prob0 = 0;
-      if (!m_output_syms.try_push_back(sym))
+      return put_bits_align_to_byte();
+   }
+
+   bool symbol_codec::encode_aligned_bytes(const uint8* pBytes, uint num_bytes)
+   {
+      LZHAM_ASSERT(m_mode == cEncoding);
+
+      // Aligned, so put_bits() has already moved every bit to the output buffer.
+      LZHAM_ASSERT(m_bit_count == cBitBufSize);
+
+      if (!m_output_buf.append(pBytes, num_bytes))
          return false;
 
+      m_total_bits_written += num_bytes * 8;
+
       return true;
    }
 
@@ -790,7 +795,7 @@ namespace lzham
       LZHAM_ASSERT(m_mode == cEncoding);
       LZHAM_ASSERT(model.m_encoding);
 
-      if (!record_put_bits(model.m_codes[sym], model.m_code_sizes[sym]))
+      if (!put_bits(model.m_codes[sym], model.m_code_sizes[sym]))
          return false;
 
       uint freq = model.m_sym_freq[sym];
@@ -833,7 +838,7 @@ namespace lzham
       {
          if (!m_arith_output_buf.try_push_back((m_arith_base >> 24) & 0xFF))
             return false;
-         m_total_bits_written += 8;
+         m_arith_bytes_pending++;
 
          m_arith_base <<= 8;
       } while ((m_arith_length <<= 8) < cSymbolCodecArithMinLen);
@@ -856,12 +861,12 @@ namespace lzham
 
       m_arith_total_bits++;
 
-      output_symbol sym;
-      sym.m_bits = bit;
-      sym.m_num_bits = -1;
-      sym.m_arith_prob0 = model.m_bit_0_prob;
-      if (!m_output_syms.try_push_back(sym))
-         return false;
+      if (m_arith_bytes_pending)
+      {
+         if (!put_arith_byte_holes(m_arith_bytes_pending))
+            return false;
+         m_arith_bytes_pending = 0;
+      }
 
       uint x = model.m_bit_0_prob * (m_arith_length >> cSymbolCodecArithProbBits);
 
@@ -937,7 +942,6 @@ namespace lzham
       {
          if (!m_arith_output_buf.try_push_back(0))
             return false;
-         m_total_bits_written += 8;
       }
       return true;
    }
@@ -952,32 +956,12 @@ namespace lzham
             return false;
       }
 
-      if (!assemble_output_buf())
+      if (!flush_bits())
          return false;
 
-      m_mode = cNull;
-      return true;
-   }
-
-   bool symbol_codec::record_put_bits(uint bits, uint num_bits)
-   {
-      LZHAM_ASSERT(m_mode == cEncoding);
-
-      LZHAM_ASSERT(num_bits <= 25);
-      LZHAM_ASSERT(m_bit_count >= 25);
-
-      if (!num_bits)
-         return true;
-
-      m_total_bits_written += num_bits;
-
-      output_symbol sym;
-      sym.m_bits = bits;
-      sym.m_num_bits = (uint16)num_bits;
-      sym.m_arith_prob0 = 0;
-      if (!m_output_syms.try_push_back(sym))
-         return false;
+      fill_arith_byte_holes();
 
+      m_mode = cNull;
       return true;
    }
 
@@ -1034,78 +1018,35 @@ namespace lzham
       return put_bits(0, 7); // to ensure the last bits are flushed
    }
 
-   bool symbol_codec::assemble_output_buf()
+   bool symbol_codec::put_arith_byte_holes(uint num_bytes)
    {
-      m_total_bits_written = 0;
-
-      uint arith_buf_ofs = 0;
-
-      // Intermix the final Arithmetic, Huffman, or plain bits to a single combined bitstream.
-      // All bits from each source must be output in exactly the same order that the decompressor will read them.
-      for (uint sym_index = 0; sym_index < m_output_syms.size(); sym_index++)
+      for (uint i = 0; i < num_bytes; i++)
       {
-         const output_symbol& sym = m_output_syms[sym_index];
-
-         if (sym.m_num_bits == output_symbol::cAlignToByteSym)
-         {
-            if (!put_bits_align_to_byte())
-               return false;
-         }
-         else if (sym.m_num_bits == output_symbol::cArithInit)
-         {
-            LZHAM_ASSERT(m_arith_output_buf.size());
+         const uint bit_ofs = m_output_buf.size() * 8 + (cBitBufSize - m_bit_count);
+         if (!m_arith_byte_bit_ofs.try_push_back(bit_ofs))
+            return false;
 
-            if (m_arith_output_buf.size())
-            {
-               m_arith_length = cSymbolCodecArithMaxLen;
-               m_arith_value = 0;
-               for (uint i = 0; i < 4; i++)
-               {
-                  const uint c = m_arith_output_buf[arith_buf_ofs++];
-                  m_arith_value = (m_arith_value << 8) | c;
-                  if (!put_bits(c, 8))
-                     return false;
-               }
-            }
-         }
-         else if (sym.m_num_bits == output_symbol::cArithSym)
-         {
-            // This renorm logic must match the logic used in the arithmetic decoder.
-            if (m_arith_length < cSymbolCodecArithMinLen)
-            {
-               do
-               {
-                  const uint c = (arith_buf_ofs < m_arith_output_buf.size()) ? m_arith_output_buf[arith_buf_ofs++] : 0;
-                  if (!put_bits(c, 8))
-                     return false;
-                  m_arith_value = (m_arith_value << 8) | c;
-               } while ((m_arith_length <<= 8) < cSymbolCodecArithMinLen);
-            }
+         if (!put_bits(0, 8))
+            return false;
+      }
+      return true;
+   }
 
-            uint x = sym.m_arith_prob0 * (m_arith_length >> cSymbolCodecArithProbBits);
-            uint bit = (m_arith_value >= x);
+   // Must be called after flush_bits(), so every hole is in m_output_buf.
+   void symbol_codec::fill_arith_byte_holes()
+   {
+      for (uint i = 0; i < m_arith_byte_bit_ofs.size(); i++)
+      {
+         const uint c = (i < m_arith_output_buf.size()) ? m_arith_output_buf[i] : 0;
 
-            if (bit == 0)
-            {
-               m_arith_length = x;
-            }
-            else
-            {
-               m_arith_value  -= x;
-               m_arith_length -= x;
-            }
+         const uint bit_ofs = m_arith_byte_bit_ofs[i];
+         const uint shift = bit_ofs & 7;
+         uint8* pDst = &m_output_buf[bit_ofs >> 3];
 
-            LZHAM_VERIFY(bit == sym.m_bits);
-         }
-         else
-         {
-            // Huffman or plain bits
-            if (!put_bits(sym.m_bits, sym.m_num_bits))
-               return false;
-         }
+         pDst[0] |= static_cast<uint8>(c >> shift);
+         if (shift)
+            pDst[1] |= static_cast<uint8>(c << (8 - shift));
       }
-
-      return flush_bits();
    }
 
    //------------------------------------------------------------------------------------------------------------------
@@ -1175,6 +1116,8 @@ namespace lzham
       if (!num_bits)
          return 0;
 
+      decode_try_refill_8_bytes(num_bits);
+
       while (m_bit_count < (int)num_bits)
       {
          uint c = 0;
@@ -1207,6 +1150,8 @@ namespace lzham
 
       const prefix_coding::decoder_tables* pTables = model.m_pDecode_tables;
 
+      decode_try_refill_8_bytes(cBitBufSize - 8);
+
       while (m_bit_count < (cBitBufSize - 8))
       {
          uint c = 0;
@@ -1281,10 +1226,28 @@ namespace lzham
       return sym;
    }
 
+   void symbol_codec::decode_unread_bit_buf_bytes()
+   {
+      // Past the end of the final buffer the bit buffer is padded with zeros, which don't map back to any input bytes.
+      if ((m_decode_buf_eof) && (m_pDecode_buf_next == m_pDecode_buf_end))
+         return;
+
+      // Only bytes from the current buffer can be put back, any older ones stay in the bit buffer.
+      const uint n = static_cast<uint>(LZHAM_MIN(static_cast<uint64>(m_bit_count >> 3), static_cast<uint64>(m_pDecode_buf_next - m_pDecode_buf)));
+      if (!n)
+         return;
+
+      m_pDecode_buf_next -= n;
+      m_bit_count -= n << 3;
+      m_bit_buf = m_bit_count ? ((m_bit_buf >> (cBitBufSize - m_bit_count)) << (cBitBufSize - m_bit_count)) : 0;
+   }
+
    uint64 symbol_codec::stop_decoding()
    {
       LZHAM_ASSERT(m_mode == cDecoding);
 
+      decode_unread_bit_buf_bytes();
+
       uint64 n = m_pDecode_buf_next - m_pDecode_buf;
 
       m_mode = cNull;
@@ -1299,6 +1262,8 @@ namespace lzham
       if (!num_bits)
          return 0;
 
+      decode_try_refill_8_bytes(num_bits);
+
       while (m_bit_count < (int)num_bits)
       {
          uint c = 0;
@@ -1336,6 +1301,8 @@ namespace lzham
       if (!num_bits)
          return;
 
+      decode_try_refill_8_bytes(num_bits);
+
       while (m_bit_count < (int)num_bits)
       {
          uint c = 0;
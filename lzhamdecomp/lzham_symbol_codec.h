@@ -154,6 +154,18 @@ namespace lzham
    #define LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER 0
 #endif
 
+#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+   // Tops a 64-bit bit buffer up to at least 56 bits with one 8 byte load from pNext, which must have 8 readable bytes. Needs bit_count < 56.
+   // Only whole bytes are taken (and pNext advanced past them), so the bits below bit_count stay zero like with the byte at a time refills.
+   #define LZHAM_SYMBOL_CODEC_REFILL_8_BYTES(bit_buf, bit_count, pNext) \
+   { \
+      uint num_refill_bytes = (63 - (bit_count)) >> 3; \
+      (bit_count) += num_refill_bytes << 3; \
+      (bit_buf) |= (LZHAM_READ_BIG_ENDIAN_UINT64(pNext) >> (64 - (num_refill_bytes << 3))) << (64 - (bit_count)); \
+      (pNext) += num_refill_bytes; \
+   }
+#endif
+
    class symbol_codec
    {
    public:
@@ -169,6 +181,8 @@ namespace lzham
       bool encode_bits(uint bits, uint num_bits);
       bool encode_arith_init();
       bool encode_align_to_byte();
+      // Copies num_bytes bytes to the output as is. Must follow encode_align_to_byte().
+      bool encode_aligned_bytes(const uint8* pBytes, uint num_bytes);
       bool encode(uint sym, quasi_adaptive_huffman_data_model& model);
       bool encode(uint bit, adaptive_bit_model& model, bool update_model = true);
       bool encode(uint sym, adaptive_arith_data_model& model);
@@ -198,11 +212,24 @@ namespace lzham
       inline uint64 decode_get_bits_remaining() const { return ((m_pDecode_buf_end - m_pDecode_buf_next) << 3) + m_bit_count; }
 
       void start_arith_decoding();
+      // Loads 8 input bytes at once if the bit buffer is 64 bits and has fewer than min_bits, and at least 8 bytes are left in the decode buffer.
+      inline void decode_try_refill_8_bytes(uint min_bits)
+      {
+#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+         if ((m_bit_count < static_cast<int>(min_bits)) && ((m_pDecode_buf_end - m_pDecode_buf_next) >= 8))
+            LZHAM_SYMBOL_CODEC_REFILL_8_BYTES(m_bit_buf, m_bit_count, m_pDecode_buf_next)
+#else
+         LZHAM_NOTE_UNUSED(min_bits);
+#endif
+      }
       uint decode_bits(uint num_bits);
       uint decode_peek_bits(uint num_bits);
       void decode_remove_bits(uint num_bits);
       void decode_align_to_byte();
       int decode_remove_byte_from_bit_buf();
+      // Puts the whole bytes held in the bit buffer back into the decode buffer (as far as it goes back), so decode_get_bytes_consumed() doesn't count
+      // bytes a refill loaded ahead. Call before telling the caller how much input was consumed when it may move the input along.
+      void decode_unread_bit_buf_bytes();
       uint decode(quasi_adaptive_huffman_data_model& model);
       uint decode(adaptive_bit_model& model, bool update_model = true);
       uint decode(adaptive_arith_data_model& model);
@@ -236,21 +263,14 @@ namespace lzham
       lzham::vector<uint8>    m_output_buf;
       lzham::vector<uint8>    m_arith_output_buf;
 
-      struct output_symbol
-      {
-         uint m_bits;
-
-         enum
-         {
-            cArithSym = -1,
-            cAlignToByteSym = -2,
-            cArithInit = -3
-         };
-         int16 m_num_bits;
+      // Everything but the arithmetic coder's output goes straight to m_output_buf. The decoder reads arithmetic coded bytes from the same
+      // bitstream, so the encoder leaves an 8-bit hole at each point it will, and fills them in once the arithmetic coder's output (which
+      // carries can still change) is final. m_arith_byte_bit_ofs[i] is the bit offset of the hole for m_arith_output_buf[i].
+      lzham::vector<uint>     m_arith_byte_bit_ofs;
 
-         uint16 m_arith_prob0;
-      };
-      lzham::vector<output_symbol> m_output_syms;
+      // The decoder renormalizes right before it decodes a bit, and the encoder right after, so the bytes the encoder shifted out of its
+      // interval are read at the next arithmetic coded bit.
+      uint                    m_arith_bytes_pending;
 
       uint                    m_total_bits_written;
 
@@ -264,7 +284,8 @@ namespace lzham
       uint                    m_saved_node_index;
 
       bool put_bits_init(uint expected_size);
-      bool record_put_bits(uint bits, uint num_bits);
+      bool put_arith_byte_holes(uint num_bytes);
+      void fill_arith_byte_holes();
 
       void arith_propagate_carry();
       bool arith_renorm_enc_interval();
@@ -274,7 +295,6 @@ namespace lzham
       bool put_bits(uint bits, uint num_bits);
       bool put_bits_align_to_byte();
       bool flush_bits();
-      bool assemble_output_buf();
 
       uint get_bits(uint num_bits);
       void remove_bits(uint num_bits);
@@ -317,8 +337,22 @@ namespace lzham
 
 // The user must declare the LZHAM_DECODE_NEEDS_BYTES macro.
 
+// With a 64-bit bit buffer, takes 8 input bytes at once while at least that many are left in the decode buffer, so the byte at a time
+// refills (and their end of buffer checks) only run near the end of each input buffer.
+#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+#define LZHAM_SYMBOL_CODEC_DECODE_TRY_REFILL_8_BYTES(codec) \
+{ \
+   if (LZHAM_BUILTIN_EXPECT((codec.m_pDecode_buf_end - pDecode_buf_next) >= 8, 1)) \
+      LZHAM_SYMBOL_CODEC_REFILL_8_BYTES(bit_buf, bit_count, pDecode_buf_next) \
+}
+#else
+#define LZHAM_SYMBOL_CODEC_DECODE_TRY_REFILL_8_BYTES(codec) { }
+#endif
+
 #define LZHAM_SYMBOL_CODEC_DECODE_GET_BITS(codec, result, num_bits) \
 { \
+   if (LZHAM_BUILTIN_EXPECT(bit_count < (int)(num_bits), 0)) \
+      LZHAM_SYMBOL_CODEC_DECODE_TRY_REFILL_8_BYTES(codec) \
    while (LZHAM_BUILTIN_EXPECT(bit_count < (int)(num_bits), 0)) \
    { \
       uint r; \
@@ -405,40 +439,9 @@ namespace lzham
    result = node_index - pArith_data_model->m_total_syms; \
 }
 
-#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
-#define LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN(codec, result, model) \
+// Decodes a symbol from the top of the bit buffer, which must hold at least 16 bits, and updates the model's frequencies.
+#define LZHAM_SYMBOL_CODEC_DECODE_HUFFMAN_LOOKUP(result, pModel, pTables) \
 { \
-   quasi_adaptive_huffman_data_model* pModel; const prefix_coding::decoder_tables* pTables; \
-   pModel = &model; pTables = model.m_pDecode_tables; \
-   if (LZHAM_BUILTIN_EXPECT(bit_count < 24, 0)) \
-   { \
-      uint c; \
-      pDecode_buf_next += sizeof(uint32); \
-      if (LZHAM_BUILTIN_EXPECT(pDecode_buf_next >= codec.m_pDecode_buf_end, 0)) \
-      { \
-         pDecode_buf_next -= sizeof(uint32); \
-         while (bit_count < 24) \
-         { \
-            if (!codec.m_decode_buf_eof) \
-            { \
-               codec.m_pSaved_huff_model = pModel; \
-               LZHAM_SYMBOL_CODEC_DECODE_END(codec) \
-               LZHAM_DECODE_NEEDS_BYTES \
-               LZHAM_SYMBOL_CODEC_DECODE_BEGIN(codec) \
-               pModel = codec.m_pSaved_huff_model; pTables = pModel->m_pDecode_tables; \
-            } \
-            c = 0; if (pDecode_buf_next < codec.m_pDecode_buf_end) c = *pDecode_buf_next++; \
-            bit_count += 8; \
-            bit_buf |= (static_cast<symbol_codec::bit_buf_t>(c) << (symbol_codec::cBitBufSize - bit_count)); \
-         } \
-      } \
-      else \
-      { \
-         c = LZHAM_READ_BIG_ENDIAN_UINT32(pDecode_buf_next - sizeof(uint32)); \
-         bit_count += 32; \
-         bit_buf |= (static_cast<symbol_codec::bit_buf_t>(c) << (symbol_codec::cBitBufSize - bit_count)); \
-      } \
-   } \
    uint k = static_cast<uint>((bit_buf >> (symbol_codec::cBitBufSize - 16)) + 1); \
    uint len; \
    if (LZHAM_BUILTIN_EXPECT(k <= pTables->m_table_max_code, 1)) \
@@ -457,7 +460,7 @@ namespace lzham
          len++; \
       } \
       int val_ptr = pTables->m_val_ptrs[len - 1] + static_cast<int>(bit_buf >> (symbol_codec::cBitBufSize - len)); \
-      if (((uint)val_ptr >= pModel->m_total_syms)) val_ptr = 0; \
+      if (LZHAM_BUILTIN_EXPECT(((uint)val_ptr >= pModel->m_total_syms), 0)) val_ptr = 0; \
       result = pTables->m_sorted_symbol_order[val_ptr]; \
    }  \
    bit_buf <<= len; \
@@ -471,6 +474,38 @@ namespace lzham
       pModel->update(); \
    } \
 }
+
+#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+#define LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN(codec, result, model) \
+{ \
+   quasi_adaptive_huffman_data_model* pModel; const prefix_coding::decoder_tables* pTables; \
+   pModel = &model; pTables = model.m_pDecode_tables; \
+   if (LZHAM_BUILTIN_EXPECT(bit_count < 24, 0)) \
+   { \
+      LZHAM_SYMBOL_CODEC_DECODE_TRY_REFILL_8_BYTES(codec) \
+      while (LZHAM_BUILTIN_EXPECT(bit_count < 24, 0)) \
+      { \
+         uint c; \
+         if (pDecode_buf_next == codec.m_pDecode_buf_end) \
+         { \
+            if (!codec.m_decode_buf_eof) \
+            { \
+               codec.m_pSaved_huff_model = pModel; \
+               LZHAM_SYMBOL_CODEC_DECODE_END(codec) \
+               LZHAM_DECODE_NEEDS_BYTES \
+               LZHAM_SYMBOL_CODEC_DECODE_BEGIN(codec) \
+               pModel = codec.m_pSaved_huff_model; pTables = pModel->m_pDecode_tables; \
+            } \
+            c = 0; if (pDecode_buf_next < codec.m_pDecode_buf_end) c = *pDecode_buf_next++; \
+         } \
+         else \
+            c = *pDecode_buf_next++; \
+         bit_count += 8; \
+         bit_buf |= (static_cast<symbol_codec::bit_buf_t>(c) << (symbol_codec::cBitBufSize - bit_count)); \
+      } \
+   } \
+   LZHAM_SYMBOL_CODEC_DECODE_HUFFMAN_LOOKUP(result, pModel, pTables) \
+}
 #else
 #define LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN(codec, result, model) \
 { \
@@ -496,39 +531,72 @@ namespace lzham
       bit_count += 8; \
       bit_buf |= (static_cast<symbol_codec::bit_buf_t>(c) << (symbol_codec::cBitBufSize - bit_count)); \
    } \
-   uint k = static_cast<uint>((bit_buf >> (symbol_codec::cBitBufSize - 16)) + 1); \
-   uint len; \
-   if (LZHAM_BUILTIN_EXPECT(k <= pTables->m_table_max_code, 1)) \
+   LZHAM_SYMBOL_CODEC_DECODE_HUFFMAN_LOOKUP(result, pModel, pTables) \
+}
+#endif
+
+// Unchecked variants of the macros above. They never look at the end of the decode buffer or invoke LZHAM_DECODE_NEEDS_BYTES, so the
+// caller must know there's enough input left for everything it decodes with them, plus cSymbolCodecDecodeFastMaxOverread bytes.
+// At most 24 bits can be taken at once.
+const uint cSymbolCodecDecodeFastMaxOverread = 8;
+
+#if LZHAM_SYMBOL_CODEC_USE_64_BIT_BUFFER
+// Needs bit_count < 56. Leaves at least 56 bits in the bit buffer.
+#define LZHAM_SYMBOL_CODEC_DECODE_FAST_REFILL(codec) LZHAM_SYMBOL_CODEC_REFILL_8_BYTES(bit_buf, bit_count, pDecode_buf_next)
+#else
+// Leaves at least 25 bits in the bit buffer.
+#define LZHAM_SYMBOL_CODEC_DECODE_FAST_REFILL(codec) \
+{ \
+   do \
    { \
-      uint32 t = pTables->m_lookup[bit_buf >> (symbol_codec::cBitBufSize - pTables->m_table_bits)]; \
-      result = t & UINT16_MAX; \
-      len = t >> 16; \
+      bit_count += 8; \
+      bit_buf |= (static_cast<symbol_codec::bit_buf_t>(*pDecode_buf_next++) << (symbol_codec::cBitBufSize - bit_count)); \
+   } while (bit_count <= (symbol_codec::cBitBufSize - 8)); \
+}
+#endif
+
+#define LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, result, num_bits) \
+{ \
+   if (LZHAM_BUILTIN_EXPECT(bit_count < (int)(num_bits), 0)) \
+      LZHAM_SYMBOL_CODEC_DECODE_FAST_REFILL(codec) \
+   result = (num_bits) ? static_cast<uint>(bit_buf >> (symbol_codec::cBitBufSize - (num_bits))) : 0; \
+   bit_buf <<= (num_bits); \
+   bit_count -= (num_bits); \
+}
+
+#define LZHAM_SYMBOL_CODEC_DECODE_ARITH_BIT_FAST(codec, result, model) \
+{ \
+   adaptive_bit_model *pModel; \
+   pModel = &model; \
+   while (LZHAM_BUILTIN_EXPECT(arith_length < cSymbolCodecArithMinLen, 0)) \
+   { \
+      uint c; LZHAM_SYMBOL_CODEC_DECODE_GET_BITS_FAST(codec, c, 8); \
+      arith_value = (arith_value << 8) | c; \
+      arith_length <<= 8; \
    } \
-   else \
+   uint x = pModel->m_bit_0_prob * (arith_length >> cSymbolCodecArithProbBits); \
+   result = (arith_value >= x); \
+   if (!result) \
    { \
-      len = pTables->m_decode_start_code_size; \
-      for ( ; ; ) \
-      { \
-         if (LZHAM_BUILTIN_EXPECT(k <= pTables->m_max_codes[len - 1], 0)) \
-            break; \
-         len++; \
-      } \
-      int val_ptr = pTables->m_val_ptrs[len - 1] + static_cast<int>(bit_buf >> (symbol_codec::cBitBufSize - len)); \
-      if (LZHAM_BUILTIN_EXPECT(((uint)val_ptr >= pModel->m_total_syms), 0)) val_ptr = 0; \
-      result = pTables->m_sorted_symbol_order[val_ptr]; \
-   }  \
-   bit_buf <<= len; \
-   bit_count -= len; \
-   uint freq = pModel->m_sym_freq[result]; \
-   freq++; \
-   pModel->m_sym_freq[result] = static_cast<uint16>(freq); \
-   LZHAM_ASSERT(freq <= UINT16_MAX); \
-   if (LZHAM_BUILTIN_EXPECT(--pModel->m_symbols_until_update == 0, 0)) \
+      pModel->m_bit_0_prob += ((cSymbolCodecArithProbScale - pModel->m_bit_0_prob) >> cSymbolCodecArithProbMoveBits); \
+      arith_length = x; \
+   } \
+   else \
    { \
-      pModel->update(); \
+      pModel->m_bit_0_prob -= (pModel->m_bit_0_prob >> cSymbolCodecArithProbMoveBits); \
+      arith_value  -= x; \
+      arith_length -= x; \
    } \
 }
-#endif
+
+#define LZHAM_SYMBOL_CODEC_DECODE_ADAPTIVE_HUFFMAN_FAST(codec, result, model) \
+{ \
+   quasi_adaptive_huffman_data_model* pModel; const prefix_coding::decoder_tables* pTables; \
+   pModel = &model; pTables = model.m_pDecode_tables; \
+   if (LZHAM_BUILTIN_EXPECT(bit_count < 24, 0)) \
+      LZHAM_SYMBOL_CODEC_DECODE_FAST_REFILL(codec) \
+   LZHAM_SYMBOL_CODEC_DECODE_HUFFMAN_LOOKUP(result, pModel, pTables) \
+}
 
 #define LZHAM_SYMBOL_CODEC_DECODE_ALIGN_TO_BYTE(codec) if (bit_count & 7) { int dummy_result; LZHAM_NOTE_UNUSED(dummy_result); LZHAM_SYMBOL_CODEC_DECODE_GET_BITS(codec, dummy_result, bit_count & 7); }
 
@@ -22,6 +22,18 @@ namespace lzham
       {
          QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(pTicks));
       }
+   #elif defined(CLOCK_MONOTONIC)
+      // clock() measures CPU time, which doesn't advance while a thread is blocked.
+      inline void query_counter(timer_ticks *pTicks)
+      {
+         struct timespec ts;
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+         *pTicks = static_cast<timer_ticks>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+      }
+      inline void query_counter_frequency(timer_ticks *pTicks)
+      {
+         *pTicks = 1000000000ULL;
+      }
    #else
       inline void query_counter(timer_ticks *pTicks)
       {
@@ -27,6 +27,7 @@ namespace lzham
       }
                   
       static inline uint32 swap32(uint32 x) { return ((x << 24U) | ((x << 8U) & 0x00FF0000U) | ((x >> 8U) & 0x0000FF00U) | (x >> 24U)); }
+      static inline uint64 swap64(uint64 x) { return (static_cast<uint64>(swap32(static_cast<uint32>(x))) << 32U) | swap32(static_cast<uint32>(x >> 32U)); }
       
       inline uint count_leading_zeros16(uint v)
       {
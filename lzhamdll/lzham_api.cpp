@@ -24,6 +24,11 @@ extern "C" LZHAM_DLL_EXPORT lzham_decompress_state_ptr lzham_decompress_reinit(l
    return lzham::lzham_lib_decompress_reinit(p, pParams);
 }
 
+extern "C" LZHAM_DLL_EXPORT lzham_decompress_state_ptr lzham_decompress_clone(lzham_decompress_state_ptr p)
+{
+   return lzham::lzham_lib_decompress_clone(p);
+}
+
 extern "C" LZHAM_DLL_EXPORT lzham_uint32 lzham_decompress_deinit(lzham_decompress_state_ptr p)
 {
    return lzham::lzham_lib_decompress_deinit(p);
@@ -53,11 +58,26 @@ extern "C" LZHAM_DLL_EXPORT lzham_compress_state_ptr lzham_compress_reinit(lzham
    return lzham::lzham_lib_compress_reinit(p);
 }
 
+extern "C" LZHAM_DLL_EXPORT lzham_compress_state_ptr lzham_compress_clone(lzham_compress_state_ptr p)
+{
+   return lzham::lzham_lib_compress_clone(p);
+}
+
 extern "C" LZHAM_DLL_EXPORT lzham_uint32 lzham_compress_deinit(lzham_compress_state_ptr p)
 {
    return lzham::lzham_lib_compress_deinit(p);
 }
 
+extern "C" LZHAM_DLL_EXPORT lzham_compress_dict_ptr lzham_compress_dict_init(const lzham_compress_params *pParams)
+{
+   return lzham::lzham_lib_compress_dict_init(pParams);
+}
+
+extern "C" LZHAM_DLL_EXPORT void lzham_compress_dict_deinit(lzham_compress_dict_ptr p)
+{
+   lzham::lzham_lib_compress_dict_deinit(p);
+}
+
 extern "C" LZHAM_DLL_EXPORT lzham_compress_status_t lzham_compress(
    lzham_compress_state_ptr p,
    const lzham_uint8 *pIn_buf, size_t *pIn_buf_size, 
@@ -24,6 +24,11 @@ extern "C" lzham_decompress_state_ptr LZHAM_CDECL lzham_decompress_reinit(lzham_
    return lzham::lzham_lib_decompress_reinit(p, pParams);
 }
 
+extern "C" lzham_decompress_state_ptr LZHAM_CDECL lzham_decompress_clone(lzham_decompress_state_ptr p)
+{
+   return lzham::lzham_lib_decompress_clone(p);
+}
+
 extern "C" lzham_uint32 LZHAM_CDECL lzham_decompress_deinit(lzham_decompress_state_ptr p)
 {
    return lzham::lzham_lib_decompress_deinit(p);
@@ -53,11 +58,26 @@ extern "C" lzham_compress_state_ptr LZHAM_CDECL lzham_compress_reinit(lzham_comp
    return lzham::lzham_lib_compress_reinit(p);
 }
 
+extern "C" lzham_compress_state_ptr LZHAM_CDECL lzham_compress_clone(lzham_compress_state_ptr p)
+{
+   return lzham::lzham_lib_compress_clone(p);
+}
+
 extern "C" lzham_uint32 LZHAM_CDECL lzham_compress_deinit(lzham_compress_state_ptr p)
 {
    return lzham::lzham_lib_compress_deinit(p);
 }
 
+extern "C" lzham_compress_dict_ptr LZHAM_CDECL lzham_compress_dict_init(const lzham_compress_params *pParams)
+{
+   return lzham::lzham_lib_compress_dict_init(pParams);
+}
+
+extern "C" void LZHAM_CDECL lzham_compress_dict_deinit(lzham_compress_dict_ptr p)
+{
+   lzham::lzham_lib_compress_dict_deinit(p);
+}
+
 extern "C" lzham_compress_status_t LZHAM_CDECL lzham_compress(
    lzham_compress_state_ptr p,
    const lzham_uint8 *pIn_buf, size_t *pIn_buf_size, 
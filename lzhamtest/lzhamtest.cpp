@@ -96,6 +96,9 @@ typedef unsigned int uint32;
    #define LZHAMTEST_DECOMP_OUTPUT_BUFFER_SIZE 1
 #endif
 
+// Output ring decompression (--ring) asks for between 1 and this many bytes per call.
+#define LZHAMTEST_DECOMP_RING_MAX_CHUNK_SIZE 4096
+
 #define LZHAMTEST_NO_RANDOM_EXTREME_PARSING 1
 
 struct comp_options
@@ -112,7 +115,26 @@ struct comp_options
       m_extreme_parsing(false),
       m_deterministic_parsing(false),
       m_tradeoff_decomp_rate_for_comp_ratio(false),
-      m_test_compressor_reinit(false)
+      m_long_range_matching(false),
+      m_speculative_parsing(false),
+      m_large_pages(false),
+      m_numa_node(-1),
+      m_test_compressor_reinit(false),
+      m_match_hash_bits(0),
+      m_match_hash_bytes(0),
+      m_max_parse_threads(0),
+      m_parse_graph_size(0),
+      m_match_finder(LZHAM_MATCH_FINDER_DEFAULT),
+      m_prepare_seed_dict(false),
+      m_test_clone(false),
+      m_independent_segments(false),
+      m_segment_size_log2(0),
+      m_segment_prime_size(0),
+      m_target_comp_kb_per_sec(0),
+      m_mirrored_dict(false),
+      m_output_ring(false),
+      m_output_ring_slack(0),
+      m_full_flush(false)
    {
    }
 
@@ -129,7 +151,26 @@ struct comp_options
       printf("Randomize parameters: %u\n", m_randomize_params);
       printf("Deterministic parsing: %u\n", m_deterministic_parsing);
       printf("Trade off decompression rate for compression ratio: %u\n", m_tradeoff_decomp_rate_for_comp_ratio);
+      printf("Long range matching: %u\n", m_long_range_matching);
+      printf("Speculative parsing: %u\n", m_speculative_parsing);
+      printf("Large pages: %u\n", m_large_pages);
+      printf("NUMA node: %i\n", m_numa_node);
       printf("Test compressor reinit: %u\n", m_test_compressor_reinit);
+      printf("Match hash bits: %u\n", m_match_hash_bits);
+      printf("Match hash bytes: %u\n", m_match_hash_bytes);
+      printf("Max parse threads: %u\n", m_max_parse_threads);
+      printf("Parse graph size: %u\n", m_parse_graph_size);
+      printf("Match finder: %u\n", m_match_finder);
+      printf("Prepare seed dictionary: %u\n", m_prepare_seed_dict);
+      printf("Test cloning: %u\n", m_test_clone);
+      printf("Independent segments: %u\n", m_independent_segments);
+      printf("Segment size log2: %u\n", m_segment_size_log2);
+      printf("Segment prime size: %u\n", m_segment_prime_size);
+      printf("Target compression rate: %u KB/s\n", m_target_comp_kb_per_sec);
+      printf("Mirrored dictionary: %u\n", m_mirrored_dict);
+      printf("Output ring: %u\n", m_output_ring);
+      printf("Output ring slack: %u\n", m_output_ring_slack);
+      printf("Full flushes: %u\n", m_full_flush);
    }
 
    lzham_compress_level m_comp_level;
@@ -143,7 +184,26 @@ struct comp_options
    bool m_extreme_parsing;
    bool m_deterministic_parsing;
    bool m_tradeoff_decomp_rate_for_comp_ratio;
+   bool m_long_range_matching;
+   bool m_speculative_parsing;
+   bool m_large_pages;
+   int m_numa_node;                    // -1 = OS default
    bool m_test_compressor_reinit;
+   uint m_match_hash_bits;             // 0 = automatic
+   uint m_match_hash_bytes;            // 0 = automatic
+   uint m_max_parse_threads;           // 0 = automatic
+   uint m_parse_graph_size;            // 0 = automatic
+   uint m_match_finder;                // lzham_match_finder
+   bool m_prepare_seed_dict;
+   bool m_test_clone;
+   bool m_independent_segments;
+   uint m_segment_size_log2;           // 0 = default
+   uint m_segment_prime_size;
+   uint m_target_comp_kb_per_sec;      // 0 = off
+   bool m_mirrored_dict;
+   bool m_output_ring;
+   uint m_output_ring_slack;           // bytes past the dictionary size
+   bool m_full_flush;
 };
 
 static void print_usage()
@@ -154,10 +214,13 @@ static void print_usage()
    printf("c - Compress \"infile\" to \"outfile\"\n");
    printf("d - Decompress \"infile\" to \"outfile\"\n");
    printf("a - Recursively compress all files under \"inpath\"\n");
+   printf("b - Benchmark \"infile\" in memory at every compression level\n");
    printf("\n");
    printf("Options:\n");
-   printf("-m[0-4] - Compression level: 0=fastest, 1=faster, 2=default, 3=better, 4=uber\n");
-   printf("          Default is uber (4).\n");
+   printf("-m[-2-4][,kb_per_sec] - Compression level: 0=fastest, 1=faster, 2=default, 3=better, 4=uber\n");
+   printf("          -2=greedy, -1=lazy (single probe hash table, no parse graph).\n");
+   printf("          Default is uber (4). With kb_per_sec, levels 0-4 drop to faster settings\n");
+   printf("          block by block whenever compression falls behind this rate.\n");
    printf("-d[15-29] - Set log2 dictionary size, max. is 26 on x86 platforms, 29 on x64.\n");
    printf("          Default is 26 (64MB) on x86, 28 (256MB) on x64.\n");
    printf("-c - Do not compute or verify adler32 checksum during decompression (faster).\n");
@@ -171,13 +234,37 @@ static void print_usage()
    printf("-x - Extreme parsing, for slight compression gain (Uber only, MUCH slower).\n");
    printf("-o - Permit the compressor to trade off decompression rate for higher ratios.\n");
    printf("     Note: This flag can drop the decompression rate by 30%% or more.\n");
+   printf("-l - Long range matching: find repeats of 512+ bytes anywhere in the dictionary\n");
+   printf("     (faster and better on archives or backups with duplicated files).\n");
+   printf("-j - Speculative parsing: parse jobs start from a predicted state instead\n");
+   printf("     of a partial state reset.\n");
+   printf("-z - Back the dictionaries and match finder with huge pages, and report how\n");
+   printf("     much of the process's memory ended up in transparent huge pages.\n");
+   printf("-b[node] - Allocate the huge page buffers from this NUMA node (with -z).\n");
    printf("-e - Enable deterministic parsing for slightly higher compression and\n");
    printf("     predictable output files when enabled, but less scalability.\n");
    printf("     The default is disabled, so the generated output data may slightly vary\n");
    printf("     between runs when multithreaded compression is enabled.\n");
    printf("-afilename Enable delta compression using the specified seed file.\n");
    printf("           The same seed file MUST be used for compression/decompression.\n");
+   printf("-k - Index the seed file once with lzham_compress_dict_init() and compress from\n");
+   printf("     the prepared dictionary (output is identical to plain -a).\n");
+   printf("-n - Swap the compressor and decompressor for clones of themselves halfway\n");
+   printf("     through each file (output is identical).\n");
    printf("-r - Use randomized parameters for each file.\n");
+   printf("-h[16-24] - Set log2 size of the match finder's hash table.\n");
+   printf("          Default is automatic (scaled with the dictionary size and level).\n");
+   printf("-g[3-4] - Number of bytes hashed by the match finder. Default is automatic.\n");
+   printf("-f[0-2] - Match finder: 0=default, 1=binary trees, 2=hash chains.\n");
+   printf("-y[1-64] - Max number of parse jobs run at once. Default is automatic.\n");
+   printf("-w[1024-16384] - Bytes optimized at once by each parse job. Default is automatic.\n");
+   printf("-q[20-26][,prime_bytes] - Compress independent segments of 2^N bytes in parallel,\n");
+   printf("          each able to see prime_bytes before it, and append a segment index.\n");
+   printf("--mirror - Decompress through a dictionary whose pages are mapped twice back to\n");
+   printf("           back (falls back to mirroring its first 64KB where that fails).\n");
+   printf("--ring[=slack] - Decompress into a caller owned output ring of the dictionary size\n");
+   printf("           plus slack bytes, taking the output from it in small random chunks.\n");
+   printf("--full-flush - Compress with a full flush after every %uKB of input.\n", LZHAMTEST_COMP_INPUT_BUFFER_SIZE / 1024);
 }
 
 static void print_error(const char *pMsg, ...)
@@ -194,6 +281,29 @@ static void print_error(const char *pMsg, ...)
    fprintf(stderr, "Error: %s", buf);
 }
 
+// Shows whether -z got its huge pages: on Linux, the amount of the process's anonymous memory currently backed by transparent huge pages.
+static void print_huge_page_usage()
+{
+#if defined(__linux__)
+   FILE *pFile = fopen("/proc/self/smaps_rollup", "r");
+   if (!pFile)
+      return;
+
+   char line[256];
+   while (fgets(line, sizeof(line), pFile))
+   {
+      unsigned long kb;
+      if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+      {
+         printf("Transparent huge pages in use: %lu MB\n", kb / 1024);
+         break;
+      }
+   }
+
+   fclose(pFile);
+#endif
+}
+
 static FILE* open_file_with_retries(const char *pFilename, const char* pMode)
 {
    const uint cNumRetries = 8;
@@ -327,6 +437,42 @@ static bool read_seed_file(const char *pSeed_filename, lzham_uint32 &num_seed_by
    return true;
 }
 
+static void init_comp_params(lzham_compress_params &params, const comp_options &options)
+{
+   memset(&params, 0, sizeof(params));
+   params.m_struct_size = sizeof(lzham_compress_params);
+   params.m_dict_size_log2 = options.m_dict_size_log2;
+   params.m_max_helper_threads = options.m_max_helper_threads;
+   params.m_level = options.m_comp_level;
+   if (options.m_force_polar_codes)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_FORCE_POLAR_CODING;
+   if (options.m_extreme_parsing)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_EXTREME_PARSING;
+   if (options.m_deterministic_parsing)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_DETERMINISTIC_PARSING;
+   if (options.m_tradeoff_decomp_rate_for_comp_ratio)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_TRADEOFF_DECOMPRESSION_RATE_FOR_COMP_RATIO;
+   if (options.m_long_range_matching)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_LONG_RANGE_MATCHING;
+   if (options.m_speculative_parsing)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_SPECULATIVE_PARSING;
+   if (options.m_large_pages)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_LARGE_PAGES;
+   params.m_numa_node = options.m_numa_node + 1;
+   params.m_match_hash_bits = options.m_match_hash_bits;
+   params.m_match_hash_bytes = options.m_match_hash_bytes;
+   params.m_max_parse_threads = options.m_max_parse_threads;
+   params.m_parse_graph_size = options.m_parse_graph_size;
+   params.m_match_finder = options.m_match_finder;
+   if (options.m_independent_segments)
+      params.m_compress_flags |= LZHAM_COMP_FLAG_INDEPENDENT_SEGMENTS;
+   params.m_segment_size_log2 = options.m_segment_size_log2;
+   params.m_segment_prime_size = options.m_segment_prime_size;
+   params.m_target_comp_kb_per_sec = options.m_target_comp_kb_per_sec;
+   params.m_cpucache_line_size = 0;
+   params.m_cpucache_total_lines = 0;
+}
+
 static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const char *pDst_filename, const comp_options &options, const char *pSeed_filename)
 {
    printf("Testing: Streaming compression\n");
@@ -387,21 +533,7 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
    timer_ticks start_time = timer::get_ticks();
 
    lzham_compress_params params;
-   memset(&params, 0, sizeof(params));
-   params.m_struct_size = sizeof(lzham_compress_params);
-   params.m_dict_size_log2 = options.m_dict_size_log2;
-   params.m_max_helper_threads = options.m_max_helper_threads;
-   params.m_level = options.m_comp_level;
-   if (options.m_force_polar_codes)
-      params.m_compress_flags |= LZHAM_COMP_FLAG_FORCE_POLAR_CODING;
-   if (options.m_extreme_parsing)
-      params.m_compress_flags |= LZHAM_COMP_FLAG_EXTREME_PARSING;
-   if (options.m_deterministic_parsing)
-      params.m_compress_flags |= LZHAM_COMP_FLAG_DETERMINISTIC_PARSING;
-   if (options.m_tradeoff_decomp_rate_for_comp_ratio)
-      params.m_compress_flags |= LZHAM_COMP_FLAG_TRADEOFF_DECOMPRESSION_RATE_FOR_COMP_RATIO;
-   params.m_cpucache_line_size = 0;
-   params.m_cpucache_total_lines = 0;
+   init_comp_params(params, options);
    
    if (pSeed_filename)
    {
@@ -415,10 +547,41 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
       }
    }
 
+   lzham_compress_dict_ptr pPrepared_dict = NULL;
+   if ((params.m_num_seed_bytes) && (options.m_prepare_seed_dict))
+   {
+      timer_ticks dict_start_time = timer::get_ticks();
+      pPrepared_dict = lzham_dll.lzham_compress_dict_init(&params);
+      timer_ticks total_dict_time = timer::get_ticks() - dict_start_time;
+
+      // The dictionary keeps its own copy of the seed bytes.
+      _aligned_free((void*)params.m_pSeed_bytes);
+      params.m_pSeed_bytes = NULL;
+      params.m_num_seed_bytes = 0;
+
+      if (!pPrepared_dict)
+      {
+         print_error("Failed preparing seed dictionary!\n");
+         _aligned_free(in_file_buf);
+         _aligned_free(out_file_buf);
+         fclose(pInFile);
+         fclose(pOutFile);
+         return false;
+      }
+
+      printf("lzham_compress_dict_init took %3.3fms\n", timer::ticks_to_secs(total_dict_time)*1000.0f);
+
+      params.m_pPrepared_dict = pPrepared_dict;
+   }
+
    timer_ticks init_start_time = timer::get_ticks();
    lzham_compress_state_ptr pComp_state = lzham_dll.lzham_compress_init(&params);
    timer_ticks total_init_time = timer::get_ticks() - init_start_time;
 
+   // The compressor holds its own reference to the dictionary.
+   if (pPrepared_dict)
+      lzham_dll.lzham_compress_dict_deinit(pPrepared_dict);
+
    if ((pComp_state) && (options.m_test_compressor_reinit))
    {
       if (!lzham_dll.lzham_compress_reinit(pComp_state))
@@ -447,6 +610,8 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
    uint total_passes = options.m_test_compressor_reinit ? 2 : 1;
    for (uint pass = 0; pass < total_passes; ++pass)
    {
+      bool cloned = false;
+
       for ( ; ; )
       {
          if (src_file_size)
@@ -490,7 +655,11 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
          uint8* pOut_bytes = out_file_buf;
          size_t out_num_bytes = cOutBufSize;
 
-         status = lzham_dll.lzham_compress(pComp_state, pIn_bytes, &num_in_bytes, pOut_bytes, &out_num_bytes, src_bytes_left == 0);
+         lzham_flush_t flush_type = options.m_full_flush ? LZHAM_FULL_FLUSH : LZHAM_NO_FLUSH;
+         if (!src_bytes_left)
+            flush_type = LZHAM_FINISH;
+
+         status = lzham_dll.lzham_compress2(pComp_state, pIn_bytes, &num_in_bytes, pOut_bytes, &out_num_bytes, flush_type);
 
          if (num_in_bytes)
          {
@@ -518,6 +687,31 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
          
          if (status >= LZHAM_COMP_STATUS_FIRST_SUCCESS_OR_FAILURE_CODE)
             break;
+
+         if ((options.m_test_clone) && (!cloned) && ((src_file_size - src_bytes_left) >= (src_file_size / 2)))
+         {
+            timer_ticks clone_start_time = timer::get_ticks();
+            lzham_compress_state_ptr pClone_state = lzham_dll.lzham_compress_clone(pComp_state);
+            timer_ticks total_clone_time = timer::get_ticks() - clone_start_time;
+
+            lzham_dll.lzham_compress_deinit(pComp_state);
+            pComp_state = pClone_state;
+
+            if (!pComp_state)
+            {
+               printf("\n");
+               print_error("Failed cloning compressor!\n");
+               _aligned_free(in_file_buf);
+               _aligned_free(out_file_buf);
+               fclose(pInFile);
+               fclose(pOutFile);
+               _aligned_free((void*)params.m_pSeed_bytes);
+               return false;
+            }
+
+            printf("lzham_compress_clone took %3.3fms\n", timer::ticks_to_secs(total_clone_time)*1000.0f);
+            cloned = true;
+         }
       }
 
 #ifdef LZHAM_PRINT_OUTPUT_PROGRESS
@@ -561,6 +755,9 @@ static bool compress_file(ilzham &lzham_dll, const char* pSrc_filename, const ch
 
    src_bytes_left += (in_file_buf_size - in_file_buf_ofs);
 
+   if (options.m_large_pages)
+      print_huge_page_usage();
+
    uint32 adler32 = lzham_dll.lzham_compress_deinit(pComp_state);
    pComp_state = NULL;
 
@@ -666,8 +863,13 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
       options.m_unbuffered_decompression = false;
    }
 
+   // With an output ring the decompressor uses out_file_buf as its dictionary and hands out its output in place.
+   const uint dict_mask = (1U << dict_size) - 1;
+
    if (options.m_unbuffered_decompression)
       printf("Testing: Unbuffered decompression\n");
+   else if (options.m_output_ring)
+      printf("Testing: Streaming decompression into an output ring\n");
    else
       printf("Testing: Streaming decompression\n");
 
@@ -675,6 +877,8 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
    uint8 *in_file_buf = static_cast<uint8*>(_aligned_malloc(cInBufSize, 16));
 
    uint out_buf_size = options.m_unbuffered_decompression ? static_cast<uint>(orig_file_size) : LZHAMTEST_DECOMP_OUTPUT_BUFFER_SIZE;
+   if (options.m_output_ring)
+      out_buf_size = dict_mask + 1 + options.m_output_ring_slack;
    uint8 *out_file_buf = static_cast<uint8*>(_aligned_malloc(out_buf_size, 16));
    if (!out_file_buf)
    {
@@ -699,6 +903,16 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
       params.m_decompress_flags |= LZHAM_DECOMP_FLAG_COMPUTE_ADLER32;
    if (options.m_unbuffered_decompression)
       params.m_decompress_flags |= LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED;
+   if (options.m_large_pages)
+      params.m_decompress_flags |= LZHAM_DECOMP_FLAG_LARGE_PAGES;
+   if (options.m_mirrored_dict)
+      params.m_decompress_flags |= LZHAM_DECOMP_FLAG_MIRRORED_DICT;
+   params.m_numa_node = options.m_numa_node + 1;
+   if (options.m_output_ring)
+   {
+      params.m_pOutput_ring = out_file_buf;
+      params.m_output_ring_size = out_buf_size;
+   }
 
    timer_ticks start_time = timer::get_ticks();
    double decomp_only_time = 0;
@@ -731,6 +945,11 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
 
    printf("lzham_decompress_init took %3.3fms\n", timer::ticks_to_secs(total_init_time)*1000.0f);
 
+   bool cloned = false;
+
+   // Where the next output byte lands in the ring, the seed bytes come first.
+   uint64 ring_ofs = params.m_num_seed_bytes;
+
    lzham_decompress_status_t status;
    for ( ; ; )
    {
@@ -759,6 +978,11 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
       size_t num_in_bytes = in_file_buf_size - in_file_buf_ofs;
       uint8* pOut_bytes = out_file_buf;
       size_t out_num_bytes = out_buf_size;
+      if (options.m_output_ring)
+      {
+         pOut_bytes = NULL;
+         out_num_bytes = 1 + (rand() % LZHAMTEST_DECOMP_RING_MAX_CHUNK_SIZE);
+      }
 
       {
          timer decomp_only_timer;
@@ -775,7 +999,25 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
 
       if (out_num_bytes)
       {
-         if (fwrite(out_file_buf, 1, static_cast<uint>(out_num_bytes), pOutFile) != out_num_bytes)
+         const uint8 *pOut_data = out_file_buf;
+         if (options.m_output_ring)
+         {
+            pOut_data = out_file_buf + static_cast<uint>(ring_ofs & dict_mask);
+            if (((ring_ofs & dict_mask) + out_num_bytes) > (dict_mask + 1))
+            {
+               print_error("Decompressor's output wrapped around the end of the output ring!\n");
+               _aligned_free(in_file_buf);
+               _aligned_free(out_file_buf);
+               _aligned_free((void*)params.m_pSeed_bytes);
+               lzham_dll.lzham_decompress_deinit(pDecomp_state);
+               fclose(pInFile);
+               fclose(pOutFile);
+               return false;
+            }
+            ring_ofs += out_num_bytes;
+         }
+
+         if (fwrite(pOut_data, 1, static_cast<uint>(out_num_bytes), pOutFile) != out_num_bytes)
          {
             print_error("Failure writing to destination file!\n");
             _aligned_free(in_file_buf);
@@ -803,21 +1045,50 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
 
       if (status >= LZHAM_DECOMP_STATUS_FIRST_SUCCESS_OR_FAILURE_CODE)
          break;
+
+      // Unbuffered and output ring decompressors write straight into the caller's buffer, so they can't be cloned.
+      if ((options.m_test_clone) && (!cloned) && (!options.m_unbuffered_decompression) && (!options.m_output_ring) && (dst_bytes_left <= (orig_file_size / 2)))
+      {
+         timer_ticks clone_start_time = timer::get_ticks();
+         lzham_decompress_state_ptr pClone_state = lzham_dll.lzham_decompress_clone(pDecomp_state);
+         timer_ticks total_clone_time = timer::get_ticks() - clone_start_time;
+
+         lzham_dll.lzham_decompress_deinit(pDecomp_state);
+         pDecomp_state = pClone_state;
+
+         if (!pDecomp_state)
+         {
+            print_error("Failed cloning decompressor!\n");
+            _aligned_free(in_file_buf);
+            _aligned_free(out_file_buf);
+            _aligned_free((void*)params.m_pSeed_bytes);
+            fclose(pInFile);
+            fclose(pOutFile);
+            return false;
+         }
+
+         printf("lzham_decompress_clone took %3.3fms\n", timer::ticks_to_secs(total_clone_time)*1000.0f);
+         cloned = true;
+      }
    }
    _aligned_free(in_file_buf);
    in_file_buf = NULL;
 
-   _aligned_free(out_file_buf);
-   out_file_buf = NULL;
-
    _aligned_free((void*)params.m_pSeed_bytes);
    params.m_pSeed_bytes = NULL;
 
    src_bytes_left += (in_file_buf_size - in_file_buf_ofs);
 
+   if (options.m_large_pages)
+      print_huge_page_usage();
+
    uint32 adler32 = lzham_dll.lzham_decompress_deinit(pDecomp_state);
    pDecomp_state = NULL;
 
+   // An output ring has to outlive its decompressor.
+   _aligned_free(out_file_buf);
+   out_file_buf = NULL;
+
    timer_ticks end_time = timer::get_ticks();
    double total_time = timer::ticks_to_secs(my_max(1, end_time - start_time));
 
@@ -853,6 +1124,127 @@ static bool decompress_file(ilzham &lzham_dll, const char* pSrc_filename, const
    return true;
 }
 
+static bool benchmark_file(ilzham &lzham_dll, const char* pSrc_filename, const comp_options &options)
+{
+   printf("Testing: In-memory benchmark\n");
+
+   FILE *pInFile = fopen(pSrc_filename, "rb");
+   if (!pInFile)
+   {
+      print_error("Unable to read file: %s\n", pSrc_filename);
+      return false;
+   }
+
+   _fseeki64(pInFile, 0, SEEK_END);
+   uint64 src_file_size = _ftelli64(pInFile);
+   _fseeki64(pInFile, 0, SEEK_SET);
+
+   if (src_file_size > 0x7FFFFFFF)
+   {
+      print_error("File is too large to benchmark in memory: %s\n", pSrc_filename);
+      fclose(pInFile);
+      return false;
+   }
+
+   const size_t src_size = static_cast<size_t>(src_file_size);
+   const size_t cmp_buf_size = static_cast<size_t>(lzham_dll.lzham_z_compressBound(static_cast<lzham_z_ulong>(src_size)));
+
+   uint8 *pSrc_buf = static_cast<uint8*>(_aligned_malloc(my_max(src_size, 1U), 16));
+   uint8 *pCmp_buf = static_cast<uint8*>(_aligned_malloc(cmp_buf_size, 16));
+   uint8 *pDecomp_buf = static_cast<uint8*>(_aligned_malloc(my_max(src_size, 1U), 16));
+   if ((!pSrc_buf) || (!pCmp_buf) || (!pDecomp_buf))
+   {
+      print_error("Out of memory!\n");
+      _aligned_free(pSrc_buf);
+      _aligned_free(pCmp_buf);
+      _aligned_free(pDecomp_buf);
+      fclose(pInFile);
+      return false;
+   }
+
+   bool status = (fread(pSrc_buf, 1, src_size, pInFile) == src_size);
+   fclose(pInFile);
+   if (!status)
+      print_error("Failed reading from input file!\n");
+
+   static const struct
+   {
+      lzham_compress_level m_level;
+      const char *m_pName;
+   } s_levels[] =
+   {
+      { LZHAM_COMP_LEVEL_GREEDY, "greedy" },
+      { LZHAM_COMP_LEVEL_LAZY, "lazy" },
+      { LZHAM_COMP_LEVEL_FASTEST, "fastest" },
+      { LZHAM_COMP_LEVEL_FASTER, "faster" },
+      { LZHAM_COMP_LEVEL_DEFAULT, "default" },
+      { LZHAM_COMP_LEVEL_BETTER, "better" },
+      { LZHAM_COMP_LEVEL_UBER, "uber" }
+   };
+
+   printf("Input file size: " QUAD_INT_FMT "\n", src_file_size);
+   printf("%-8s %12s %8s %12s %12s\n", "Level", "Comp size", "Ratio", "Comp MB/s", "Decomp MB/s");
+
+   for (uint i = 0; (status) && (i < sizeof(s_levels) / sizeof(s_levels[0])); i++)
+   {
+      lzham_compress_params comp_params;
+      init_comp_params(comp_params, options);
+      comp_params.m_level = s_levels[i].m_level;
+
+      size_t cmp_len = cmp_buf_size;
+      lzham_uint32 comp_adler32 = 0;
+
+      timer_ticks comp_start_time = timer::get_ticks();
+      lzham_compress_status_t comp_status = lzham_dll.lzham_compress_memory(&comp_params, pCmp_buf, &cmp_len, pSrc_buf, src_size, &comp_adler32);
+      double comp_time = timer::ticks_to_secs(my_max(1, timer::get_ticks() - comp_start_time));
+      if (comp_status != LZHAM_COMP_STATUS_SUCCESS)
+      {
+         print_error("Compression failed at level %s with status %i!\n", s_levels[i].m_pName, comp_status);
+         status = false;
+         break;
+      }
+
+      lzham_decompress_params decomp_params;
+      memset(&decomp_params, 0, sizeof(decomp_params));
+      decomp_params.m_struct_size = sizeof(decomp_params);
+      decomp_params.m_dict_size_log2 = options.m_dict_size_log2;
+      if (options.m_compute_adler32_during_decomp)
+         decomp_params.m_decompress_flags |= LZHAM_DECOMP_FLAG_COMPUTE_ADLER32;
+
+      size_t decomp_len = src_size;
+      lzham_uint32 decomp_adler32 = 0;
+
+      timer_ticks decomp_start_time = timer::get_ticks();
+      lzham_decompress_status_t decomp_status = lzham_dll.lzham_decompress_memory(&decomp_params, pDecomp_buf, &decomp_len, pCmp_buf, cmp_len, &decomp_adler32);
+      double decomp_time = timer::ticks_to_secs(my_max(1, timer::get_ticks() - decomp_start_time));
+      if (decomp_status != LZHAM_DECOMP_STATUS_SUCCESS)
+      {
+         print_error("Decompression failed at level %s with status %i!\n", s_levels[i].m_pName, decomp_status);
+         status = false;
+         break;
+      }
+
+      if ((decomp_len != src_size) || (memcmp(pDecomp_buf, pSrc_buf, src_size)) || ((options.m_compute_adler32_during_decomp) && (comp_adler32 != decomp_adler32)))
+      {
+         print_error("Decompressed data mismatch at level %s!\n", s_levels[i].m_pName);
+         status = false;
+         break;
+      }
+
+      const double mb = src_size / (1024.0f * 1024.0f);
+      printf("%-8s %12u %7.2f%% %12.2f %12.2f\n", s_levels[i].m_pName, (uint)cmp_len, src_size ? (cmp_len * 100.0f / src_size) : 0.0f, mb / comp_time, mb / decomp_time);
+   }
+
+   _aligned_free(pSrc_buf);
+   _aligned_free(pCmp_buf);
+   _aligned_free(pDecomp_buf);
+
+   if (status)
+      printf("Success\n");
+
+   return status;
+}
+
 static bool compare_files(const char *pFilename1, const char* pFilename2)
 {
    FILE* pFile1 = open_file_with_retries(pFilename1, "rb");
@@ -1148,6 +1540,11 @@ static bool test_recursive(ilzham &lzham_dll, const char *pPath, comp_options op
          file_options.m_force_polar_codes = (rand() & 1) != 0;
          file_options.m_deterministic_parsing = (rand() & 1) != 0;
          file_options.m_tradeoff_decomp_rate_for_comp_ratio = (rand() & 1) != 0;
+         file_options.m_long_range_matching = (rand() & 1) != 0;
+         file_options.m_speculative_parsing = (rand() & 1) != 0;
+         file_options.m_mirrored_dict = (rand() & 1) != 0;
+         file_options.m_output_ring = (!file_options.m_unbuffered_decompression) && ((rand() & 1) != 0);
+         file_options.m_output_ring_slack = (rand() & 1) ? (rand() % 65537) : 0;
          //file_options.m_test_compressor_reinit = (rand() & 1) != 0;
 
          file_options.print();
@@ -1254,7 +1651,8 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
       OP_MODE_INVALID = -1,
       OP_MODE_COMPRESS = 0,
       OP_MODE_DECOMPRESS = 1,
-      OP_MODE_ALL = 2
+      OP_MODE_ALL = 2,
+      OP_MODE_BENCHMARK = 3
    };
 
    op_mode_t op_mode = OP_MODE_INVALID;
@@ -1290,13 +1688,24 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
             }
             case 'm':
             {
-               int comp_level = atoi(str.c_str() + 2);
-               if ((comp_level < 0) || (comp_level > (int)LZHAM_COMP_LEVEL_UBER))
+               if ((str.size() <= 2) || (str[2] != ','))
                {
-                  print_error("Invalid compression level: %s\n", str.c_str());
-                  return EXIT_FAILURE;
+                  int comp_level = atoi(str.c_str() + 2);
+                  if ((comp_level < -2) || (comp_level > (int)LZHAM_COMP_LEVEL_UBER))
+                  {
+                     print_error("Invalid compression level: %s\n", str.c_str());
+                     return EXIT_FAILURE;
+                  }
+                  if (comp_level == -2)
+                     options.m_comp_level = LZHAM_COMP_LEVEL_GREEDY;
+                  else if (comp_level == -1)
+                     options.m_comp_level = LZHAM_COMP_LEVEL_LAZY;
+                  else
+                     options.m_comp_level = static_cast<lzham_compress_level>(comp_level);
                }
-               options.m_comp_level = static_cast<lzham_compress_level>(comp_level);
+               const char *pRate = strchr(str.c_str(), ',');
+               if (pRate)
+                  options.m_target_comp_kb_per_sec = atoi(pRate + 1);
                break;
             }
             case 't':
@@ -1345,12 +1754,110 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
                options.m_tradeoff_decomp_rate_for_comp_ratio = true;
                break;
             }
+            case 'l':
+            {
+               options.m_long_range_matching = true;
+               break;
+            }
+            case 'j':
+            {
+               options.m_speculative_parsing = true;
+               break;
+            }
+            case 'z':
+            {
+               options.m_large_pages = true;
+               break;
+            }
+            case 'b':
+            {
+               options.m_numa_node = atoi(str.c_str() + 2);
+               if ((options.m_numa_node < 0) || (options.m_numa_node > 63))
+               {
+                  print_error("Invalid NUMA node: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               break;
+            }
             case 'i':
             {
                options.m_test_compressor_reinit = true;
                options.m_deterministic_parsing = true;
                break;
             }
+            case 'h':
+            {
+               int hash_bits = atoi(str.c_str() + 2);
+               if ((hash_bits < LZHAM_MIN_MATCH_HASH_BITS) || (hash_bits > LZHAM_MAX_MATCH_HASH_BITS))
+               {
+                  print_error("Invalid match hash bits: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               options.m_match_hash_bits = hash_bits;
+               break;
+            }
+            case 'g':
+            {
+               int hash_bytes = atoi(str.c_str() + 2);
+               if ((hash_bytes != 3) && (hash_bytes != 4))
+               {
+                  print_error("Invalid match hash bytes: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               options.m_match_hash_bytes = hash_bytes;
+               break;
+            }
+            case 'y':
+            {
+               int parse_threads = atoi(str.c_str() + 2);
+               if ((parse_threads < 1) || (parse_threads > LZHAM_MAX_PARSE_THREADS))
+               {
+                  print_error("Invalid max parse threads: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               options.m_max_parse_threads = parse_threads;
+               break;
+            }
+            case 'w':
+            {
+               int graph_size = atoi(str.c_str() + 2);
+               if ((graph_size < LZHAM_MIN_PARSE_GRAPH_SIZE) || (graph_size > LZHAM_MAX_PARSE_GRAPH_SIZE))
+               {
+                  print_error("Invalid parse graph size: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               options.m_parse_graph_size = graph_size;
+               break;
+            }
+            case 'f':
+            {
+               int match_finder = atoi(str.c_str() + 2);
+               if ((match_finder < 0) || (match_finder >= static_cast<int>(LZHAM_TOTAL_MATCH_FINDERS)))
+               {
+                  print_error("Invalid match finder: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               options.m_match_finder = match_finder;
+               break;
+            }
+            case 'q':
+            {
+               options.m_independent_segments = true;
+               if ((str.size() > 2) && (str[2] != ','))
+               {
+                  int segment_size_log2 = atoi(str.c_str() + 2);
+                  if ((segment_size_log2 < LZHAM_MIN_SEGMENT_SIZE_LOG2) || (segment_size_log2 > LZHAM_MAX_SEGMENT_SIZE_LOG2))
+                  {
+                     print_error("Invalid segment size: %s\n", str.c_str());
+                     return EXIT_FAILURE;
+                  }
+                  options.m_segment_size_log2 = segment_size_log2;
+               }
+               const char *pPrime = strchr(str.c_str(), ',');
+               if (pPrime)
+                  options.m_segment_prime_size = atoi(pPrime + 1);
+               break;
+            }
             case 's':
             {
                int seed = atoi(str.c_str() + 2);
@@ -1358,6 +1865,16 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
                printf("Using random seed: %i\n", seed);
                break;
             }
+            case 'k':
+            {
+               options.m_prepare_seed_dict = true;
+               break;
+            }
+            case 'n':
+            {
+               options.m_test_clone = true;
+               break;
+            }
             case 'a':
             {
                seed_filename = str.c_str() + 2;
@@ -1369,6 +1886,34 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
                printf("Seed filename: %s\n", seed_filename.c_str());
                break;
             }
+            case '-':
+            {
+               // Long options, for decompressor modes the single letters ran out before.
+               if (str == "--mirror")
+                  options.m_mirrored_dict = true;
+               else if (str == "--full-flush")
+                  options.m_full_flush = true;
+               else if ((str == "--ring") || (str.compare(0, 7, "--ring=") == 0))
+               {
+                  options.m_output_ring = true;
+                  if (str.size() > 7)
+                  {
+                     int slack = atoi(str.c_str() + 7);
+                     if ((slack < 0) || (slack > 16*1024*1024))
+                     {
+                        print_error("Invalid output ring slack: %s\n", str.c_str());
+                        return EXIT_FAILURE;
+                     }
+                     options.m_output_ring_slack = slack;
+                  }
+               }
+               else
+               {
+                  print_error("Invalid option: %s\n", str.c_str());
+                  return EXIT_FAILURE;
+               }
+               break;
+            }
             default:
             {
                print_error("Invalid option: %s\n", str.c_str());
@@ -1388,6 +1933,18 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
          return EXIT_FAILURE;
       }
 
+      if ((options.m_unbuffered_decompression) && (options.m_output_ring))
+      {
+         print_error("Unbuffered decompression is not compatible with output rings!\n");
+         return EXIT_FAILURE;
+      }
+
+      if ((options.m_unbuffered_decompression) && (options.m_full_flush))
+      {
+         print_error("Unbuffered decompression is not compatible with full flushes!\n");
+         return EXIT_FAILURE;
+      }
+
       if (str.size() != 1)
       {
          print_error("Invalid mode: %s\n", str.c_str());
@@ -1410,6 +1967,11 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
             op_mode = OP_MODE_ALL;
             break;
          }
+         case 'b':
+         {
+            op_mode = OP_MODE_BENCHMARK;
+            break;
+         }
          default:
          {
             print_error("Invalid mode: %s\n", str.c_str());
@@ -1519,6 +2081,17 @@ int main_internal(string_array cmd_line, int num_helper_threads, ilzham &lzham_d
             exit_status = EXIT_SUCCESS;
          break;
       }
+      case OP_MODE_BENCHMARK:
+      {
+         if (cmd_line.size() != 1)
+         {
+            print_error("Must specify a single input filename!\n");
+            return EXIT_FAILURE;
+         }
+         if (benchmark_file(lzham_dll, cmd_line[0].c_str(), options))
+            exit_status = EXIT_SUCCESS;
+         break;
+      }
       default:
       {
          print_error("No mode specified!\n");